@@ -0,0 +1,60 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include "../inc/crypt.hpp"
+
+// ns per op, run for at least min_ms
+double
+latency(std::function<void()> op, int min_ms = 1000) {
+  using namespace std::chrono;
+  size_t ops = 0;
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::duration elapsed;
+  do {
+    op();
+    ops++;
+    elapsed = steady_clock::now() - start;
+  } while (elapsed < milliseconds(min_ms));
+  return duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int
+main() {
+  std::string key = cAES::keygen();
+  cAES::Session session(key);
+
+  std::cout << std::left << std::setw(10) << "bytes"
+    << std::right << std::setw(14) << "enc ns"
+    << std::setw(14) << "session ns"
+    << std::setw(14) << "dec ns"
+    << std::setw(14) << "session ns" << std::endl;
+
+  for (size_t len : {16, 64, 256, 1024, 4096}) {
+    std::string msg(len, 'm');
+    std::array<std::string, 2> sealed = cAES::encrypt(key, msg);
+
+    // sessions must stay interoperable with the one-shot calls
+    if (session.decrypt(sealed[1], sealed[0]) != msg) {
+      std::cerr << "session failed to decrypt one-shot output" << std::endl;
+      return 1;
+    }
+    std::array<std::string, 2> session_sealed = session.encrypt(msg);
+    if (cAES::decrypt(key, session_sealed[1], session_sealed[0]) != msg) {
+      std::cerr << "one-shot failed to decrypt session output" << std::endl;
+      return 1;
+    }
+
+    std::cout << std::left << std::setw(10) << len
+      << std::right << std::fixed << std::setprecision(0)
+      << std::setw(14) << latency([&]{ cAES::encrypt(key, msg); })
+      << std::setw(14) << latency([&]{ session.encrypt(msg); })
+      << std::setw(14) << latency([&]{ cAES::decrypt(key, sealed[1], sealed[0]); })
+      << std::setw(14) << latency([&]{ session.decrypt(sealed[1], sealed[0]); })
+      << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <nlohmann/json.hpp>
+
+/**
+ * \brief Microbenchmark harness shared by the suite benches
+ *
+ * Each bench adds its cases and hands main's arguments to run(). Flags:
+ *  --filter=<substr>     only run cases whose name contains substr
+ *  --min-time=<secs>     time each case for at least this long (default 0.5)
+ *  --json=<path>         write results as JSON, "-" for stdout
+ *  --compare=<path>      diff against a JSON baseline written by --json
+ *  --threshold=<pct>     slowdown that counts as a regression (default 10)
+ * With --compare, run() returns 1 if any case regressed, so make targets fail on it.
+ */
+namespace bench {
+  /**
+   * \brief Handed to each case; the case loops while keep_running()
+   */
+  class state {
+  public:
+    state(std::vector<long> args, size_t iterations) : args(args), target(iterations) {}
+
+    /**
+     * \brief Truth state of another iteration being wanted
+     *
+     * The clock starts on the first call, so setup before the loop isn't timed.
+     */
+    bool keep_running() {
+      if (!this->started) {
+        this->started = true;
+        this->start = clock::now();
+      }
+      if (this->done < this->target) {
+        this->done++;
+        return true;
+      }
+      pause();
+      return false;
+    }
+
+    /**
+     * \brief Stop the clock, for per-iteration setup
+     */
+    void pause() {
+      if (this->paused) return;
+      this->elapsed += clock::now() - this->start;
+      this->paused = true;
+    }
+
+    /**
+     * \brief Restart the clock after pause()
+     */
+    void resume() {
+      this->paused = false;
+      this->start = clock::now();
+    }
+
+    /**
+     * \brief Argument i of the case, e.g. a batch size
+     */
+    long arg(size_t i) const {return (this->args).at(i);}
+
+    /**
+     * \brief Items handled per iteration, reported as items/s
+     */
+    void set_items(size_t items) {this->items = items;}
+
+    size_t iterations() const {return this->target;}
+    double seconds() const {return std::chrono::duration<double>(this->elapsed).count();}
+    size_t items_per_iteration() const {return this->items;}
+
+  private:
+    using clock = std::chrono::steady_clock;
+    std::vector<long> args;
+    size_t target;
+    size_t done = 0;
+    size_t items = 0;
+    bool started = false;
+    bool paused = false;
+    clock::time_point start;
+    clock::duration elapsed = clock::duration::zero();
+  };
+
+  /**
+   * \brief A named case, run once per argument list
+   */
+  struct bench_case {
+    std::string name;
+    std::function<void(state&)> fn;
+    std::vector<std::vector<long>> arg_sets;
+    size_t iterations; /**< Fixed iteration count, or 0 to calibrate against min_time */
+  };
+
+  /**
+   * \brief One measured case
+   */
+  struct result {
+    std::string name;
+    size_t iterations;
+    double ns_per_op;
+    double items_per_sec;
+  };
+
+  /**
+   * \brief Keep a result alive, so the optimizer can't drop the work behind it
+   */
+  template<class T>
+  inline void
+  keep(T&& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+  }
+
+  inline std::vector<bench_case>&
+  registry() {
+    static std::vector<bench_case> cases;
+    return cases;
+  }
+
+  /**
+   * \brief Add a case
+   * \param name Case name; each argument list is appended as /a/b
+   * \param fn Case body
+   * \param arg_sets Argument lists to run fn with, none for a single run
+   * \param iterations Fixed iteration count, for cases whose untimed setup dwarfs the timed part
+   */
+  inline void
+  add(std::string name, std::function<void(state&)> fn, std::vector<std::vector<long>> arg_sets = {{}}, size_t iterations = 0) {
+    registry().push_back({name, fn, arg_sets, iterations});
+  }
+
+  inline std::string
+  full_name(const std::string& name, const std::vector<long>& args) {
+    std::string out = name;
+    for (long a : args) out += "/" + std::to_string(a);
+    return out;
+  }
+
+  /**
+   * \brief Time fn, growing the iteration count until a run lasts min_time
+   */
+  inline result
+  measure(const std::string& name, const bench_case& c, const std::vector<long>& args, double min_time) {
+    size_t iterations = c.iterations ? c.iterations : 1;
+    while (true) {
+      state st(args, iterations);
+      (c.fn)(st);
+      double secs = st.seconds();
+      if (c.iterations || secs >= min_time || iterations >= 1000000000) {
+        double ns = secs * 1e9 / iterations;
+        double items = st.items_per_iteration() && secs > 0 ? st.items_per_iteration() * iterations / secs : 0;
+        return {name, iterations, ns, items};
+      }
+      // aim a little past min_time, without jumping more than 10x on a noisy short run
+      double scale = secs > 0 ? min_time * 1.4 / secs : 10;
+      iterations = std::max<size_t>(iterations + 1, iterations * std::min(scale, 10.0));
+    }
+  }
+
+  inline std::string
+  human_ns(double ns) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(ns < 10 ? 2 : ns < 1000 ? 1 : 0);
+    if (ns < 1e3) out << ns << " ns";
+    else if (ns < 1e6) out << ns / 1e3 << " us";
+    else if (ns < 1e9) out << ns / 1e6 << " ms";
+    else out << ns / 1e9 << " s";
+    return out.str();
+  }
+
+  inline nlohmann::json
+  to_json(const std::vector<result>& results) {
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::gmtime(&now));
+
+    nlohmann::json out;
+    out["context"]["date"] = date;
+    out["context"]["threads"] = std::thread::hardware_concurrency();
+    out["benchmarks"] = nlohmann::json::array();
+    for (const auto& r : results) {
+      out["benchmarks"].push_back({
+          {"name", r.name},
+          {"iterations", r.iterations},
+          {"ns_per_op", r.ns_per_op},
+          {"items_per_sec", r.items_per_sec}
+          });
+    }
+    return out;
+  }
+
+  /**
+   * \brief Print each case against the baseline
+   * \returns Number of cases slower than the baseline by more than threshold percent
+   */
+  inline int
+  compare(const std::vector<result>& results, const nlohmann::json& baseline, double threshold) {
+    std::map<std::string, double> base_ns;
+    for (const auto& b : baseline.at("benchmarks")) base_ns[b.at("name")] = b.at("ns_per_op");
+
+    std::cout << std::endl << std::left << std::setw(40) << "compare"
+      << std::right << std::setw(14) << "baseline"
+      << std::setw(14) << "now"
+      << std::setw(10) << "change" << std::endl;
+
+    int regressions = 0;
+    for (const auto& r : results) {
+      std::cout << std::left << std::setw(40) << r.name << std::right;
+      if (!base_ns.contains(r.name) || base_ns[r.name] <= 0) {
+        std::cout << std::setw(14) << "-" << std::setw(14) << human_ns(r.ns_per_op) << std::setw(10) << "new" << std::endl;
+        continue;
+      }
+      double change = (r.ns_per_op / base_ns[r.name] - 1) * 100;
+      bool regressed = change > threshold;
+      regressions += regressed;
+      std::cout << std::setw(14) << human_ns(base_ns[r.name])
+        << std::setw(14) << human_ns(r.ns_per_op)
+        << std::setw(9) << std::showpos << std::fixed << std::setprecision(1) << change << std::noshowpos << "%"
+        << (regressed ? "  REGRESSED" : "") << std::endl;
+    }
+    return regressions;
+  }
+
+  /**
+   * \brief Run every added case that matches the flags
+   * \returns Process exit status
+   */
+  inline int
+  run(int argc, char** argv) {
+    std::string filter, json_path, compare_path;
+    double min_time = 0.5, threshold = 10;
+    for (int i = 1; i < argc; i++) {
+      std::string flag = argv[i];
+      auto value = [&flag](std::string prefix) {return flag.substr(prefix.size());};
+      if (flag.starts_with("--filter=")) filter = value("--filter=");
+      else if (flag.starts_with("--min-time=")) min_time = std::stod(value("--min-time="));
+      else if (flag.starts_with("--json=")) json_path = value("--json=");
+      else if (flag.starts_with("--compare=")) compare_path = value("--compare=");
+      else if (flag.starts_with("--threshold=")) threshold = std::stod(value("--threshold="));
+      else {
+        std::cerr << "unknown flag " << flag << std::endl;
+        return 2;
+      }
+    }
+
+    // read the baseline first, so a bad path fails before minutes of timing
+    nlohmann::json baseline;
+    if (!compare_path.empty()) {
+      std::ifstream in(compare_path);
+      if (!in) {
+        std::cerr << "can't read baseline " << compare_path << std::endl;
+        return 2;
+      }
+      baseline = nlohmann::json::parse(in);
+    }
+
+    std::cout << std::left << std::setw(40) << "case"
+      << std::right << std::setw(14) << "time/op"
+      << std::setw(14) << "iterations"
+      << std::setw(14) << "items/s" << std::endl;
+
+    std::vector<result> results;
+    for (const auto& c : registry()) {
+      for (const auto& args : c.arg_sets) {
+        std::string name = full_name(c.name, args);
+        if (!filter.empty() && name.find(filter) == std::string::npos) continue;
+        result r = measure(name, c, args, min_time);
+        std::cout << std::left << std::setw(40) << r.name
+          << std::right << std::setw(14) << human_ns(r.ns_per_op)
+          << std::setw(14) << r.iterations
+          << std::setw(14) << std::fixed << std::setprecision(0) << r.items_per_sec << std::endl;
+        results.push_back(r);
+      }
+    }
+
+    if (json_path == "-") std::cout << to_json(results).dump(2) << std::endl;
+    else if (!json_path.empty()) {
+      std::ofstream out(json_path);
+      out << to_json(results).dump(2) << std::endl;
+      if (!out) {
+        std::cerr << "can't write " << json_path << std::endl;
+        return 2;
+      }
+    }
+
+    if (!compare_path.empty() && compare(results, baseline, threshold) > 0) return 1;
+    return 0;
+  }
+}
+
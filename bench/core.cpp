@@ -0,0 +1,52 @@
+#include <string>
+#include <unordered_set>
+
+#include "bench.hpp"
+#include "../inc/tree.hpp"
+
+int
+main(int argc, char** argv) {
+  bench::add("miner/generate_valid_nonce", [](bench::state& st) {
+    Miner miner(st.arg(0));
+    std::string content = std::string(256, 'c');
+    while (st.keep_running()) bench::keep(miner.generate_valid_nonce(false, content));
+  }, {{0}, {1}, {2}, {3}});
+
+  bench::add("block/hash_concat", [](bench::state& st) {
+    block b(std::string(st.arg(0), 'c'), {std::string(64, 'a'), std::string(64, 'b')}, 0, std::string(24, 's'));
+    while (st.keep_running()) bench::keep(b.hash_concat());
+  }, {{64}, {1024}, {16384}});
+
+  // rehash is the full check get_valid runs; without it only the stored hash is held to pow
+  bench::add("block/verify", [](bench::state& st) {
+    block b(std::string(st.arg(0), 'c'), {std::string(64, 'a')}, 1, std::string(24, 's'));
+    bool rehash = st.arg(1);
+    while (st.keep_running()) bench::keep(b.verify(1, rehash));
+  }, {{64, 1}, {1024, 1}, {16384, 1}, {1024, 0}});
+
+  bench::add("b64/encode", [](bench::state& st) {
+    std::string raw = gen::string(st.arg(0));
+    st.set_items(raw.size());
+    while (st.keep_running()) bench::keep(b64::encode(raw));
+  }, {{16}, {1024}, {65536}});
+
+  bench::add("b64/decode", [](bench::state& st) {
+    std::string encoded = b64::encode(gen::string(st.arg(0)));
+    st.set_items(st.arg(0));
+    while (st.keep_running()) bench::keep(b64::decode(encoded));
+  }, {{16}, {1024}, {65536}});
+
+  bench::add("hex/encode", [](bench::state& st) {
+    std::string raw = gen::string(st.arg(0));
+    st.set_items(raw.size());
+    while (st.keep_running()) bench::keep(hex::encode(raw));
+  }, {{32}, {1024}, {65536}});
+
+  bench::add("hex/decode", [](bench::state& st) {
+    std::string encoded = hex::encode(gen::string(st.arg(0)));
+    st.set_items(st.arg(0));
+    while (st.keep_running()) bench::keep(hex::decode(encoded));
+  }, {{32}, {1024}, {65536}});
+
+  return bench::run(argc, argv);
+}
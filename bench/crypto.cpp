@@ -0,0 +1,87 @@
+#include <array>
+#include <string>
+
+#include "bench.hpp"
+#include "../inc/crypt.hpp"
+
+// keygen is slow enough to dominate a run, so every case shares one set
+struct keys {
+  std::string aes = cAES::keygen();
+  std::array<std::string, 2> dsa = cDSA::keygen();
+  std::array<std::string, 2> ed = cDSA::keygen(cDSA::Alg::ED25519);
+  std::array<std::string, 2> rsa = cRSA::keygen();
+};
+
+keys&
+shared_keys() {
+  static keys k;
+  return k;
+}
+
+int
+main(int argc, char** argv) {
+  bench::add("cAES/encrypt", [](bench::state& st) {
+    std::string msg(st.arg(0), 'm');
+    st.set_items(msg.size());
+    while (st.keep_running()) bench::keep(cAES::encrypt(shared_keys().aes, msg));
+  }, {{64}, {4096}, {65536}});
+
+  bench::add("cAES/decrypt", [](bench::state& st) {
+    std::array<std::string, 2> sealed = cAES::encrypt(shared_keys().aes, std::string(st.arg(0), 'm'));
+    st.set_items(st.arg(0));
+    while (st.keep_running()) bench::keep(cAES::decrypt(shared_keys().aes, sealed[1], sealed[0]));
+  }, {{64}, {4096}, {65536}});
+
+  bench::add("cAES/session_encrypt", [](bench::state& st) {
+    cAES::Session session(shared_keys().aes);
+    std::string msg(st.arg(0), 'm');
+    st.set_items(msg.size());
+    while (st.keep_running()) bench::keep(session.encrypt(msg));
+  }, {{64}, {4096}, {65536}});
+
+  bench::add("cRSA/encrypt", [](bench::state& st) {
+    cRSA::PubKey pub(shared_keys().rsa[1]);
+    std::string msg(64, 'm');
+    while (st.keep_running()) bench::keep(cRSA::encrypt(pub, msg));
+  });
+
+  bench::add("cRSA/decrypt", [](bench::state& st) {
+    cRSA::PriKey pri(shared_keys().rsa[0]);
+    std::string cipher = cRSA::encrypt(cRSA::PubKey(shared_keys().rsa[1]), std::string(64, 'm'));
+    while (st.keep_running()) bench::keep(cRSA::decrypt(pri, cipher));
+  });
+
+  // scheme: 1 DSA, 2 Ed25519
+  bench::add("cDSA/sign", [](bench::state& st) {
+    cDSA::Alg alg = (cDSA::Alg) st.arg(0);
+    cDSA::PriKey pri(alg == cDSA::Alg::DSA ? shared_keys().dsa[0] : shared_keys().ed[0], alg);
+    std::string msg(256, 'm');
+    while (st.keep_running()) bench::keep(cDSA::sign(pri, msg));
+  }, {{1}, {2}});
+
+  bench::add("cDSA/verify", [](bench::state& st) {
+    cDSA::Alg alg = (cDSA::Alg) st.arg(0);
+    std::array<std::string, 2>& pair = alg == cDSA::Alg::DSA ? shared_keys().dsa : shared_keys().ed;
+    cDSA::PubKey pub(pair[1], alg);
+    std::string msg(256, 'm');
+    std::string sig = cDSA::sign(cDSA::PriKey(pair[0], alg), msg);
+    while (st.keep_running()) bench::keep(cDSA::verify(pub, sig, msg));
+  }, {{1}, {2}});
+
+  bench::add("cMSG/lock", [](bench::state& st) {
+    cDSA::PriKey dsa_pri(shared_keys().dsa[0]);
+    cRSA::PubKey rsa_pub(shared_keys().rsa[1]);
+    std::string msg(st.arg(0), 'm');
+    st.set_items(msg.size());
+    while (st.keep_running()) bench::keep(cMSG::lock(msg, true, dsa_pri, "", rsa_pub));
+  }, {{256}, {65536}});
+
+  bench::add("cMSG/unlock", [](bench::state& st) {
+    cRSA::PriKey rsa_pri(shared_keys().rsa[0]);
+    std::string locked = cMSG::lock(std::string(st.arg(0), 'm'), true, cDSA::PriKey(shared_keys().dsa[0]), "", cRSA::PubKey(shared_keys().rsa[1]));
+    st.set_items(st.arg(0));
+    while (st.keep_running()) bench::keep(cMSG::unlock(locked, true, "", rsa_pri));
+  }, {{256}, {65536}});
+
+  return bench::run(argc, argv);
+}
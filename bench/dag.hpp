@@ -0,0 +1,37 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "../inc/tree.hpp"
+
+/**
+ * \brief A valid pow 0 graph: the root, then count blocks spread over servers
+ *
+ * Every block has its server's previous block as a parent (the root for a server's first), plus up to two recent blocks from anywhere.
+ * Blocks come out parent-first, so any prefix is a graph on its own.
+ */
+inline std::vector<block>
+synthetic_dag(size_t count, size_t servers = 4, size_t cont_len = 128) {
+  std::mt19937 rng(count);
+  std::vector<block> out;
+  out.push_back(block("{\"pow\":0}", {}, 0, std::string(24, '=')));
+
+  std::vector<std::string> last_by_server(servers, out.front().hash);
+  for (size_t i = 0; i < count; i++) {
+    size_t server = i % servers;
+    std::unordered_set<std::string> p_hashes = {last_by_server[server]};
+    size_t extra = rng() % 3;
+    for (size_t j = 0; j < extra && out.size() > 1; j++) {
+      size_t window = std::min<size_t>(out.size() - 1, 16);
+      p_hashes.insert(out[out.size() - 1 - rng() % window].hash);
+    }
+
+    std::string s_trip = std::string(23, 's') + (char) ('a' + server % 26);
+    out.push_back(block(std::string(cont_len, 'a' + i % 26), p_hashes, 0, s_trip, 1700000000 + i));
+    last_by_server[server] = out.back().hash;
+  }
+  return out;
+}
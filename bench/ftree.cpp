@@ -0,0 +1,78 @@
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bench.hpp"
+#include "dag.hpp"
+#include "../inc/ftree.hpp"
+
+/**
+ * \brief FileTree that can be handed a whole graph, saving it as it goes
+ */
+class BenchFileTree : public FileTree {
+public:
+  using FileTree::FileTree;
+  using FileTree::batch_push;
+  using FileTree::save;
+};
+
+static const std::string base = (std::filesystem::temp_directory_path() / "concord-ftree-bench/").string();
+
+std::string
+layout_dir(long layout) {
+  return base + "layout" + std::to_string(layout) + "/";
+}
+
+int
+main(int argc, char** argv) {
+  std::filesystem::remove_all(base);
+
+  // layout (0 directory, 1 segmented, 2 mapped), then block count; saves are timed until they're durable
+  bench::add("FileTree/save", [](bench::state& st) {
+    std::vector<block> blocks = synthetic_dag(st.arg(1));
+    std::string dir = layout_dir(st.arg(0)) + "save/";
+    st.set_items(blocks.size());
+
+    std::unique_ptr<BenchFileTree> tree;
+    while (st.keep_running()) {
+      st.pause();
+      tree.reset();
+      std::filesystem::remove_all(dir);
+      std::filesystem::create_directories(dir);
+      tree = std::make_unique<BenchFileTree>(dir, (store_layout) st.arg(0));
+      st.resume();
+      for (const block& b : blocks) tree->save(b);
+      tree->durable().get();
+    }
+    tree.reset();
+    std::filesystem::remove_all(dir);
+  }, {{0, 1000}, {1, 1000}, {2, 1000}});
+
+  // one stored graph per layout, loaded with its checkpoint (1) or with every block validated (0)
+  bench::add("FileTree/load", [](bench::state& st) {
+    std::string dir = layout_dir(st.arg(0)) + "load/";
+    if (!std::filesystem::exists(dir)) {
+      std::filesystem::create_directories(dir);
+      std::vector<block> blocks = synthetic_dag(st.arg(2));
+      BenchFileTree(dir, (store_layout) st.arg(0)).batch_push(std::unordered_set<block>(blocks.begin(), blocks.end()));
+    }
+    st.set_items(st.arg(2) + 1);
+
+    // writing the next checkpoint on the way out isn't loading, so trees are torn down untimed
+    std::unique_ptr<FileTree> tree;
+    while (st.keep_running()) {
+      st.pause();
+      tree.reset();
+      if (!st.arg(1)) std::filesystem::remove(dir + FTREE_CHECKPOINT);
+      st.resume();
+      tree = std::make_unique<FileTree>(dir, (store_layout) st.arg(0));
+    }
+    tree.reset();
+  }, {{0, 0, 1000}, {1, 0, 1000}, {1, 1, 1000}, {2, 0, 1000}, {2, 1, 1000}}, 3);
+
+  int status = bench::run(argc, argv);
+  std::filesystem::remove_all(base);
+  return status;
+}
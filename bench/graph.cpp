@@ -0,0 +1,48 @@
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bench.hpp"
+#include "dag.hpp"
+
+/**
+ * \brief Tree with nowhere to save to, so pushes measure the graph alone
+ */
+class MemTree : public Tree {
+public:
+  using Tree::batch_push;
+  void save(block) override {}
+  void load() override {}
+};
+
+int
+main(int argc, char** argv) {
+  // graph size, then batch size: the batch lands on a graph already holding that many blocks
+  bench::add("graph_model/batch_push", [](bench::state& st) {
+    size_t graph_size = st.arg(0), batch_size = st.arg(1);
+    std::vector<block> blocks = synthetic_dag(graph_size + batch_size);
+    std::unordered_set<block> base(blocks.begin(), blocks.begin() + graph_size + 1);
+    std::unordered_set<block> batch(blocks.begin() + graph_size + 1, blocks.end());
+    st.set_items(batch_size);
+
+    std::unique_ptr<MemTree> tree;
+    while (st.keep_running()) {
+      st.pause();
+      tree = std::make_unique<MemTree>();
+      tree->batch_push(base);
+      st.resume();
+      tree->batch_push(batch);
+    }
+  }, {{0, 1}, {0, 100}, {0, 1000}, {1000, 1}, {1000, 100}, {1000, 1000}}, 3);
+
+  bench::add("Tree/find_p_hashes", [](bench::state& st) {
+    std::vector<block> blocks = synthetic_dag(st.arg(0));
+    MemTree tree;
+    tree.batch_push(std::unordered_set<block>(blocks.begin(), blocks.end()));
+    std::string s_trip = blocks.back().s_trip;
+    while (st.keep_running()) tree.find_p_hashes(s_trip);
+  }, {{100}, {1000}});
+
+  return bench::run(argc, argv);
+}
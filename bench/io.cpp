@@ -0,0 +1,76 @@
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "../inc/ioengine.hpp"
+
+// seconds taken by op
+double
+timed(std::function<void()> op) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  op();
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+void
+report(std::string name, size_t count, double secs) {
+  std::cout << std::left << std::setw(20) << name
+    << std::right << std::fixed << std::setprecision(1)
+    << std::setw(14) << count / secs
+    << std::setw(12) << secs * 1000 << std::endl;
+}
+
+int
+main(int argc, char** argv) {
+  size_t count = (argc > 1) ? std::stoul(argv[1]) : 20000;
+  size_t file_len = (argc > 2) ? std::stoul(argv[2]) : 1024;
+  std::string base = (std::filesystem::temp_directory_path() / "concord-io-bench/").string();
+  std::filesystem::remove_all(base);
+  std::filesystem::create_directories(base);
+
+  std::vector<io_file> files(count);
+  for (size_t i = 0; i < count; i++) {
+    files[i].path = base + std::to_string(i) + ".block";
+    files[i].data = std::string(file_len, 'a' + i % 26);
+  }
+
+  std::cout << count << " files of " << file_len << " bytes, shared engine is " << IOEngine::shared().name() << std::endl;
+  std::cout << std::left << std::setw(20) << "op"
+    << std::right << std::setw(14) << "files/s"
+    << std::setw(12) << "ms" << std::endl;
+
+  // the stream path FileTree used before IOEngine: one file at a time
+  report("stream save", count, timed([&]{
+    for (const auto& file : files) {
+      std::ofstream out(file.path);
+      out << file.data;
+    }
+  }));
+  report("stream load", count, timed([&]{
+    for (const auto& file : files) {
+      std::ifstream in(file.path);
+      std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    }
+  }));
+
+  PoolEngine pool_engine;
+  std::vector<std::pair<std::string, IOEngine*>> engines = {{"pool", &pool_engine}};
+  if (IOEngine::shared().name() != pool_engine.name()) engines.push_back({IOEngine::shared().name(), &IOEngine::shared()});
+
+  for (auto& [name, engine] : engines) {
+    report(name + " save", count, timed([&]{ engine->write(files); }));
+    std::vector<io_file> to_read(count);
+    for (size_t i = 0; i < count; i++) to_read[i].path = files[i].path;
+    report(name + " load", count, timed([&]{ engine->read(to_read); }));
+    report(name + " sync", count, timed([&]{ engine->sync(to_read); }));
+  }
+
+  std::filesystem::remove_all(base);
+  return 0;
+}
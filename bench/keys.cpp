@@ -0,0 +1,99 @@
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include "../inc/crypt.hpp"
+
+// ops/sec of one op, run for at least min_ms
+double
+rate(std::function<void()> op, int min_ms = 2000) {
+  using namespace std::chrono;
+  size_t ops = 0;
+  steady_clock::time_point start = steady_clock::now();
+  steady_clock::duration elapsed;
+  do {
+    op();
+    ops++;
+    elapsed = steady_clock::now() - start;
+  } while (elapsed < milliseconds(min_ms));
+  return ops / duration<double>(elapsed).count();
+}
+
+void
+report(std::string name, double raw, double handle) {
+  std::cout << std::left << std::setw(12) << name
+    << std::right << std::fixed << std::setprecision(1)
+    << std::setw(12) << raw
+    << std::setw(12) << handle
+    << std::setw(9) << handle / raw << "x" << std::endl;
+}
+
+int
+main() {
+  const std::string msg(256, 'm');
+
+  std::cout << "generating keys..." << std::endl;
+  std::array<std::string, 2> dsa_keys = cDSA::keygen();
+  std::array<std::string, 2> rsa_keys = cRSA::keygen();
+
+  cDSA::PriKey dsa_pri(dsa_keys[0]);
+  cDSA::PubKey dsa_pub(dsa_keys[1]);
+  cRSA::PriKey rsa_pri(rsa_keys[0]);
+  cRSA::PubKey rsa_pub(rsa_keys[1]);
+
+  std::string sig = cDSA::sign(dsa_pri, msg);
+  std::string cipher = cRSA::encrypt(rsa_pub, msg);
+  std::string locked = cMSG::lock(msg, true, dsa_pri, "", rsa_pub);
+
+  std::cout << std::left << std::setw(12) << "op"
+    << std::right << std::setw(12) << "ber ops/s"
+    << std::setw(12) << "handle ops/s"
+    << std::setw(10) << "speedup" << std::endl;
+
+  report("dsa sign",
+      rate([&]{ cDSA::sign(dsa_keys[0], msg); }),
+      rate([&]{ cDSA::sign(dsa_pri, msg); }));
+  report("dsa verify",
+      rate([&]{ cDSA::verify(dsa_keys[1], sig, msg); }),
+      rate([&]{ cDSA::verify(dsa_pub, sig, msg); }));
+  report("rsa encrypt",
+      rate([&]{ cRSA::encrypt(rsa_keys[1], msg); }),
+      rate([&]{ cRSA::encrypt(rsa_pub, msg); }));
+  report("rsa decrypt",
+      rate([&]{ cRSA::decrypt(rsa_keys[0], cipher); }),
+      rate([&]{ cRSA::decrypt(rsa_pri, cipher); }));
+  report("msg lock",
+      rate([&]{ cMSG::lock(msg, true, dsa_keys[0], "", rsa_keys[1]); }),
+      rate([&]{ cMSG::lock(msg, true, dsa_pri, "", rsa_pub); }));
+  report("msg unlock",
+      rate([&]{ cMSG::unlock(locked, true, "", rsa_keys[0]); }),
+      rate([&]{ cMSG::unlock(locked, true, "", rsa_pri); }));
+
+  // scheme comparison, both through handles
+  std::array<std::string, 2> ed_keys = cDSA::keygen(cDSA::Alg::ED25519);
+  cDSA::PriKey ed_pri(ed_keys[0], cDSA::Alg::ED25519);
+  cDSA::PubKey ed_pub(ed_keys[1], cDSA::Alg::ED25519);
+  std::string ed_sig = cDSA::sign(ed_pri, msg);
+
+  std::vector<std::string> sigs(1024, sig), ed_sigs(1024, ed_sig), msgs(1024, msg);
+
+  std::cout << std::endl << std::left << std::setw(12) << "op"
+    << std::right << std::setw(12) << "dsa ops/s"
+    << std::setw(12) << "ed ops/s"
+    << std::setw(10) << "speedup" << std::endl;
+
+  report("sign",
+      rate([&]{ cDSA::sign(dsa_pri, msg); }),
+      rate([&]{ cDSA::sign(ed_pri, msg); }));
+  report("verify",
+      rate([&]{ cDSA::verify(dsa_pub, sig, msg); }),
+      rate([&]{ cDSA::verify(ed_pub, ed_sig, msg); }));
+  report("verify x1k",
+      rate([&]{ cDSA::verify_batch(dsa_pub, sigs, msgs); }),
+      rate([&]{ cDSA::verify_batch(ed_pub, ed_sigs, msgs); }));
+
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include <chrono>
+#include <functional>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../inc/store.hpp"
+
+// seconds taken by op
+double
+timed(std::function<void()> op) {
+  using namespace std::chrono;
+  steady_clock::time_point start = steady_clock::now();
+  op();
+  return duration<double>(steady_clock::now() - start).count();
+}
+
+void
+report(std::string name, size_t count, double secs) {
+  std::cout << std::left << std::setw(24) << name
+    << std::right << std::fixed << std::setprecision(1)
+    << std::setw(14) << count / secs
+    << std::setw(12) << secs * 1000 << std::endl;
+}
+
+uintmax_t
+disk_usage(std::string dir) {
+  uintmax_t total = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) total += entry.file_size();
+  return total;
+}
+
+int
+main(int argc, char** argv) {
+  size_t count = (argc > 1) ? std::stoul(argv[1]) : 20000;
+  std::string base = (std::filesystem::temp_directory_path() / "concord-store-bench/").string();
+  std::filesystem::remove_all(base);
+
+  std::cout << "generating " << count << " blocks..." << std::endl;
+  std::vector<block> blocks;
+  std::unordered_set<std::string> p_hashes;
+  for (size_t i = 0; i < count; i++) {
+    // chat-like JSON, so compression has something realistic to chew on
+    std::string cont = "{\"user\":\"user" + std::to_string(i % 37) + "\",\"channel\":\"general\",\"msg\":\"message "
+      + std::to_string(i) + " " + std::string(100 + i % 150, 'a' + i % 26) + "\",\"ts\":" + std::to_string(1700000000 + i) + "}";
+    blocks.push_back(block(cont, p_hashes, 0, "bench"));
+    p_hashes = {blocks.back().hash};
+  }
+
+  std::cout << std::left << std::setw(24) << "op"
+    << std::right << std::setw(14) << "blocks/s"
+    << std::setw(12) << "ms" << std::endl;
+
+  std::vector<std::pair<std::string, std::function<std::unique_ptr<BlockStore>()>>> stores = {
+    {"directory", [&]{ return std::make_unique<DirStore>(base + "dir"); }},
+    {"segmented", [&]{ return std::make_unique<SegmentStore>(base + "seg"); }},
+    {"mapped", [&]{ return std::make_unique<MappedStore>(base + "map"); }},
+    {"segmented+zstd", [&]{ return std::make_unique<SegmentStore>(base + "zseg", SEGMENT_LIMIT, ContCodec::available()); }},
+    {"mapped+zstd", [&]{ return std::make_unique<MappedStore>(base + "zmap", SEGMENT_LIMIT, ContCodec::available()); }}
+  };
+  std::map<std::string, std::string> dirs = {
+    {"directory", "dir"}, {"segmented", "seg"}, {"mapped", "map"}, {"segmented+zstd", "zseg"}, {"mapped+zstd", "zmap"}
+  };
+  for (auto& [name, open_store] : stores) {
+    std::unique_ptr<BlockStore> store = open_store();
+    report(name + " put+sync", count, timed([&]{
+      for (const block& b : blocks) store->put(b);
+      store->sync();
+    }));
+    if (SegmentStore* segments = dynamic_cast<SegmentStore*>(store.get()); segments && name.ends_with("zstd")) {
+      codec_stats codec = segments->compression();
+      std::cout << "  contents " << std::setprecision(2) << codec.ratio << "x smaller, "
+        << codec.dictionaries << " dictionaries" << std::endl;
+    }
+    store.reset();
+    std::cout << "  " << disk_usage(base + dirs[name]) / 1024 << " KiB on disk" << std::endl;
+
+    // reopen so the segmented store pays for recovery, as a restart would
+    report(name + " load", count, timed([&]{
+      open_store()->load();
+    }));
+    // what a load that touches every content would pay, decompression included
+    report(name + " load+read", count, timed([&]{
+      size_t total = 0;
+      for (const block& b : open_store()->load()) total += b.cont.size();
+    }));
+  }
+
+  // ingestion as push_response sees it: put() only queues, and syncs happen once per group commit
+  std::vector<std::pair<std::string, std::unique_ptr<BlockStore>>> behind_stores;
+  behind_stores.emplace_back("directory", std::make_unique<DirStore>(base + "dir-behind"));
+  behind_stores.emplace_back("segmented", std::make_unique<SegmentStore>(base + "seg-behind"));
+  for (auto& [name, store] : behind_stores) {
+    WriteBehind writer(*store);
+    report(name + " queued", count, timed([&]{
+      for (const block& b : blocks) writer.put(b);
+    }));
+    report(name + " durable", count, timed([&]{
+      writer.barrier().get();
+    }));
+    std::cout << "  " << writer.stats().batches << " group commits" << std::endl;
+  }
+
+  std::unique_ptr<SegmentStore> migrated = std::make_unique<SegmentStore>(base + "migrated");
+  DirStore source(base + "dir");
+  report("directory -> segmented", count, timed([&]{ migrated->import(source); }));
+
+  std::filesystem::remove_all(base);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "bench.hpp"
+#include "dag.hpp"
+
+/**
+ * \brief Tree with nowhere to save to, so syncs measure the graph alone
+ */
+class MemTree : public Tree {
+public:
+  using Tree::batch_push;
+  void save(block) override {}
+  void load() override {}
+};
+
+/**
+ * \brief Diff a against b, doubling the table until the difference lists
+ * \returns Hashes only a holds, then the cells it took
+ */
+static std::pair<std::unordered_set<std::string>, size_t>
+only_ours(MemTree& a, MemTree& b) {
+  for (size_t cells = 16;; cells *= 2) {
+    iblt_diff diff = a.reconcile(b.summarize(cells));
+    if (diff.complete) return {std::unordered_set<std::string>(diff.only_ours.begin(), diff.only_ours.end()), cells};
+  }
+}
+
+/**
+ * \brief Truth state of a and b holding the same blocks
+ */
+static bool
+converged(MemTree& a, MemTree& b) {
+  iblt_diff diff = a.reconcile(b.summarize(16));
+  return diff.complete && diff.only_ours.empty() && diff.only_theirs.empty();
+}
+
+int
+main(int argc, char** argv) {
+  // shared graph size, then blocks on each side the other lacks: ours extend the shared graph, theirs start a server of their own on top of it
+  bench::add("Tree/reconcile", [](bench::state& st) {
+    size_t shared = st.arg(0), apart = st.arg(1);
+    std::vector<block> blocks = synthetic_dag(shared + apart);
+    std::unordered_set<block> base(blocks.begin(), blocks.begin() + shared + 1);
+    std::unordered_set<block> ours(blocks.begin() + shared + 1, blocks.end());
+    std::unordered_set<block> theirs;
+    std::string parent = blocks[shared].hash;
+    for (size_t i = 0; i < apart; i++) {
+      block next(std::string(128, 'z'), {parent}, 0, std::string(24, 'z'), 1800000000 + i);
+      parent = next.hash;
+      theirs.insert(next);
+    }
+    st.set_items(2 * apart);
+
+    std::unique_ptr<MemTree> a, b;
+    while (st.keep_running()) {
+      st.pause();
+      a = std::make_unique<MemTree>();
+      b = std::make_unique<MemTree>();
+      a->batch_push(base);
+      b->batch_push(base);
+      a->batch_push(ours);
+      b->batch_push(theirs);
+      st.resume();
+
+      // each side sends what the other lacks as one parent-first batch
+      std::vector<block> to_b = a->export_blocks(only_ours(*a, *b).first);
+      std::vector<block> to_a = b->export_blocks(only_ours(*b, *a).first);
+      a->batch_push(std::unordered_set<block>(to_a.begin(), to_a.end()));
+      b->batch_push(std::unordered_set<block>(to_b.begin(), to_b.end()));
+    }
+    if (!converged(*a, *b)) throw std::runtime_error("trees differ after one batch each way");
+  }, {{1000, 1}, {1000, 50}, {1000, 500}, {10000, 50}}, 3);
+
+  // the same exchange through the push queue, waiting for both trees to link everything
+  bench::add("Tree/reconcile_queued", [](bench::state& st) {
+    size_t shared = st.arg(0), behind = st.arg(1);
+    std::vector<block> blocks = synthetic_dag(shared + behind);
+    st.set_items(behind);
+
+    std::unique_ptr<MemTree> a, b;
+    while (st.keep_running()) {
+      st.pause();
+      a = std::make_unique<MemTree>();
+      b = std::make_unique<MemTree>();
+      a->batch_push(std::unordered_set<block>(blocks.begin(), blocks.end()));
+      b->batch_push(std::unordered_set<block>(blocks.begin(), blocks.begin() + shared + 1));
+      st.resume();
+
+      // the batch is indexed in one go, so its newest block showing up means all of it has
+      b->queue_batch(a->export_blocks(only_ours(*a, *b).first));
+      while (b->get_latest(blocks.back().s_trip, 1) != std::vector<time_cursor>{{blocks.back().time, blocks.back().hash}}) std::this_thread::yield();
+    }
+    if (!converged(*a, *b)) throw std::runtime_error("trees differ after one queued batch");
+  }, {{1000, 50}, {1000, 500}}, 3);
+
+  return bench::run(argc, argv);
+}
@@ -0,0 +1,327 @@
+/**
+ * Synthetic workload generator and scale harness.
+ *
+ * Streams a valid graph in the real block format: servers are picked with a Zipf skew, every block takes one intraserver
+ * childless parent (none for a server's first block) and fills up to --fanout from recently childless blocks anywhere,
+ * as Tree::find_p_hashes does. Memory stays flat in --blocks; only tips and a bounded pool of childless hashes are kept.
+ *
+ *   bench_workload [--blocks=N] [--servers=N] [--skew=S] [--users=N] [--fanout=N] [--pow=N] [--cont=BYTES]
+ *                  [--batch=N] [--out=DIR] [--layout=directory|segmented|mapped] [--compress]
+ *                  [--push] [--rate=BLOCKS_PER_SEC] [--report=SECS]
+ *
+ * Without --push, blocks are written straight into --out's store, ready for FileTree to load.
+ * With --push, batches go through queue_batch into a FileTree on --out, or an in-memory Tree without it, paced to --rate.
+ * Every --report seconds it prints throughput, RSS growth and per-batch latency quantiles for the interval.
+ * With --pow above 0, each batch is mined in parallel across servers.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "../inc/ftree.hpp"
+#include "../inc/metrics.hpp"
+#include "../inc/pool.hpp"
+
+/**
+ * \brief Tree with nowhere to save to
+ */
+class MemTree : public Tree {
+public:
+  void save(block) override {}
+  void load() override {}
+};
+
+/**
+ * \brief Ranks [0, n) with P(k) proportional to 1 / (k + 1)^skew
+ */
+class zipf {
+public:
+  zipf(size_t n, double skew) : cdf(n) {
+    double total = 0;
+    for (size_t k = 0; k < n; k++) cdf[k] = (total += 1 / std::pow(k + 1, skew));
+    for (auto& c : cdf) c /= total;
+  }
+
+  size_t operator()(std::mt19937_64& rng) {
+    double u = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+  }
+private:
+  std::vector<double> cdf;
+};
+
+struct options {
+  size_t blocks = 1000000;
+  size_t servers = 10000;
+  double skew = 1.1;
+  size_t users = 0;
+  size_t fanout = 3;
+  int pow = 0;
+  size_t cont = 160;
+  size_t batch = 1000;
+  std::string out;
+  store_layout layout = store_layout::segmented;
+  bool compress = false;
+  bool push = false;
+  double rate = 0;
+  double report = 5;
+};
+
+/**
+ * \brief Generates the graph a batch at a time
+ */
+class generator {
+public:
+  generator(const options& opts) :
+    opts(opts),
+    servers(opts.servers, opts.skew),
+    users(std::max<size_t>(opts.users, 1), opts.skew),
+    tips(opts.servers),
+    rng(42) {
+    for (size_t i = 0; i < opts.servers; i++) server_trips.push_back(gen::trip("server" + std::to_string(i)));
+    for (size_t i = 0; i < opts.users; i++) user_trips.push_back(gen::trip("user" + std::to_string(i)));
+    this->clock = timeh::raw();
+  }
+
+  /**
+   * \brief The graph root, carrying the PoW requirement
+   */
+  block root() {
+    block out("{\"pow\":" + std::to_string(opts.pow) + "}", {}, opts.pow, std::string(24, '='), this->clock);
+    pool.push_back(out.hash);
+    this->recent = out.hash;
+    return out;
+  }
+
+  std::vector<block> next(size_t count) {
+    // one plan per block: parents from before this batch, plus its place in its server's chain within the batch
+    struct plan {
+      size_t server;
+      std::unordered_set<std::string> p_hashes;
+      std::string cont;
+      std::string c_trip;
+      unsigned long long time;
+    };
+    std::vector<plan> plans(count);
+    std::map<size_t, std::vector<size_t>> chains; // server -> positions, in order
+
+    for (size_t i = 0; i < count; i++) {
+      plan& p = plans[i];
+      p.server = servers(rng);
+      bool first_in_batch = !chains.contains(p.server);
+      chains[p.server].push_back(i);
+
+      // the intraserver parent: a tip, or the server's previous block in this batch (filled in once mined)
+      if (first_in_batch && !tips[p.server].empty()) {
+        std::vector<std::string>& server_tips = tips[p.server];
+        size_t pick = rng() % server_tips.size();
+        p.p_hashes.insert(server_tips[pick]);
+        server_tips.erase(server_tips.begin() + pick);
+      }
+
+      size_t want = 1 + rng() % opts.fanout;
+      while (p.p_hashes.size() < want && !pool.empty()) {
+        size_t pick = rng() % pool.size();
+        p.p_hashes.insert(pool[pick]);
+        pool[pick] = pool.back();
+        pool.pop_back();
+      }
+      // a drained pool still leaves the previous batch's newest block; only the root may go without parents
+      if (p.p_hashes.empty() && first_in_batch) p.p_hashes.insert(this->recent);
+
+      // chat-like JSON, lengths spread around --cont
+      size_t len = std::max<size_t>(8, std::exponential_distribution<double>(1.0 / opts.cont)(rng));
+      p.cont = "{\"user\":" + std::to_string(rng() % 1000) + ",\"msg\":\"" + std::string(len, 'a' + rng() % 26) + "\"}";
+      p.c_trip = user_trips.empty() ? "" : user_trips[users(rng)];
+      this->clock += 1000000 + rng() % 1000000; // ~1.5ms apart
+      p.time = this->clock;
+    }
+
+    // chains are independent of each other, so servers mine in parallel
+    std::vector<block> out(count);
+    std::vector<std::pair<size_t, std::vector<size_t>>> chain_list(chains.begin(), chains.end());
+    auto mine_chain = [&](size_t c) {
+      const auto& [server, positions] = chain_list[c];
+      for (size_t j = 0; j < positions.size(); j++) {
+        plan& p = plans[positions[j]];
+        if (j > 0) p.p_hashes.insert(out[positions[j - 1]].hash);
+        out[positions[j]] = block(p.cont, p.p_hashes, opts.pow, server_trips[server], p.time, p.c_trip);
+      }
+    };
+    if (opts.pow > 0) ThreadPool::shared().parallel_for(chain_list.size(), mine_chain);
+    else for (size_t c = 0; c < chain_list.size(); c++) mine_chain(c);
+
+    // each chain's last block is childless, within its server and everywhere
+    for (const auto& [server, positions] : chain_list) {
+      const std::string& last = out[positions.back()].hash;
+      std::vector<std::string>& server_tips = tips[server];
+      server_tips.push_back(last);
+      if (server_tips.size() > 4) server_tips.erase(server_tips.begin());
+      if (pool.size() < 4096) pool.push_back(last);
+      else pool[rng() % pool.size()] = last;
+    }
+    this->recent = out.back().hash;
+    return out;
+  }
+private:
+  const options& opts;
+  zipf servers;
+  zipf users;
+  std::vector<std::string> server_trips;
+  std::vector<std::string> user_trips;
+  std::vector<std::vector<std::string>> tips; /**< Per server, its newest childless blocks */
+  std::vector<std::string> pool; /**< Recently childless blocks from any server */
+  std::string recent; /**< Newest block of the previous batch */
+  std::mt19937_64 rng;
+  unsigned long long clock;
+};
+
+size_t
+rss_bytes() {
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0, resident = 0;
+  statm >> pages >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+options
+parse(int argc, char** argv) {
+  options opts;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    std::string key = arg.substr(0, eq), value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+    if (key == "--blocks") opts.blocks = std::stoull(value);
+    else if (key == "--servers") opts.servers = std::stoull(value);
+    else if (key == "--skew") opts.skew = std::stod(value);
+    else if (key == "--users") opts.users = std::stoull(value);
+    else if (key == "--fanout") opts.fanout = std::max<size_t>(1, std::stoull(value));
+    else if (key == "--pow") opts.pow = std::stoi(value);
+    else if (key == "--cont") opts.cont = std::stoull(value);
+    else if (key == "--batch") opts.batch = std::max<size_t>(1, std::stoull(value));
+    else if (key == "--out") opts.out = value;
+    else if (key == "--layout") {
+      if (value == "directory") opts.layout = store_layout::directory;
+      else if (value == "segmented") opts.layout = store_layout::segmented;
+      else if (value == "mapped") opts.layout = store_layout::mapped;
+      else throw std::runtime_error("unknown layout " + value);
+    }
+    else if (key == "--compress") opts.compress = true;
+    else if (key == "--push") opts.push = true;
+    else if (key == "--rate") opts.rate = std::stod(value);
+    else if (key == "--report") opts.report = std::stod(value);
+    else throw std::runtime_error("unknown flag " + arg);
+  }
+  if (!opts.push && opts.out.empty()) throw std::runtime_error("--out is needed unless blocks are pushed");
+  if (opts.servers == 0) throw std::runtime_error("--servers must be at least 1");
+  return opts;
+}
+
+int
+main(int argc, char** argv) {
+  options opts;
+  try {
+    opts = parse(argc, argv);
+  } catch (const std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 2;
+  }
+
+  std::unique_ptr<BlockStore> store;
+  std::unique_ptr<Tree> tree;
+  std::function<void(std::vector<block>&)> sink;
+  if (!opts.out.empty()) std::filesystem::create_directories(opts.out);
+  if (opts.push) {
+    if (opts.out.empty()) tree = std::make_unique<MemTree>();
+    else tree = std::make_unique<FileTree>(opts.out, opts.layout, opts.compress);
+    // set up front: raising it from the root's config mid-push rebuilds the graph under push_proc_mtx, which push_proc already holds
+    tree->set_pow_req(opts.pow);
+    sink = [&tree](std::vector<block>& batch) {tree->queue_batch(batch);};
+  } else {
+    std::string dir = opts.out + (opts.out.back() == '/' ? "" : "/");
+    if (opts.layout == store_layout::mapped) store = std::make_unique<MappedStore>(dir, SEGMENT_LIMIT, opts.compress);
+    else if (opts.layout == store_layout::segmented) store = std::make_unique<SegmentStore>(dir, SEGMENT_LIMIT, opts.compress);
+    else store = std::make_unique<DirStore>(dir);
+    sink = [&store](std::vector<block>& batch) {store->put_batch(batch);};
+  }
+
+  generator gen(opts);
+  std::vector<block> root_batch = {gen.root()};
+  sink(root_batch);
+
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now(), last_report = start;
+  size_t done = 0, done_at_report = 0;
+  size_t rss_start = rss_bytes(), rss_at_report = rss_start;
+  std::unique_ptr<Histogram> latency = std::make_unique<Histogram>();
+  double generating = 0;
+
+  std::cout << std::left << std::setw(8) << "secs"
+    << std::right << std::setw(12) << "blocks"
+    << std::setw(12) << "blocks/s"
+    << std::setw(10) << "rss MiB"
+    << std::setw(10) << "+MiB"
+    << std::setw(10) << "p50 ms"
+    << std::setw(10) << "p99 ms"
+    << std::setw(10) << "p999 ms"
+    << std::setw(10) << "max ms" << std::endl;
+
+  auto report = [&](clock::time_point now) {
+    double secs = std::chrono::duration<double>(now - last_report).count();
+    size_t rss = rss_bytes();
+    histogram_snapshot lat = latency->snapshot();
+    std::cout << std::left << std::setw(8) << std::fixed << std::setprecision(1) << std::chrono::duration<double>(now - start).count()
+      << std::right << std::setw(12) << done
+      << std::setw(12) << std::setprecision(0) << (done - done_at_report) / secs
+      << std::setw(10) << std::setprecision(1) << rss / 1048576.0
+      << std::setw(10) << ((double) rss - rss_at_report) / 1048576.0
+      << std::setw(10) << std::setprecision(2) << lat.p50 / 1e6
+      << std::setw(10) << lat.p99 / 1e6
+      << std::setw(10) << lat.p999 / 1e6
+      << std::setw(10) << lat.max / 1e6 << std::endl;
+    last_report = now;
+    done_at_report = done;
+    rss_at_report = rss;
+    latency = std::make_unique<Histogram>();
+  };
+
+  while (done < opts.blocks) {
+    clock::time_point gen_start = clock::now();
+    std::vector<block> batch = gen.next(std::min(opts.batch, opts.blocks - done));
+    generating += std::chrono::duration<double>(clock::now() - gen_start).count();
+
+    // pace to --rate against the run's start, so a slow batch is caught up on rather than lost
+    if (opts.rate > 0) std::this_thread::sleep_until(start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(done / opts.rate)));
+
+    clock::time_point batch_start = clock::now();
+    sink(batch);
+    latency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - batch_start).count());
+    done += batch.size();
+
+    clock::time_point now = clock::now();
+    if (std::chrono::duration<double>(now - last_report).count() >= opts.report) report(now);
+  }
+  if (store) store->sync();
+  if (FileTree* file_tree = dynamic_cast<FileTree*>(tree.get())) file_tree->durable().get();
+  if (done > done_at_report) report(clock::now());
+
+  double total = std::chrono::duration<double>(clock::now() - start).count();
+  std::cout << done << " blocks in " << std::setprecision(1) << total << "s ("
+    << std::setprecision(0) << done / total << " blocks/s, " << std::setprecision(1) << generating << "s generating), rss +"
+    << (rss_bytes() - (double) rss_start) / 1048576.0 << " MiB" << std::endl;
+  if (tree) std::cout << tree->get_graph().size() << " blocks in the graph" << std::endl;
+  return 0;
+}
@@ -0,0 +1,135 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include "tree.hpp"
+#include "store.hpp"
+
+#include <fstream>
+#include <string>
+#include <unordered_set>
+
+#define BUNDLE_FRAME (1 << 20) // raw bytes of records per frame
+#define BUNDLE_RECORD_MAX (64u << 20) // largest packed block a bundle holds, so readers can bound a frame before allocating it
+#define BUNDLE_BATCH 4096 // blocks per push on import
+
+/**
+ * \brief Counters of a bundle export or import
+ */
+struct bundle_stats {
+  uint64_t blocks; /**< Blocks written or read */
+  uint64_t frames; /**< Frames written or read */
+  uint64_t raw_bytes; /**< Packed blocks, before compression */
+  uint64_t stored_bytes; /**< Frame payloads as stored */
+};
+
+/**
+ * \brief What export_bundle takes from a Tree
+ */
+struct bundle_scope {
+  std::string s_trip; /**< Optional. Only a given 'server''s blocks */
+  std::unordered_set<std::string> since; /**< Optional. Leave out these blocks and their ancestors, e.g. a peer's tips */
+};
+
+/**
+ * \brief Streams blocks into a bundle file
+ *
+ * Bundles hold packed blocks (see block::pack) in frames of up to BUNDLE_FRAME bytes, optionally zstd compressed; each frame's header and payload carry their own CRC32C.
+ * Written to a temporary file, synced and renamed into place by finish(), so a bundle that exists is whole, across crashes too.
+ */
+class BundleWriter {
+public:
+  /**
+   * \param path Bundle to write
+   * \param compress Compress frames; throws std::runtime_error when built without zstd
+   */
+  BundleWriter(std::string path, bool compress = false);
+
+  /**
+   * \brief Drops the temporary file if finish() was never reached
+   */
+  ~BundleWriter();
+
+  /**
+   * \brief Append a block; importers push blocks in the order they were put
+   *
+   * Throws std::runtime_error if it packs to more than BUNDLE_RECORD_MAX bytes.
+   */
+  void put(const block& to_put);
+
+  /**
+   * \brief Write the last frame and the end marker, then fsync and move the bundle into place
+   */
+  bundle_stats finish();
+private:
+  std::string path;
+  std::string tmp_path;
+  std::ofstream out;
+  bool compress;
+  std::string frame; /**< Records of the frame being filled */
+  uint32_t frame_count = 0; /**< Records in frame */
+  bundle_stats stats = {};
+  bool finished = false;
+
+  void flush_frame();
+  void write_frame(uint32_t count, uint32_t raw_len, std::string_view stored);
+};
+
+/**
+ * \brief Streams blocks out of a bundle file, one frame in memory at a time
+ */
+class BundleReader {
+public:
+  /**
+   * \param path Bundle to read; throws std::runtime_error if it isn't one
+   */
+  BundleReader(std::string path);
+
+  /**
+   * \brief Read the next block
+   * \param out Where to put it
+   * \returns Truth state of a block being read; false at the end marker
+   *
+   * Throws std::runtime_error on a corrupt or truncated bundle.
+   */
+  bool next(block& out);
+
+  bundle_stats get_stats() const {return this->stats;}
+private:
+  std::ifstream in;
+  bool compressed;
+  std::string frame; /**< Decoded records of the current frame */
+  size_t pos = 0; /**< Next record in frame */
+  uint32_t left = 0; /**< Records left in frame */
+  bundle_stats stats = {};
+  bool ended = false;
+
+  bool read_frame();
+};
+
+/**
+ * \brief Write a Tree's blocks to a bundle, parents first
+ * \param tree Tree to export
+ * \param path Bundle to write
+ * \param scope Optional. Which blocks; everything by default
+ * \param compress Optional. Compress frames
+ *
+ * Blocks are walked with Tree::walk_topological, so pushes carry on while the export is written; it holds the blocks linked when it began.
+ */
+bundle_stats export_bundle(Tree& tree, std::string path, bundle_scope scope = bundle_scope(), bool compress = false);
+
+/**
+ * \brief Push a bundle's blocks into a Tree while reading it
+ * \param tree Tree to import into
+ * \param path Bundle to read
+ * \param batch Blocks per push
+ *
+ * Each batch is pushed on the calling thread (graph_model::push_batch), waiting out any push in progress, so memory stays at one frame plus one
+ * batch whatever the bundle's size, even while push_proc runs elsewhere. Blocks go through the usual validation; ones already linked are dropped cheaply (see graph_model::drop_known).
+ */
+bundle_stats import_bundle(Tree& tree, std::string path, size_t batch = BUNDLE_BATCH);
+
+/** \} */
@@ -5,18 +5,127 @@
 
 #pragma once
 #include <string>
+#include <string_view>
 #include <iostream>
 #include <array>
+#include <memory>
+#include <span>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <optional>
+#include <chrono>
+#include <exception>
 #include <cryptopp/aes.h>
+#include <cryptopp/gcm.h>
+#include <cryptopp/osrng.h>
+#include <cryptopp/dsa.h>
+#include <cryptopp/rsa.h>
+#include <cryptopp/xed25519.h>
+
+#include "pool.hpp"
 
 #define AES_KEYLEN CryptoPP::AES::MAX_KEYLENGTH
 #define AES_NONCELEN CryptoPP::AES::BLOCKSIZE
 #define DSA_SIGLEN 64
+#define ED25519_SIGLEN 64
 #define DSA_KEYLEN 3072
 #define RSA_KEYLEN 4096
+#define RSA_KEYIDLEN 8
+#define AES_CHUNKLEN (64 * 1024)
+#define MSG_MAGIC "cMSG"
+#define MSG_HEADERLEN 6
+#define MSG_V_STREAM 1
+#define MSG_V_TAGGED 2
+#define MSG_V_STREAM_TAGGED 3
+#define MSG_V_MULTI 4
+#define MSG_F_ASYMM 0x01
+#define KEYPOOL_BACKOFF_MS 10 // first wait after a failed keygen, doubling per failure in a row
+#define KEYPOOL_BACKOFF_MAX_MS 1000
+#define KEYPOOL_FAILURE_LIMIT 8 // failures in a row before take() stops generating and rethrows
+
+// Streaming
+namespace cIO {
+  /**
+   * \brief Pull-based byte source
+   */
+  struct Reader {
+    virtual ~Reader() = default;
+    /**
+     * \brief Read up to len bytes
+     * \returns Bytes read; 0 only at end of stream
+     */
+    virtual size_t read(char* buf, size_t len) = 0;
+  };
+
+  /**
+   * \brief Push-based byte sink
+   */
+  struct Writer {
+    virtual ~Writer() = default;
+    virtual void write(const char* buf, size_t len) = 0;
+  };
+
+  class StringReader : public Reader {
+  public:
+    StringReader(std::string_view src);
+    size_t read(char* buf, size_t len) override;
+  private:
+    std::string_view src;
+  };
+
+  class StringWriter : public Writer {
+  public:
+    StringWriter(std::string& dst);
+    void write(const char* buf, size_t len) override;
+  private:
+    std::string& dst;
+  };
+
+  class IStreamReader : public Reader {
+  public:
+    IStreamReader(std::istream& src);
+    size_t read(char* buf, size_t len) override;
+  private:
+    std::istream& src;
+  };
+
+  class OStreamWriter : public Writer {
+  public:
+    OStreamWriter(std::ostream& dst);
+    void write(const char* buf, size_t len) override;
+  private:
+    std::ostream& dst;
+  };
+
+  // keeps reading until len bytes or end of stream
+  size_t read_full(Reader& src, char* buf, size_t len);
+}
 
 // AES
 namespace cAES {
+  /**
+   * \brief Keyed AES-GCM state for many messages under one key
+   *
+   * The key schedule and GHASH tables are built once; each message only changes the IV.
+   * Output is byte-for-byte what cAES::encrypt produces, so either side can decrypt the other's.
+   * Not thread-safe: a Session holds mutable cipher state, so give each thread its own.
+   */
+  class Session {
+  public:
+    explicit Session(std::string skey);
+    std::array<std::string, 2> encrypt(std::string msg);
+    // empty on authentication failure
+    std::string decrypt(std::string snonce, std::string cipher);
+  private:
+    CryptoPP::GCM<CryptoPP::AES>::Encryption e;
+    CryptoPP::GCM<CryptoPP::AES>::Decryption d;
+    CryptoPP::AutoSeededRandomPool prng;
+  };
+
   std::string keygen();
   std::array<std::string, 2> encrypt(std::string skey, std::string msg);
   std::string decrypt(
@@ -24,26 +133,264 @@ namespace cAES {
       std::string snonce, 
       std::string cipher
   );
+  /**
+   * segmented AES-GCM; memory use is bounded by chunk_len whatever the input size.
+   * Each chunk gets its own nonce (random prefix | counter | final flag), and the last chunk also authenticates the total length,
+   * so reordering, truncation and extension are all caught.
+   */
+  void encrypt(
+      std::string skey, 
+      cIO::Reader& msg, 
+      cIO::Writer& cipher, 
+      size_t chunk_len = AES_CHUNKLEN
+  );
+  // chunks are written as they verify; if this returns false everything written must be discarded
+  bool decrypt(
+      std::string skey, 
+      cIO::Reader& cipher, 
+      cIO::Writer& msg
+  );
 }
 // RSA
 namespace cRSA {
+  /**
+   * \brief Pre-parsed RSA public key
+   *
+   * The BER key is decoded once; copies share the same encryptor and may be used from any thread.
+   */
+  class PubKey {
+  public:
+    PubKey();
+    explicit PubKey(std::string encodedPublicKey);
+    bool empty() const;
+    // first RSA_KEYIDLEN bytes of SHA-256 over the BER public key
+    const std::string& id() const;
+    const CryptoPP::RSAES_OAEP_SHA_Encryptor& encryptor() const;
+  private:
+    std::string key_id;
+    std::shared_ptr<const CryptoPP::RSAES_OAEP_SHA_Encryptor> e;
+  };
+
+  /**
+   * \brief Pre-parsed RSA private key
+   *
+   * The BER key is decoded once; copies share the same decryptor and may be used from any thread.
+   */
+  class PriKey {
+  public:
+    PriKey();
+    explicit PriKey(std::string encodedPrivateKey);
+    bool empty() const;
+    // id of the matching public key
+    const std::string& id() const;
+    const CryptoPP::RSAES_OAEP_SHA_Decryptor& decryptor() const;
+  private:
+    std::string key_id;
+    std::shared_ptr<const CryptoPP::RSAES_OAEP_SHA_Decryptor> d;
+  };
+
   std::array<std::string, 2> keygen();
   std::string encrypt(std::string encodedPublicKey, std::string msg);
+  std::string encrypt(const PubKey& publicKey, std::string msg);
   std::string decrypt(std::string encodedPrivateKey, std::string cipher);
+  std::string decrypt(const PriKey& privateKey, std::string cipher);
 }
 // DSA
 namespace cDSA {
-  std::array<std::string, 2> keygen();
-  std::string sign(std::string encodedPrivateKey, std::string msg);
+  /**
+   * \brief Signature schemes
+   *
+   * Values are written into cMSG envelopes as the algorithm tag, so they must never be reused.
+   */
+  enum class Alg : unsigned char {
+    DSA = 1, /**< DSA-3072, the original scheme */
+    ED25519 = 2 /**< Ed25519, far cheaper to sign and verify */
+  };
+
+  /**
+   * \brief Signature length of a scheme
+   * \returns Length in bytes; throws on unknown schemes
+   */
+  size_t siglen(Alg alg);
+
+  /**
+   * \brief Pre-parsed signing key
+   *
+   * The BER key is decoded once and, for DSA and unless disabled, the fixed-base exponentiation tables are precomputed.
+   * Copies share the same signer and may be used from any thread.
+   */
+  class PriKey {
+  public:
+    PriKey();
+    explicit PriKey(std::string encodedPrivateKey, Alg alg = Alg::DSA, bool precompute = true);
+    bool empty() const;
+    Alg alg() const;
+    const CryptoPP::PK_Signer& signer() const;
+  private:
+    Alg scheme = Alg::DSA;
+    std::shared_ptr<const CryptoPP::PK_Signer> s;
+  };
+
+  /**
+   * \brief Pre-parsed verification key
+   *
+   * The BER key is decoded once and, for DSA and unless disabled, the fixed-base exponentiation tables are precomputed.
+   * Copies share the same verifier and may be used from any thread.
+   */
+  class PubKey {
+  public:
+    PubKey();
+    explicit PubKey(std::string encodedPublicKey, Alg alg = Alg::DSA, bool precompute = true);
+    bool empty() const;
+    Alg alg() const;
+    const CryptoPP::PK_Verifier& verifier() const;
+  private:
+    Alg scheme = Alg::DSA;
+    std::shared_ptr<const CryptoPP::PK_Verifier> v;
+  };
+
+  std::array<std::string, 2> keygen(Alg alg = Alg::DSA);
+  std::string sign(std::string encodedPrivateKey, std::string msg, Alg alg = Alg::DSA);
+  std::string sign(const PriKey& privateKey, std::string msg);
   bool verify(
       std::string encodedPublicKey, 
       std::string sig, 
+      std::string msg, 
+      Alg alg = Alg::DSA
+  );
+  bool verify(
+      const PubKey& publicKey, 
+      std::string sig, 
       std::string msg
   );
+  // batch verification, results[i] corresponds to sigs[i]/msgs[i]
+  std::vector<bool> verify_batch(
+      const PubKey& publicKey, 
+      std::span<const std::string> sigs, 
+      std::span<const std::string> msgs, 
+      ThreadPool& pool = ThreadPool::shared()
+  );
+  // one key per item; each distinct key is decoded once and shared, and items whose key doesn't decode are false
+  std::vector<bool> verify_batch(
+      std::span<const std::string> encodedPublicKeys, 
+      std::span<const std::string> sigs, 
+      std::span<const std::string> msgs, 
+      Alg alg = Alg::DSA, 
+      ThreadPool& pool = ThreadPool::shared()
+  );
+  // DSA keys on a given pool, the signature from before Alg was added
+  std::vector<bool> verify_batch(
+      std::span<const std::string> encodedPublicKeys, 
+      std::span<const std::string> sigs, 
+      std::span<const std::string> msgs, 
+      ThreadPool& pool
+  );
 }
 
+// Key Pools
+/**
+ * \brief Snapshot of a KeyPool
+ */
+struct keypool_stats {
+  size_t depth; /**< Pairs ready to hand out */
+  size_t generated; /**< Pairs generated in the background */
+  size_t taken; /**< Pairs handed out */
+  size_t misses; /**< take() calls that found the pool dry and generated in the foreground */
+  size_t failures; /**< Background keygen calls that threw */
+  double gen_rate; /**< Background pairs per second since the pool started */
+  double mean_gen_ms; /**< Mean time to generate (and validate) one pair */
+};
+
+/**
+ * \brief Pre-generated key pairs
+ *
+ * RSA-4096/DSA-3072 keygen takes from hundreds of milliseconds to seconds, so background threads keep pairs ready.
+ * Once the depth drops to the low watermark the workers refill up to the high watermark, then go idle again.
+ * Pass the generator as a lambda, e.g. `KeyPool([] { return cDSA::keygen(); })`.
+ */
+class KeyPool {
+public:
+  /**
+   * \param keygen Pair generator, any of the cX::keygen functions
+   * \param low_watermark Depth at which refilling starts
+   * \param high_watermark Depth at which refilling stops
+   * \param threads Background generator threads
+   */
+  KeyPool(
+      std::function<std::array<std::string, 2>()> keygen, 
+      size_t low_watermark = 4, 
+      size_t high_watermark = 16, 
+      size_t threads = 1
+      );
+
+  /**
+   * \brief Stops the workers; waits for in-flight generation to finish
+   */
+  ~KeyPool();
+
+  /**
+   * \brief Take a pair
+   * \returns Key pair, in keygen's order
+   *
+   * O(1) while the pool has pairs, otherwise generates one in the calling thread.
+   * If the pool is dry because background keygen has failed KEYPOOL_FAILURE_LIMIT times in a row, rethrows the last failure instead.
+   */
+  std::array<std::string, 2> take();
+
+  /**
+   * \brief Change the watermarks
+   */
+  void set_watermarks(size_t low_watermark, size_t high_watermark);
+
+  /**
+   * \brief Pairs ready to hand out
+   */
+  size_t depth();
+
+  /**
+   * \brief Current depth and generation counters
+   */
+  keypool_stats stats();
+
+private:
+  std::function<std::array<std::string, 2>()> keygen; /**< Pair generator */
+  size_t low_watermark; /**< Refill trigger */
+  size_t high_watermark; /**< Refill target */
+  std::deque<std::array<std::string, 2>> ready; /**< Generated pairs */
+  size_t in_flight = 0; /**< Pairs being generated right now */
+  bool refilling = true; /**< Truth state of refill (fills up on start) */
+  bool stopping = false; /**< Truth state of shutdown */
+  size_t generated = 0;
+  size_t taken = 0;
+  size_t misses = 0;
+  size_t failures = 0;
+  size_t failing = 0; /**< Background failures in a row */
+  std::exception_ptr last_error; /**< Most recent background failure, while failing */
+  double gen_seconds = 0; /**< Total time spent generating in the background */
+  std::chrono::steady_clock::time_point started; /**< Pool start */
+  std::mutex pool_mtx; /**< Memlock of everything above */
+  std::condition_variable pool_cv; /**< Wakes workers */
+  std::vector<std::thread> workers; /**< Background generators */
+
+  /**
+   * \brief Worker loop
+   */
+  void work();
+};
+
 // Message Locking
 namespace cMSG {
+  /**
+   * DSA envelopes from lock(std::string...) are untagged (version 0), as they always were.
+   * Every other envelope starts with MSG_MAGIC, a version byte and a flags byte; versions after MSG_V_STREAM add the signature algorithm tag.
+   * MSG_V_MULTI follows the tag with a slot count (4, BE) and the sorted key slots (key id | wrapped key), then the legacy cipher | nonce body.
+   * Untagged envelopes start with AES output, so about one in 2^32 starts with MSG_MAGIC and reads as tagged. In-memory unlocks that fail on such a
+   * tagged reading (unknown version, key mode mismatch, truncation, failed authentication) retry it as untagged, so it still opens. Stream unlock
+   * can't rewind, so an untagged envelope whose fifth byte is also a stream version (about one in 2^39) only opens in memory.
+   */
+  unsigned char version(std::string_view envelope);
+  // signature scheme of an envelope; untagged versions, and envelopes whose tag doesn't parse, are DSA
+  cDSA::Alg sig_alg(std::string_view envelope);
   std::string lock(
       std::string message, 
       bool use_asymm, 
@@ -51,12 +398,83 @@ namespace cMSG {
       std::string aes_key = "", 
       std::string rsa_pub_key = ""
   );
+  std::string lock(
+      std::string message, 
+      bool use_asymm, 
+      const cDSA::PriKey& dsa_pri_key, 
+      std::string aes_key = "", 
+      const cRSA::PubKey& rsa_pub_key = cRSA::PubKey()
+  );
   std::array<std::string, 2> unlock(
       std::string ciphertext, 
       bool use_asymm, 
       std::string aes_key = "", 
       std::string rsa_pri_key = ""
   );
+  std::array<std::string, 2> unlock(
+      std::string ciphertext, 
+      bool use_asymm, 
+      std::string aes_key, 
+      const cRSA::PriKey& rsa_pri_key
+  );
+  // symmetric envelopes under a long-lived key
+  std::string lock(
+      std::string message, 
+      const cDSA::PriKey& dsa_pri_key, 
+      cAES::Session& session
+  );
+  std::array<std::string, 2> unlock(
+      std::string ciphertext, 
+      cAES::Session& session
+  );
+  /**
+   * multi-recipient envelopes: one signature and one AES pass, then the content key is wrapped per recipient (in parallel).
+   * Key slots are sorted by recipient key id, so unlocking binary searches for its slot instead of trying each one.
+   */
+  std::string lock(
+      std::string message, 
+      const cDSA::PriKey& dsa_pri_key, 
+      std::span<const cRSA::PubKey> recipients, 
+      ThreadPool& pool = ThreadPool::shared()
+  );
+  // also accepts single-recipient asymmetric envelopes
+  std::array<std::string, 2> unlock(
+      std::string ciphertext, 
+      const cRSA::PriKey& rsa_pri_key
+  );
+  // batch unlocking, results[i] corresponds to ciphertexts[i], and is empty if that envelope doesn't unlock
+  std::vector<std::optional<std::array<std::string, 2>>> unlock_batch(
+      std::span<const std::string> ciphertexts, 
+      bool use_asymm, 
+      std::string aes_key = "", 
+      std::string rsa_pri_key = "", 
+      ThreadPool& pool = ThreadPool::shared()
+  );
+  std::vector<std::optional<std::array<std::string, 2>>> unlock_batch(
+      std::span<const std::string> ciphertexts, 
+      bool use_asymm, 
+      std::string aes_key, 
+      const cRSA::PriKey& rsa_pri_key, 
+      ThreadPool& pool = ThreadPool::shared()
+  );
+  // streamed locking, memory use stays constant for any message size with DSA;
+  // Ed25519 hashes the message twice, so its signer has to buffer the message
+  void lock(
+      cIO::Reader& message, 
+      cIO::Writer& ciphertext, 
+      bool use_asymm, 
+      const cDSA::PriKey& dsa_pri_key, 
+      std::string aes_key = "", 
+      const cRSA::PubKey& rsa_pub_key = cRSA::PubKey()
+  );
+  // writes the message, returns the signature; legacy envelopes are read whole and unlocked as before
+  std::string unlock(
+      cIO::Reader& ciphertext, 
+      cIO::Writer& message, 
+      bool use_asymm, 
+      std::string aes_key = "", 
+      const cRSA::PriKey& rsa_pri_key = cRSA::PriKey()
+  );
 }
 /**
  * \}
@@ -5,6 +5,38 @@
 #pragma once
 
 #include "tree.hpp"
+#include "store.hpp"
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <chrono>
+
+#define FTREE_CHECKPOINT "graph.ckpt"
+
+/**
+ * \brief Counters of a FileTree's directory watcher
+ */
+struct watch_stats {
+  uint64_t events; /**< Relevant inotify events (finished writes and move-ins of .block files) */
+  uint64_t batches; /**< Coalesced batches queued */
+  uint64_t overflows; /**< Kernel queue overflows, each answered with a rescan */
+  double last_lag_ms; /**< Oldest event to batch queued, for the latest batch */
+  double max_lag_ms; /**< Worst lag so far */
+  double mean_lag_ms; /**< Mean lag over all batches */
+};
+
+/**
+ * \brief Storage metrics for FileTree, in ns
+ */
+struct ftree_metrics {
+  Histogram& save; /**< FileTree::save, including stalls on a full write-behind queue */
+  Histogram& load; /**< FileTree::load, end to end */
+  Histogram& watch_lag; /**< Oldest watcher event to its batch being applied */
+  Counter& commit_failures; /**< Write-behind commits the store failed, each retried */
+
+  ftree_metrics(const metric_labels& instance, MetricsRegistry& registry = MetricsRegistry::shared());
+};
 
 /**
  * \brief Filesystem extension of Tree
@@ -17,41 +49,161 @@ protected:
    * \brief FileTree's storage directory.
    */
   std::string dir;
+
+  /**
+   * \brief On-disk layout of FileTree::dir
+   */
+  store_layout layout;
+
+  /**
+   * \brief Truth state of compressing contents in segmented layouts
+   */
+  bool compress;
+
+  /**
+   * \brief Storage backend for FileTree::dir
+   */
+  std::unique_ptr<BlockStore> store;
+
+  /**
+   * \brief Write-behind queue in front of FileTree::store
+   */
+  std::unique_ptr<WriteBehind> writer;
+
+  ftree_metrics ftree_stats; /**< Save, load and watcher latency */
   
   /**
-   * \brief Write block to FileTree::dir
+   * \brief Queue block for writing to FileTree::dir
    * \param to_save Block to save
+   *
+   * Returns once queued; see WriteBehind for when it becomes durable.
    */
   void save(block to_save) override;
 
+  /**
+   * \brief Commit queued writes and checkpoint the graph against the store
+   *
+   * A no-op for stores without BlockStore::mark. Callers hold push_proc_mtx.
+   */
+  void write_checkpoint();
+
   /**
    * \brief Kernel Queue File Descriptor
    */
   int kqfd = -1;
 
+  /**
+   * \brief Wakes the watcher for shutdown
+   */
+  int wake_fd = -1;
+
+  /**
+   * \brief Watch descriptor -> watched directory, '/' terminated
+   */
+  std::map<int, std::string> watches;
+
+  /**
+   * \brief Event loop over kqfd, started by the first install
+   */
+  std::thread watcher;
+
+  /**
+   * \brief Watcher counters, and lag sum for the mean
+   */
+  watch_stats watch_counters = {};
+  double watch_lag_total_ms = 0;
+
+  /**
+   * \brief Memlock of watches and the counters
+   */
+  std::mutex watch_mtx;
+
+  /**
+   * \brief Watcher loop; returns once woken through wake_fd
+   */
+  void watch_loop();
+
+  /**
+   * \brief Stop and join the watcher, and close its descriptors
+   */
+  void unwatch();
+
 public: 
   /**
    * \brief Loads a file descriptor for storage.
    * \param dir Directory to target
+   * \param progress Optional. Called periodically, and once when everything is parsed
+   *
+   * Reading and parsing is spread over ThreadPool::shared() (see BlockStore::load); everything is pushed as one batch at the end.
+   * Unreadable or unparsable entries are skipped.
+   *
+   * If dir holds a checkpoint whose store mark still matches, the checkpointed graph is restored as-is and only blocks stored after it are validated.
+   * A missing, corrupt or stale checkpoint (or a directory store, which has no mark) means full validation, after which a fresh checkpoint is written.
+   * Safe to call while the watcher is applying; the store is swapped under the push lock.
    */
-  void load(std::string dir);
+  void load(std::string dir, std::function<void(load_progress)> progress = nullptr);
+
+  /**
+   * \brief Reloads FileTree::dir
+   */
+  void load() override;
+
+  /**
+   * \brief Checkpoint the validated graph so the next load can skip validating it
+   *
+   * Also done after a load that validated anything, and on destruction.
+   */
+  void checkpoint();
+
+  /**
+   * \brief Durability barrier over every block saved so far
+   * \returns Resolves once they are all synced to storage
+   *
+   * Saves are write-behind: a pushed block is in the graph (and announced) before it is on disk. Await this when that matters.
+   * Carries the store's exception while commits are failing; they are retried in the background, so a later barrier can resolve.
+   */
+  std::shared_future<void> durable();
   
   /**
-   * \brief Install kernel monitoring on a file descriptor.
+   * \brief Watch a directory for new .block files
+   * \param path Directory to watch
+   *
+   * One watcher thread serves every installed directory: an epoll loop over a single inotify descriptor.
+   * Files are picked up once fully written (IN_CLOSE_WRITE) or moved in (IN_MOVED_TO), and events are coalesced over FileTree::watch_window into one apply().
+   * Linux only.
    */
   void install(std::string path);
+
+  /**
+   * \brief Coalescing window of the watcher
+   *
+   * Read by the watcher thread; set it before the first install.
+   */
+  std::chrono::milliseconds watch_window = std::chrono::milliseconds(20);
+
+  /**
+   * \brief Watcher counters
+   * \returns Snapshot
+   */
+  watch_stats get_watch_stats();
   
   /**
-   * \brief Apply a new block
-   * \param path Path to new block
+   * \brief Apply new blocks
+   * \param path Paths to new blocks
+   *
+   * Read as one batch; blocks already in the graph and files that don't parse are skipped, and the rest go to queue_batch.
    */
   void apply(std::unordered_set<std::string> path); 
 
   /**
    * \brief Storage directory. Contained blocks are gospel.
    * \param dir Directory to store.
+   * \param layout On-disk layout; existing directory stores can be moved over with SegmentStore::import
+   * \param compress Compress block contents (segmented and mapped layouts only, needs zstd); see ContCodec
+   *
+   * Metrics are labelled with the directory as the tree's name.
    */
-  FileTree(std::string fpath);
+  FileTree(std::string fpath, store_layout layout = store_layout::directory, bool compress = false);
   
   ~FileTree();
 };
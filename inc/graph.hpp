@@ -15,6 +15,16 @@
 #include <mutex>
 #include <cassert>
 #include <functional>
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#include "metrics.hpp"
+#include "trace.hpp"
+#include "bloom.hpp"
+
+// batches smaller than this have only every PUSH_STAGE_SAMPLE-th one's stages timed, so the clock stays out of their cost
+#define PUSH_STAGE_SAMPLE 16
 
 /** 
  * \brief A generic data structure for points on a graph
@@ -23,10 +33,95 @@
  */
 struct vertex {
   virtual std::unordered_set<std::string> p_trips() = 0; /**< Retrieve parent verticies' trips */
-  virtual std::string trip() = 0; /**< Retrieve vertex's trip */
+  virtual std::string trip() const = 0; /**< Retrieve vertex's trip */
   virtual bool operator == (const vertex& lhs) = 0; /**< Equivalence of hashes */
 };
 
+/**
+ * \brief Allocation size estimates for memory accounting
+ */
+namespace memsize {
+  /**
+   * \brief Bytes malloc sets aside for a request, header and rounding included (glibc's rules)
+   */
+  constexpr size_t chunk(size_t request) {return std::max<size_t>(32, (request + sizeof(size_t) + 15) & ~(size_t) 15);}
+
+  /**
+   * \brief Heap bytes of a string; short ones are held inline
+   */
+  inline size_t string(const std::string& str) {return str.capacity() > 15 ? chunk(str.capacity() + 1) : 0;}
+
+  /**
+   * \brief Heap bytes of one unordered_set entry, its bucket slot included
+   */
+  template<class T>
+  constexpr size_t set_entry() {return chunk(sizeof(void*) + sizeof(T) + (std::is_same_v<T, std::string> ? sizeof(size_t) : 0)) + sizeof(void*);}
+
+  /**
+   * \brief Heap bytes of one map entry, excluding what the key and value own
+   */
+  template<class K, class V>
+  constexpr size_t map_entry() {return chunk(4 * sizeof(void*) + sizeof(K) + sizeof(V));}
+}
+
+/**
+ * \brief Estimated heap bytes, by category
+ *
+ * Computed from container and string sizes as vertices come and go, not read from the allocator.
+ */
+struct memory_usage {
+  int64_t nodes = 0; /**< Graph entries: keys and linked<vertex> wrappers */
+  int64_t edges = 0; /**< Parent and child pointers */
+  int64_t content = 0; /**< Vertex data held in memory */
+  int64_t mapped = 0; /**< Vertex data left in mapped storage; only resident once read, so not part of total() */
+  int64_t indexes = 0; /**< Lookup structures beside the graph, e.g. server roots */
+  int64_t queued = 0; /**< Batches waiting in awaiting_push_batches */
+
+  int64_t total() const {return nodes + edges + content + indexes + queued;}
+
+  memory_usage& operator+=(const memory_usage& other) {
+    nodes += other.nodes;
+    edges += other.edges;
+    content += other.content;
+    mapped += other.mapped;
+    indexes += other.indexes;
+    queued += other.queued;
+    return *this;
+  }
+};
+
+/**
+ * \brief Memory accounting of a graph
+ */
+struct memory_report {
+  memory_usage current;
+  memory_usage peak; /**< Highest value of each category, each at its own time */
+  int64_t peak_total = 0; /**< Highest current.total() */
+  std::map<std::string, memory_usage> by_group; /**< Current, by graph_model::memory_group (s_trip for Tree). Queued batches aren't grouped */
+};
+
+/**
+ * \brief Push pipeline metrics
+ *
+ * Resolved once per graph, under the graph's instance labels (see graph_model::get_metric_instance), so graphs in one process don't share them.
+ */
+struct push_metrics {
+  Gauge& queue_depth; /**< Batches waiting in awaiting_push_batches */
+  Gauge& graph_size; /**< Linked vertices */
+  Counter& batches; /**< Batches pushed */
+  Counter& pushed; /**< Vertices linked */
+  Counter& disconnected; /**< Valid vertices dropped for missing parents */
+  Counter& duplicates; /**< Vertices dropped as already linked, before validation */
+  Histogram& batch_size; /**< Vertices offered per batch */
+  Histogram& get_valid; /**< Stage latencies, in ns; see PUSH_STAGE_SAMPLE */
+  Histogram& get_connected;
+  Histogram& link;
+  Histogram& push_response;
+  std::array<Gauge*, 6> memory; /**< Bytes by memory_usage category, in declaration order */
+
+  push_metrics(const metric_labels& instance, MetricsRegistry& registry = MetricsRegistry::shared());
+};
+
 /**
  * \brief A linked wrapper for vertices
  */
@@ -44,7 +139,20 @@ struct linked {
 template<class vertex>
 class graph_model {
 public:
-  graph_model();
+  /**
+   * \param name Optional. Added as a "name" label to the graph's metrics
+   */
+  graph_model(std::string name = std::string());
+
+  /**
+   * \brief Removes the graph's metrics from the registry
+   */
+  virtual ~graph_model();
+
+  /**
+   * \brief Labels on every metric of this graph: a process-unique "graph" id, plus "name" if one was given
+   */
+  const metric_labels& get_metric_instance() const {return this->metric_instance;}
   /** \brief Get graph's root
    * \returns Graph's root
    */
@@ -87,14 +195,104 @@ public:
    * \overload
    */
   void queue_batch(std::vector<vertex> to_queue);
+
+  /**
+   * \brief Push a batch on the calling thread
+   * \param to_push Batch to push
+   *
+   * Waits for the batch being pushed, if any, then pushes this one in place of the queue. Unlike queue_batch, it returns only once the batch is
+   * linked, whichever thread runs push_proc, so a caller feeding many batches holds one at a time.
+   */
+  void push_batch(std::unordered_set<vertex> to_push);
+
+  /**
+   * \brief Estimated memory use
+   * \returns Current and peak bytes by category, and current bytes by group
+   *
+   * Kept up to date on every push and queue, so reading it costs only a copy.
+   */
+  memory_report get_memory();
 protected:
   std::map<std::string, linked<vertex>> graph; /**< Graph */
-  linked<vertex>* graph_root; /**< Graph root */
-  bool rooted; /**< Truth state of graph root */
+  linked<vertex>* graph_root = nullptr; /**< Graph root */
+  bool rooted = false; /**< Truth state of graph root */
   
   std::queue<std::unordered_set<vertex>> awaiting_push_batches; /**< Queued batches */
   std::atomic<bool> push_proc_active = false; /**< Truth state of push proc */
   std::mutex push_proc_mtx; /**< Memlock of push proc */
+  metric_labels metric_instance; /**< See get_metric_instance; set before any metrics are resolved */
+  push_metrics push_stats; /**< Queue, batch and stage metrics */
+
+  BlockedBloom seen; /**< Every trip linked into the graph, so drop_known can skip the graph for new ones */
+
+  memory_report memory; /**< Memory accounting, see get_memory */
+  std::mutex memory_mtx; /**< Memlock of memory */
+
+  /**
+   * \brief Apply changes to the memory accounting
+   * \param deltas Byte changes by group; the empty group is counted in totals only
+   */
+  void account_memory(const std::map<std::string, memory_usage>& deltas);
+
+  /**
+   * \brief Zero current memory accounting, keeping peaks
+   */
+  void reset_memory();
+
+  /**
+   * \brief Recompute nodes, edges and contents from the graph
+   *
+   * Indexes are zeroed; derived models add their own back. For graphs built without batch_push, e.g. from a checkpoint.
+   */
+  void recount_memory();
+
+  /**
+   * \brief Bytes a linked vertex accounts for: its node, its edges to parents, and its vertex_memory
+   */
+  memory_usage linked_memory(const linked<vertex>& node);
+
+  /**
+   * \brief Bytes a queued batch holds: its entries and their in-memory contents
+   */
+  int64_t batch_memory(const std::unordered_set<vertex>& batch);
+
+  /**
+   * \brief Heap bytes owned by a vertex, as content or mapped
+   *
+   * Defaults to none beyond the vertex itself, which is counted with its node.
+   */
+  virtual memory_usage vertex_memory(const vertex& target);
+
+  /**
+   * \brief Group a vertex is accounted under in memory_report::by_group
+   *
+   * Defaults to ungrouped.
+   */
+  virtual std::string memory_group(const vertex& target);
+
+  /**
+   * \brief Drop vertices that are already linked
+   * \param batch Batch to filter
+   * \returns Vertices dropped
+   *
+   * Looks only at trips, so re-delivered vertices cost a filter probe and a graph lookup rather than validation.
+   * Callers hold push_proc_mtx.
+   */
+  size_t drop_known(std::unordered_set<vertex>& batch);
+
+  /**
+   * \brief Add a newly linked trip to seen, rebuilding it larger once full
+   *
+   * Callers hold push_proc_mtx.
+   */
+  void remember(const std::string& trip);
+
+  /**
+   * \brief Rebuild seen from the graph
+   *
+   * For graphs replaced wholesale. Accounts the filter as index memory; callers have zeroed index memory first.
+   */
+  void reseed_seen();
 
   /**
    * \brief Link vertex to graph as linked<vertex>
@@ -0,0 +1,95 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#define IBLT_KEYLEN 32 // raw digest bytes; block hashes are their hex encoding
+#define IBLT_HASHES 3
+
+/**
+ * \brief Set difference recovered from two IBLTs
+ */
+struct iblt_diff {
+  std::vector<std::string> only_ours; /**< Keys in the minuend only, hex encoded */
+  std::vector<std::string> only_theirs; /**< Keys in the subtrahend only, hex encoded */
+  bool complete; /**< Truth state of every difference being recovered; if false, retry with more cells */
+};
+
+/**
+ * \brief Invertible Bloom lookup table over digests
+ *
+ * Two parties fill same-sized tables with their keys; subtracting one from the other cancels shared keys, and the difference can be listed
+ * as long as it is up to roughly two thirds of the cell count. Table size (and so what gets sent) follows the expected difference, not the set size.
+ * Each key lands in one cell of each of IBLT_HASHES equal partitions.
+ */
+class IBLT {
+public:
+  /**
+   * \param cells Cell count, rounded up to a multiple of IBLT_HASHES
+   */
+  explicit IBLT(size_t cells);
+
+  /**
+   * \brief Add a key
+   * \param hex_key Hex encoded digest of IBLT_KEYLEN bytes
+   *
+   * Throws std::runtime_error on any other key.
+   */
+  void insert(const std::string& hex_key);
+
+  /**
+   * \brief Remove the keys of another table from this one
+   *
+   * Throws std::runtime_error if the tables differ in size.
+   */
+  IBLT& operator-=(const IBLT& other);
+
+  /**
+   * \brief List the keys of a difference table, i.e. ours minus theirs
+   *
+   * Peels a copy; the table itself is left as-is.
+   */
+  iblt_diff list() const;
+
+  size_t size() const {return (this->cells).size();}
+
+  /**
+   * \brief Compact binary form, for sending
+   */
+  std::string pack() const;
+
+  /**
+   * \brief Inverse of IBLT::pack, throws std::runtime_error on malformed input
+   */
+  static IBLT unpack(std::string_view packed);
+private:
+  struct cell {
+    int32_t count = 0;
+    std::array<uint8_t, IBLT_KEYLEN> key_sum = {};
+    uint64_t check_sum = 0;
+  };
+  std::vector<cell> cells;
+
+  /**
+   * \brief Add (sign 1) or remove (sign -1) a raw key
+   */
+  void toggle(const std::array<uint8_t, IBLT_KEYLEN>& key, int sign);
+
+  /**
+   * \brief Cell of each partition a key lands in
+   */
+  std::array<size_t, IBLT_HASHES> locate(const std::array<uint8_t, IBLT_KEYLEN>& key) const;
+
+  static uint64_t check(const std::array<uint8_t, IBLT_KEYLEN>& key);
+};
+
+/** \} */
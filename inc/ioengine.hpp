@@ -0,0 +1,114 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include "pool.hpp"
+
+#include <string>
+#include <vector>
+
+#if __has_include(<liburing.h>)
+#define CONCORD_URING 1
+#endif
+
+/**
+ * \brief One whole-file transfer in an IOEngine batch
+ */
+struct io_file {
+  std::string path; /**< File to read, write or sync */
+  std::string data; /**< Contents read, or contents to write */
+  bool ok = false; /**< Truth state of the transfer, set by the engine */
+};
+
+/**
+ * \brief Batched whole-file I/O
+ *
+ * Each call takes a whole batch, so backends can keep many transfers in flight at once.
+ * Failures are reported per file through io_file::ok; calls don't throw for I/O errors.
+ */
+class IOEngine {
+public:
+  virtual ~IOEngine() = default;
+
+  /**
+   * \brief Read files in full into io_file::data
+   */
+  virtual void read(std::vector<io_file>& files) = 0;
+
+  /**
+   * \brief Create or truncate files and write io_file::data to them
+   *
+   * Not durable until IOEngine::sync.
+   */
+  virtual void write(std::vector<io_file>& files) = 0;
+
+  /**
+   * \brief fsync files; io_file::data is ignored
+   */
+  virtual void sync(std::vector<io_file>& files) = 0;
+
+  /**
+   * \brief Backend name, for reporting
+   */
+  virtual std::string name() const = 0;
+
+  /**
+   * \brief Process-wide engine
+   * \returns UringEngine where liburing was available at build time and the kernel allows it, PoolEngine otherwise
+   */
+  static IOEngine& shared();
+};
+
+/**
+ * \brief Blocking POSIX I/O spread over a ThreadPool
+ */
+class PoolEngine : public IOEngine {
+public:
+  /**
+   * \param pool Pool to run on
+   */
+  PoolEngine(ThreadPool& pool = ThreadPool::shared());
+
+  void read(std::vector<io_file>& files) override;
+  void write(std::vector<io_file>& files) override;
+  void sync(std::vector<io_file>& files) override;
+  std::string name() const override;
+
+private:
+  ThreadPool& pool; /**< Workers */
+};
+
+#ifdef CONCORD_URING
+/**
+ * \brief io_uring backend
+ *
+ * Files are opened and sized directly, then up to depth reads, writes or fsyncs go to the kernel per submission; short transfers are resubmitted for the remainder.
+ * Each calling thread gets its own ring.
+ */
+class UringEngine : public IOEngine {
+public:
+  /**
+   * \param depth Ring size, and so transfers in flight per submission
+   */
+  UringEngine(unsigned depth = 256);
+
+  void read(std::vector<io_file>& files) override;
+  void write(std::vector<io_file>& files) override;
+  void sync(std::vector<io_file>& files) override;
+  std::string name() const override;
+
+  /**
+   * \brief Check that the kernel lets this process set up a ring
+   * \returns Truth state
+   */
+  static bool available();
+
+private:
+  unsigned depth; /**< Ring size */
+};
+#endif
+
+/** \} */
@@ -0,0 +1,277 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+/**
+ * \brief Monotonic count
+ */
+class Counter {
+public:
+  void inc(uint64_t n = 1) {(this->count).fetch_add(n, std::memory_order_relaxed);}
+  uint64_t value() const {return (this->count).load(std::memory_order_relaxed);}
+private:
+  std::atomic<uint64_t> count = 0;
+};
+
+/**
+ * \brief Value that moves both ways, e.g. a queue depth
+ */
+class Gauge {
+public:
+  void set(int64_t v) {(this->current).store(v, std::memory_order_relaxed);}
+  void add(int64_t n) {(this->current).fetch_add(n, std::memory_order_relaxed);}
+  int64_t value() const {return (this->current).load(std::memory_order_relaxed);}
+private:
+  std::atomic<int64_t> current = 0;
+};
+
+/**
+ * \brief Point-in-time view of a Histogram, in recorded units
+ */
+struct histogram_snapshot {
+  uint64_t count; /**< Values recorded */
+  uint64_t sum; /**< Sum of values recorded */
+  uint64_t max; /**< Largest value recorded */
+  double p50;
+  double p90;
+  double p99;
+  double p999;
+};
+
+/**
+ * \brief Log-linear (HDR-style) histogram of unsigned values
+ *
+ * Each power of two is split into HIST_SUB linear buckets, so any value lands in a bucket within ~3% of it.
+ * Recording is a handful of relaxed atomics and never locks; snapshots may tear across buckets, which only blurs quantiles while values are in flight.
+ */
+class Histogram {
+public:
+  static constexpr unsigned HIST_SUB_BITS = 5;
+  static constexpr uint64_t HIST_SUB = 1 << HIST_SUB_BITS;
+  static constexpr size_t HIST_BUCKETS = (64 - HIST_SUB_BITS + 1) * HIST_SUB;
+
+  void record(uint64_t v);
+  histogram_snapshot snapshot() const;
+
+  /**
+   * \brief Bucket a value lands in
+   */
+  static size_t bucket(uint64_t v);
+
+  /**
+   * \brief Smallest and largest value of a bucket
+   */
+  static std::array<uint64_t, 2> bounds(size_t bucket);
+private:
+  std::array<std::atomic<uint64_t>, HIST_BUCKETS> buckets = {};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> max = 0;
+};
+
+/**
+ * \brief Records the lifetime of a scope into a Histogram, in nanoseconds
+ */
+class ScopedTimer {
+public:
+  explicit ScopedTimer(Histogram& target) : target(target), start(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() {
+    (this->target).record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start).count());
+  }
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+private:
+  Histogram& target;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * \brief Records consecutive stages into Histograms, in nanoseconds
+ *
+ * One clock read per stage instead of ScopedTimer's two, for paths cheap enough to notice.
+ * A disabled timer never reads the clock, so callers can sample.
+ */
+class LapTimer {
+public:
+  explicit LapTimer(bool enabled = true) : enabled(enabled) {
+    if (enabled) this->last = std::chrono::steady_clock::now();
+  }
+
+  /**
+   * \brief Record the time since construction or the last lap
+   */
+  void lap(Histogram& stage) {
+    if (!this->enabled) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    stage.record(std::chrono::duration_cast<std::chrono::nanoseconds>(now - this->last).count());
+    this->last = now;
+  }
+private:
+  bool enabled;
+  std::chrono::steady_clock::time_point last;
+};
+
+using metric_labels = std::map<std::string, std::string>;
+
+/**
+ * \brief Labels plus a few more, e.g. an instance's labels plus a stage
+ */
+inline metric_labels
+with_labels(metric_labels base, const metric_labels& extra) {
+  base.insert(extra.begin(), extra.end());
+  return base;
+}
+
+enum class metric_kind {counter, gauge, histogram};
+
+/**
+ * \brief One labelled metric, as read by MetricsRegistry::snapshot
+ */
+struct metric_sample {
+  std::string name;
+  std::string help;
+  metric_kind kind;
+  metric_labels labels;
+  double value; /**< Counters and gauges */
+  histogram_snapshot hist; /**< Histograms, in recorded units */
+  double scale; /**< Histograms: multiply recorded units by this for the exported unit */
+};
+
+/**
+ * \brief Metric samples, grouped by name and then labels
+ */
+struct metrics_snapshot {
+  std::vector<metric_sample> samples;
+};
+
+/**
+ * \brief Named, labelled metrics
+ *
+ * Lookups lock, so hot paths resolve their metrics once and keep the reference; metrics live as long as the registry.
+ * Most callers want MetricsRegistry::shared(), which the graph, Tree and FileTree report into.
+ */
+class MetricsRegistry {
+public:
+  /**
+   * \brief Find or create a counter
+   * \param name Metric name, e.g. concord_push_batches_total
+   * \param help Description, taken from the first registration of name
+   * \param labels Optional. Distinguishes metrics sharing a name
+   */
+  Counter& counter(std::string name, std::string help, metric_labels labels = metric_labels());
+
+  /**
+   * \overload
+   */
+  Gauge& gauge(std::string name, std::string help, metric_labels labels = metric_labels());
+
+  /**
+   * \overload
+   * \param scale Exported unit per recorded unit, e.g. 1e-9 for nanoseconds recorded and seconds exported
+   */
+  Histogram& histogram(std::string name, std::string help, metric_labels labels = metric_labels(), double scale = 1);
+
+  /**
+   * \brief Remove every metric carrying all of the given labels
+   * \param match Labels to match, e.g. an instance's
+   *
+   * References to removed metrics dangle, so only their owner calls this, once it has stopped recording.
+   */
+  void drop(const metric_labels& match);
+
+  /**
+   * \brief Read every metric
+   */
+  metrics_snapshot snapshot();
+
+  /**
+   * \brief Every metric in Prometheus text exposition format
+   *
+   * Histograms are exported as summaries (quantiles, _sum and _count).
+   */
+  std::string prometheus();
+
+  /**
+   * \brief Write prometheus() to a file, replaced atomically so scrapers never see half of it
+   * \param path Output path, e.g. for node_exporter's textfile collector
+   */
+  void write_prometheus(std::string path);
+
+  /**
+   * \brief Process-wide registry
+   */
+  static MetricsRegistry& shared();
+private:
+  struct family {
+    std::string help;
+    metric_kind kind;
+    double scale = 1;
+    std::map<metric_labels, std::unique_ptr<Counter>> counters;
+    std::map<metric_labels, std::unique_ptr<Gauge>> gauges;
+    std::map<metric_labels, std::unique_ptr<Histogram>> histograms;
+  };
+  std::map<std::string, family> families; /**< By name */
+  std::mutex registry_mtx;
+
+  family& find_family(const std::string& name, const std::string& help, metric_kind kind);
+};
+
+/**
+ * \brief Periodically hands a registry's Prometheus text to a sink
+ */
+class MetricsExporter {
+public:
+  /**
+   * \param registry Registry to export
+   * \param sink Called with the exposition text, from the exporter's thread
+   * \param interval Time between exports
+   */
+  MetricsExporter(
+      MetricsRegistry& registry,
+      std::function<void(const std::string&)> sink,
+      std::chrono::milliseconds interval = std::chrono::seconds(15)
+      );
+
+  /**
+   * \overload
+   * \param path File to keep replaced with the latest export
+   */
+  MetricsExporter(
+      MetricsRegistry& registry,
+      std::string path,
+      std::chrono::milliseconds interval = std::chrono::seconds(15)
+      );
+
+  /**
+   * \brief Exports one last time, then stops
+   */
+  ~MetricsExporter();
+private:
+  MetricsRegistry& registry;
+  std::function<void(const std::string&)> sink;
+  std::chrono::milliseconds interval;
+  bool stopping = false;
+  std::mutex export_mtx;
+  std::condition_variable stop_cv;
+  std::thread exporter;
+
+  void run();
+};
+
+/** \} */
@@ -0,0 +1,77 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * \brief Fixed-size worker pool
+ *
+ * Used for the batch crypto and loading paths; most callers want ThreadPool::shared().
+ */
+class ThreadPool {
+public:
+  /**
+   * \brief Spin up workers
+   * \param workers Worker count, hardware concurrency by default
+   */
+  ThreadPool(size_t workers = std::thread::hardware_concurrency());
+
+  /**
+   * \brief Drains queued tasks, then joins all workers
+   */
+  ~ThreadPool();
+
+  /**
+   * \brief Number of workers
+   * \returns Worker count
+   */
+  size_t size() const;
+
+  /**
+   * \brief Queue a task for any worker
+   * \param task Task to run
+   *
+   * Exceptions escaping task are dropped, so a task that must report failure catches its own.
+   */
+  void submit(std::function<void()> task);
+
+  /**
+   * \brief Run a function over an index range
+   * \param count Number of indices
+   * \param fn Function called once for every index in [0, count)
+   *
+   * Blocking. The range is cut into contiguous chunks and the calling thread works chunks too, so nested calls from inside a worker can't deadlock.
+   * The first exception thrown by fn is rethrown once every chunk has finished.
+   */
+  void parallel_for(size_t count, std::function<void(size_t)> fn);
+
+  /**
+   * \brief Process-wide pool sized to the hardware
+   * \returns Shared pool
+   */
+  static ThreadPool& shared();
+
+private:
+  std::vector<std::thread> workers; /**< Worker threads */
+  std::queue<std::function<void()>> tasks; /**< Queued tasks */
+  std::mutex tasks_mtx; /**< Memlock of tasks */
+  std::condition_variable tasks_cv; /**< Signals new tasks or shutdown */
+  bool stopping = false; /**< Truth state of shutdown */
+
+  /**
+   * \brief Worker loop
+   */
+  void work();
+};
+
+/** \} */
@@ -0,0 +1,487 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include "tree.hpp"
+#include "pool.hpp"
+#include "ioengine.hpp"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <deque>
+#include <chrono>
+#include <exception>
+#include <memory>
+#include <cstdint>
+
+/**
+ * \brief Progress of a BlockStore::load
+ */
+struct load_progress {
+  size_t found; /**< Stored blocks (files or records) discovered so far */
+  size_t loaded; /**< Blocks read and parsed */
+  size_t skipped; /**< Unreadable or unparsable entries */
+  bool enumerated; /**< Truth state of enumeration being finished */
+  double files_per_sec; /**< Read + parse rate so far */
+};
+
+/**
+ * \brief On-disk layouts FileTree can use
+ */
+enum class store_layout {
+  directory, /**< One <hash>.block JSON file per block */
+  segmented, /**< Append-only segment files with a hash index */
+  mapped /**< segmented, loaded through read-only mappings with lazy block contents */
+};
+
+/**
+ * \brief Persistent block storage beneath FileTree
+ */
+class BlockStore {
+public:
+  virtual ~BlockStore() = default;
+
+  /**
+   * \brief Store a block
+   * \param to_put Block to store
+   *
+   * Not durable until BlockStore::sync.
+   */
+  virtual void put(const block& to_put) = 0;
+
+  /**
+   * \brief Store several blocks
+   * \param to_put Blocks to store
+   *
+   * Not durable until BlockStore::sync. Stores that can batch their writes override this.
+   */
+  virtual void put_batch(const std::vector<block>& to_put) {
+    for (const auto& b : to_put) put(b);
+  }
+
+  /**
+   * \brief Make every put so far durable
+   */
+  virtual void sync() = 0;
+
+  /**
+   * \brief Check whether a block is stored
+   * \param hash Hash of the block
+   * \returns Truth state
+   */
+  virtual bool contains(const std::string& hash) = 0;
+
+  /**
+   * \brief Read every stored block
+   * \param progress Optional. Called periodically and once at the end; calls never overlap, but may come from pool threads
+   * \returns Every block that could be read
+   */
+  virtual std::unordered_set<block> load(std::function<void(load_progress)> progress = nullptr) = 0;
+
+  /**
+   * \brief Opaque description of everything stored so far, for checkpoints
+   * \returns Empty if the store can't describe its contents this way
+   */
+  virtual std::string mark() {return "";}
+
+  /**
+   * \brief Check a mark against the current contents
+   * \param mark A result of BlockStore::mark
+   * \returns Truth state of the marked contents still being stored, unchanged, ahead of anything newer
+   */
+  virtual bool matches(std::string_view mark) {return false;}
+};
+
+/**
+ * \brief One JSON file per block, the original FileTree layout
+ */
+class DirStore : public BlockStore {
+public:
+  /**
+   * \param dir Directory holding the .block files
+   * \param engine Engine for file reads, writes and syncs
+   */
+  DirStore(std::string dir, IOEngine& engine = IOEngine::shared());
+
+  void put(const block& to_put) override;
+
+  /**
+   * \brief Write all files in one IOEngine batch
+   */
+  void put_batch(const std::vector<block>& to_put) override;
+
+  /**
+   * \brief fsync every file written since the last sync in one IOEngine batch, then the directory
+   */
+  void sync() override;
+  bool contains(const std::string& hash) override;
+
+  /**
+   * \brief Read every .block file
+   *
+   * The directory is enumerated on the calling thread while chunks of files are read (one IOEngine batch each) and parsed on ThreadPool::shared().
+   * Unreadable or unparsable files are skipped. Any other failure (the IOEngine, allocation, the directory itself) is rethrown here once every chunk is done.
+   */
+  std::unordered_set<block> load(std::function<void(load_progress)> progress = nullptr) override;
+
+protected:
+  std::string dir; /**< Storage directory, '/' terminated */
+  IOEngine& engine; /**< File I/O */
+  std::unordered_set<std::string> unsynced; /**< Files written since the last sync */
+  std::mutex store_mtx; /**< Memlock of unsynced */
+};
+
+#if __has_include(<zstd.h>) && __has_include(<zdict.h>)
+#define CONCORD_ZSTD 1
+#endif
+
+#define SEGMENT_LIMIT (256ull << 20)
+#define WRITE_BEHIND_BACKOFF_MS 10 // first wait before retrying a failed commit, doubling per failure in a row
+#define WRITE_BEHIND_BACKOFF_MAX_MS 1000
+
+/**
+ * \brief Counters of a ContCodec
+ */
+struct codec_stats {
+  uint64_t raw_bytes; /**< Contents offered for compression */
+  uint64_t stored_bytes; /**< What they took up in records */
+  uint64_t compressed; /**< Contents stored compressed */
+  uint64_t passed; /**< Contents stored as-is, since compression didn't pay */
+  size_t dictionaries; /**< Trained dictionaries, one per 'server' at most */
+  size_t sample_bytes; /**< Training samples held, across servers still without a dictionary */
+  double ratio; /**< raw_bytes / stored_bytes */
+};
+
+/**
+ * \brief zstd compression of block contents, with a trained dictionary per 'server' (s_trip)
+ *
+ * Contents are compressed without a dictionary until enough samples of a server's blocks have been seen, then a dictionary is trained and used for everything after.
+ * Training runs on ThreadPool::shared(), one server at a time, so compress() never waits on it; the server's contents go without a dictionary until it is installed.
+ * Samples are held in memory only, within a budget across all servers; past it, the server with the fewest sample bytes loses them and starts over.
+ * Dictionaries are kept as dict-<id>.zdict files next to the records that need them, and are written before any such record.
+ * Built only with zstd; without it, available() is false and compressed records can't be read.
+ */
+class ContCodec {
+public:
+  /**
+   * \param dir Directory for dictionary files, '/' terminated
+   * \param level zstd level
+   * \param dict_size Target dictionary size
+   */
+  ContCodec(std::string dir, int level = 3, size_t dict_size = 16 << 10);
+
+  /**
+   * \brief Waits for a training in progress
+   */
+  ~ContCodec();
+
+  /**
+   * \brief Compress one block's contents
+   * \param s_trip Server the block belongs to, selecting the dictionary
+   * \param cont Contents
+   * \param dict_id Set to the dictionary used, 0 for none
+   * \param out Set to the compressed contents
+   * \returns Truth state of compression paying off; when false, store cont as-is
+   */
+  bool compress(const std::string& s_trip, std::string_view cont, uint32_t& dict_id, std::string& out);
+
+  /**
+   * \brief Decoder for contents compressed by ContCodec::compress
+   * \param dict_id Dictionary they were compressed with
+   * \param raw_len Uncompressed length
+   * \returns Decoder that throws std::runtime_error on corrupt input or an unknown dictionary
+   */
+  std::function<std::string(std::string_view)> decoder(uint32_t dict_id, uint32_t raw_len);
+
+  codec_stats stats();
+
+  /**
+   * \brief Truth state of zstd having been built in
+   */
+  static bool available();
+
+private:
+  struct dictionary; /**< Compression and decompression forms of one trained dictionary */
+
+  std::string dir; /**< Dictionary directory */
+  int level; /**< zstd level */
+  size_t dict_size; /**< Target dictionary size */
+  std::unordered_map<std::string, std::shared_ptr<dictionary>> by_server; /**< s_trip -> dictionary */
+  std::unordered_map<uint32_t, std::shared_ptr<dictionary>> by_id; /**< Dictionary id -> dictionary */
+  /**
+   * \brief One server's training samples
+   */
+  struct sample_set {
+    std::vector<std::string> samples;
+    size_t bytes = 0; /**< Bytes in samples */
+    uint64_t last = 0; /**< sample_clock when last added to */
+  };
+  std::unordered_map<std::string, sample_set> samples; /**< Training samples, per server still without a dictionary */
+  uint64_t sample_clock = 0; /**< Samples ever taken, to order sample_set::last */
+  std::unordered_set<std::string> untrainable; /**< Servers training gave up on */
+  std::optional<std::string> training; /**< Server being trained on the pool, if any */
+  std::shared_ptr<void> cctx; /**< Reused compression context */
+  codec_stats counters = {}; /**< Counters */
+  std::mutex codec_mtx; /**< Memlock of everything above */
+  std::condition_variable trained_cv; /**< Signals a training finishing */
+
+  /**
+   * \brief Keep a sample of a server's contents, starting its training once there are enough
+   *
+   * Callers hold codec_mtx.
+   */
+  void sample(const std::string& s_trip, std::string_view cont);
+
+  /**
+   * \brief Train, persist and install a server's dictionary, or give up on it
+   * \param s_trip Server
+   * \param taken Its samples, moved out of samples
+   *
+   * Runs on the pool, taking codec_mtx only to check and install the dictionary.
+   */
+  void train(const std::string& s_trip, std::vector<std::string> taken);
+};
+
+/**
+ * \brief Location of a record in a SegmentStore
+ */
+struct segment_loc {
+  uint32_t segment; /**< Segment number */
+  uint64_t offset; /**< Offset of the record frame */
+  uint32_t len; /**< Payload length */
+};
+
+/**
+ * \brief Append-only segmented log
+ *
+ * Blocks are appended to seg-<n>.log as length | CRC32C | block::pack() frames, and segments roll over at a size limit.
+ * With compression on, the top bit of the length marks records whose payload is codec (1) | dictionary id (4) | raw cont length (4) | block::pack() of the block with its cont compressed.
+ * The next bit marks records whose payload starts with a CRC32C of the rest of it short of cont, so the header can be checked without reading cont; records written before it lack one.
+ * index.log holds fixed-size hash -> location entries, each with its own CRC32C.
+ * On open, torn index entries are dropped and the segment tail past the index is re-scanned: whole records are re-indexed and a torn tail is truncated.
+ */
+class SegmentStore : public BlockStore {
+public:
+  /**
+   * \param dir Directory holding segments and index, created if missing
+   * \param segment_limit Segment size at which a new segment is started
+   * \param compress Compress contents of new records with ContCodec; throws std::runtime_error if built without zstd
+   *
+   * Compressed records are read either way.
+   */
+  SegmentStore(std::string dir, uint64_t segment_limit = SEGMENT_LIMIT, bool compress = false);
+  ~SegmentStore();
+
+  void put(const block& to_put) override;
+  void sync() override;
+  bool contains(const std::string& hash) override;
+
+  /**
+   * \brief Read every record
+   *
+   * Segments are read sequentially and parsed in parallel on ThreadPool::shared().
+   */
+  std::unordered_set<block> load(std::function<void(load_progress)> progress = nullptr) override;
+
+  /**
+   * \brief Read one block
+   * \param hash Hash of the block
+   * \returns The stored block; throws std::out_of_range if missing
+   */
+  block get(const std::string& hash);
+
+  /**
+   * \brief Copy every block of another store that isn't here yet, then sync
+   * \param source Store to migrate from, e.g. a DirStore over an old FileTree directory
+   * \param pow Optional. Proof of work required of imported blocks
+   * \returns Blocks imported
+   *
+   * Blocks are hashed (in parallel on ThreadPool::shared()) before they're written; ones that don't match their hash or fall short of pow are skipped.
+   */
+  size_t import(BlockStore& source, int pow = 0);
+
+  /**
+   * \brief Compression counters for records written since open
+   */
+  codec_stats compression();
+
+  /**
+   * \brief Index entry count and the digest chained over their CRCs, plus record count and the digest chained over record CRCs in segment order
+   *
+   * The record digest covers contents, so a checkpoint can't outlive a segment being changed under an unchanged index.
+   * Empty until load() has read every record's CRC.
+   */
+  std::string mark() override;
+  bool matches(std::string_view mark) override;
+
+protected:
+  std::string dir; /**< Storage directory, '/' terminated */
+  uint64_t segment_limit; /**< Rollover size */
+  std::unordered_map<std::string, segment_loc> index; /**< Hash -> record */
+  std::vector<uint32_t> index_digests; /**< Digest of the index up to and including each entry, in log order */
+  std::vector<uint32_t> record_digests; /**< Digest of the records up to and including each one, in segment order */
+  bool records_digested = false; /**< Truth state of record_digests covering every record; set by load */
+  uint32_t active_segment = 0; /**< Segment being appended to */
+  uint64_t active_size = 0; /**< Size of the active segment */
+  int segment_fd = -1; /**< Active segment */
+  int index_fd = -1; /**< Index log */
+  bool torn = false; /**< Truth state of a failed put leaving bytes it couldn't truncate; puts refuse until reopened */
+  std::unique_ptr<ContCodec> codec; /**< Content codec; null without zstd */
+  bool compress = false; /**< Truth state of compressing new records */
+  std::mutex store_mtx; /**< Memlock of everything above */
+
+  /**
+   * \brief Path of a segment
+   */
+  std::string segment_path(uint32_t segment);
+
+  /**
+   * \brief Open (or start) the newest segment for appending
+   */
+  void open_active(uint32_t segment);
+
+  /**
+   * \brief Rebuild the index and repair torn tails
+   */
+  void recover();
+
+  /**
+   * \brief Append an entry to the index log and the in-memory index
+   */
+  void index_put(const std::string& hash, segment_loc loc);
+
+  /**
+   * \brief Extend SegmentStore::index_digests by one entry
+   */
+  void index_chain(uint32_t entry_crc);
+
+  /**
+   * \brief Rebuild SegmentStore::record_digests from the record CRCs of every segment, in order
+   */
+  void digest_records(const std::vector<std::vector<uint32_t>>& segment_crcs);
+
+  /**
+   * \brief Turn a record payload back into a block
+   * \param payload Record payload
+   * \param flags Flag bits of the record frame's length
+   * \param owner Optional. Keeps payload alive, so cont can stay in it; without one, cont is copied out (still compressed, if it was)
+   * \param check Optional. Record integrity check, deferred to first access of cont
+   *
+   * Compressed contents are decompressed lazily, on first access. Throws std::runtime_error if the record has a header CRC and it doesn't match.
+   */
+  block decode_record(std::string_view payload, uint32_t flags, std::shared_ptr<const void> owner = nullptr, std::function<bool()> check = nullptr);
+};
+
+/**
+ * \brief SegmentStore that loads through memory mappings
+ *
+ * Segments are mapped read-only and only block headers (time, hashes, trips, parents) are decoded on load.
+ * Each block's cont is a lazy_string pointing into the mapping, which stays mapped while any block references it; the record CRC is checked the first time cont is read.
+ * Headers are checked against their own CRC on load, or for older records without one, against the record CRC. Records that fail are skipped.
+ * Startup cost and resident memory therefore follow header size rather than content size, as long as contents are large enough to span pages that are never touched.
+ */
+class MappedStore : public SegmentStore {
+public:
+  using SegmentStore::SegmentStore;
+
+  /**
+   * \brief Map every segment and decode block headers
+   *
+   * Segments are decoded in parallel on ThreadPool::shared(). Record CRCs are deferred to first access of cont, except for records without a header CRC.
+   */
+  std::unordered_set<block> load(std::function<void(load_progress)> progress = nullptr) override;
+};
+
+/**
+ * \brief Counters of a WriteBehind queue
+ */
+struct write_behind_stats {
+  size_t depth; /**< Blocks queued and not yet handed to the store */
+  uint64_t committed; /**< Blocks put and synced */
+  uint64_t batches; /**< Group commits (one sync each) */
+  uint64_t stalls; /**< put() calls that waited on a full queue */
+  uint64_t failures; /**< Commits that failed and were retried */
+  bool failing; /**< Truth state of the last commit having failed */
+};
+
+/**
+ * \brief Bounded write-behind queue with group commit in front of a BlockStore
+ *
+ * put() only queues; one background thread drains the queue in batches, handing each to BlockStore::put_batch followed by one BlockStore::sync.
+ * A batch closes when the queue fills, when a barrier is waiting, or after the commit window.
+ *
+ * A failed commit (ENOSPC, EIO) is retried with backoff, together with whatever was queued since, until it goes through; put() never throws it.
+ * While commits fail, barriers resolve with the store's exception at once and put() blocks once the queue is full, so nothing is lost and memory stays bounded.
+ *
+ * Crash rule: a block is durable once a barrier() taken after its put() has resolved, and not before.
+ * Blocks that were put (and so already pushed into the graph and announced) but not yet committed are simply absent after a crash; stores drop any torn tail on open, and such blocks come back the way any missing block does, from peers or by regenerating them.
+ * Checkpoints are only written after a barrier, so they never cover unflushed blocks.
+ */
+class WriteBehind {
+public:
+  /**
+   * \param store Store to write to; must outlive the queue
+   * \param capacity Queued blocks at which put() starts blocking
+   * \param window Longest a queued block waits for company before being committed
+   * \param failures Optional. Counts failed commits
+   */
+  WriteBehind(BlockStore& store, size_t capacity = 4096, std::chrono::milliseconds window = std::chrono::milliseconds(5), Counter* failures = nullptr);
+
+  /**
+   * \brief Commits whatever is still queued, with one try if commits are failing
+   */
+  ~WriteBehind();
+
+  /**
+   * \brief Queue a block
+   * \param to_put Block to store
+   *
+   * Blocks only while the queue is full. Store failures stay with the committer; see barrier().
+   */
+  void put(block to_put);
+
+  /**
+   * \brief Durability barrier
+   * \returns Resolves once every block put so far is synced; carries the store's exception if a commit fails first, or if commits are already failing
+   */
+  std::shared_future<void> barrier();
+
+  write_behind_stats stats();
+
+private:
+  BlockStore& store; /**< Backing store */
+  size_t capacity; /**< Queue bound */
+  std::chrono::milliseconds window; /**< Commit window */
+  std::vector<block> queue; /**< Blocks awaiting commit */
+  uint64_t queued = 0; /**< Blocks ever queued */
+  uint64_t committed = 0; /**< Blocks ever committed */
+  uint64_t batches = 0; /**< Commits */
+  uint64_t stalls = 0; /**< Full-queue waits */
+  uint64_t failures = 0; /**< Failed commits */
+  Counter* failure_count; /**< Optional metric of failures */
+  std::deque<std::pair<uint64_t, std::promise<void>>> waiters; /**< Barriers, by the queued count they wait for */
+  std::exception_ptr failure; /**< Last store failure, until a commit goes through again */
+  bool stopping = false; /**< Truth state of shutdown */
+  std::mutex queue_mtx; /**< Memlock of everything above */
+  std::condition_variable work_cv; /**< Wakes the committer */
+  std::condition_variable space_cv; /**< Wakes stalled put() calls */
+  std::thread committer; /**< Background committer */
+
+  /**
+   * \brief Committer loop
+   */
+  void run();
+};
+
+/** \} */
@@ -5,7 +5,9 @@
 
 #pragma once
 #include <string>
+#include <string_view>
 #include <array>
+#include <cstdint>
 #include <fstream>
 
 // B64
@@ -27,6 +29,8 @@ namespace gen {
   // HASH
   std::string hash(bool use_disk, std::string target);
   std::string trip(std::string data, size_t outlen = 24);
+  // CRC32C, for framing checksums (not security)
+  uint32_t crc(std::string_view data);
 }
 
 // HASH GEN
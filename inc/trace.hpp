@@ -0,0 +1,102 @@
+/**
+ * \addtogroup Core
+ * \{
+ */
+
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Spans are compiled in with -DCONCORD_TRACE (make TRACE=1). Without it TRACE_SPAN expands to nothing,
+ * and the trace:: functions still link but only ever see empty rings.
+ */
+
+#define TRACE_RING (1 << 14) // spans held per thread
+#define TRACE_DEAD_RINGS 8 // finished threads' rings held for a flush; past this, a new thread takes the oldest one, unflushed spans and all
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT_(a, b)
+
+#ifdef CONCORD_TRACE
+/**
+ * \brief Record the rest of the enclosing scope as a span
+ *
+ * TRACE_SPAN("name") or TRACE_SPAN("name", n); name must be a string literal, n is an optional count shown as the span's argument.
+ */
+#define TRACE_SPAN(...) trace::span TRACE_CAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...) ((void) 0)
+#endif
+
+namespace trace {
+  /**
+   * \brief Truth state of spans being compiled in
+   */
+  constexpr bool enabled() {
+#ifdef CONCORD_TRACE
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /**
+   * \brief Nanoseconds on the trace clock
+   */
+  inline uint64_t
+  now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * \brief Append a finished span to the calling thread's ring
+   * \param name Span name, a string literal
+   * \param start_ns Start, from trace::now()
+   * \param dur_ns Duration
+   * \param arg Count shown with the span, or -1 for none
+   *
+   * Lock-free: each thread writes only its own ring, overwriting its oldest spans once TRACE_RING are held.
+   */
+  void record(const char* name, uint64_t start_ns, uint64_t dur_ns, int64_t arg = -1);
+
+  /**
+   * \brief Every held span as Chrome trace event JSON, loadable by chrome://tracing and Perfetto
+   *
+   * Safe while threads are still recording; spans overwritten mid-read are left out. A finished thread's spans stay until a new thread takes
+   * its ring, which waits for them to be read here unless TRACE_DEAD_RINGS rings are already waiting.
+   */
+  std::string chrome_json();
+
+  /**
+   * \brief Write chrome_json() to a file
+   */
+  void write_chrome(std::string path);
+
+  /**
+   * \brief Drop every held span
+   *
+   * Only spans already recorded are dropped; rings keep their threads.
+   */
+  void clear();
+
+  /**
+   * \brief Scope guard behind TRACE_SPAN
+   */
+  class span {
+  public:
+    explicit span(const char* name, int64_t arg = -1) : name(name), arg(arg), start(now()) {}
+    ~span() {record(this->name, this->start, now() - this->start, this->arg);}
+    span(const span&) = delete;
+    span& operator=(const span&) = delete;
+  private:
+    const char* name;
+    int64_t arg;
+    uint64_t start;
+  };
+}
+
+/** \} */
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_set>
 #include <map>
@@ -17,11 +18,20 @@
 #include <errno.h>
 #include <atomic>
 #include <mutex>
+#include <memory>
+#include <functional>
 #include <cassert>
+#include <set>
+#include <optional>
+#include <climits>
+#include <unordered_map>
+#include <variant>
+#include <shared_mutex>
 
 #include "crypt.hpp"
 #include "strops.hpp"
 #include "graph.hpp"
+#include "iblt.hpp"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -38,6 +48,83 @@ namespace timeh {
   unsigned long long from_string(std::string str_time);
 };
 
+/**
+ * \brief String that may still live in mapped storage
+ *
+ * Owned contents are held inline, like a plain string. Source-backed ones keep their state on the heap, shared by copies: mapped bytes can
+ * be read in place with view(), and get() copies them out once, on first use.
+ */
+class lazy_string {
+public:
+  /**
+   * \brief Bytes backing a lazy_string
+   */
+  struct source {
+    std::shared_ptr<const void> owner; /**< Keeps bytes alive, e.g. a segment mapping */
+    std::string_view bytes; /**< Contents, or their encoding if decode is set */
+    std::function<bool()> check; /**< Optional. Integrity check, run once before the bytes are first read */
+    std::function<std::string(std::string_view)> decode; /**< Optional. Turns bytes into the contents, which then can't be viewed in place */
+  };
+
+  lazy_string();
+  lazy_string(std::string value);
+  lazy_string(const char* value);
+  lazy_string(source backing);
+
+  /**
+   * \brief Materialized contents
+   *
+   * Throws std::runtime_error if the source fails its check. An encoded source lets go of its bytes' owner once decoded.
+   */
+  const std::string& get() const;
+
+  /**
+   * \brief Contents without copying out of the source
+   *
+   * Encoded sources are materialized first. Throws std::runtime_error if the source fails its check.
+   */
+  std::string_view view() const;
+
+  size_t size() const;
+
+  /**
+   * \brief Truth state of the contents being held in memory, rather than in the source
+   */
+  bool materialized() const;
+
+  /**
+   * \brief Heap bytes held: owned contents, or a source's shared state plus the contents once materialized
+   *
+   * A source's state is shared by copies, like the contents themselves.
+   */
+  size_t heap_bytes() const;
+
+  /**
+   * \brief Source bytes the contents are still read from, or 0 once materialized
+   *
+   * Unlike size(), never decodes.
+   */
+  size_t source_bytes() const;
+
+  operator const std::string&() const {return get();}
+
+private:
+  struct state {
+    source backing; /**< For encoded sources, only bytes is kept once materialized */
+    bool encoded = false; /**< Truth state of backing having a decode; fixed at construction, unlike backing */
+    std::once_flag checked;
+    std::once_flag copied;
+    std::atomic<bool> materialized = false;
+    std::string value;
+  };
+  std::variant<std::string, std::shared_ptr<state>> contents; /**< Owned contents, or a source's state */
+
+  /**
+   * \brief Source bytes, once checked
+   */
+  static std::string_view checked_bytes(state& st);
+};
+
 /**
  * \brief Vertex interpretation for use with Tree
  */
@@ -47,18 +134,21 @@ struct block {
     std::string nonce;
     std::string s_trip;
     std::string c_trip;
-    std::string cont;
+    lazy_string cont;
     std::string hash;
     std::unordered_set<std::string> p_hashes;
 
     /* utility */
     std::string hash_concat() const;
-    bool verify(int pow = 0) const;
+    bool verify(int pow = 0, bool rehash = true) const; /**< Without rehash, only the stored hash is checked against pow */
     json jdump() const;
     std::string dump() const;
+    std::string pack() const; /**< Compact binary form, fixed fields first and cont last */
+    static block unpack(std::string_view packed); /**< Inverse of block::pack, throws std::runtime_error on malformed input */
+    static block unpack(std::string_view packed, std::shared_ptr<const void> owner, std::function<bool()> check = nullptr); /**< As above, but cont is left in packed (kept alive by owner) as a lazy_string */
     
     /* vertex */
-    std::string trip();
+    std::string trip() const;
     std::unordered_set<std::string> p_trips();
 
     /** construct */
@@ -87,10 +177,35 @@ namespace std {
   };
 }
 
-bool operator == (const block x, const block y) {return x.hash == y.hash;}
+inline bool operator == (const block x, const block y) {return x.hash == y.hash;}
 
 std::vector<std::string> order_hashes(std::unordered_set<std::string> input_hashes);
 
+/**
+ * \brief Position in a server's history: a block's time, with its hash breaking ties
+ *
+ * hash views the block's key in the graph, so it stays valid while the block is linked (until a set_pow_req rebuild or a checkpoint restore).
+ * A rebuild or restore invalidates every cursor handed out before it: don't dereference hash or page from an old cursor afterwards; start again from get_latest or get_time_range.
+ */
+struct time_cursor {
+  unsigned long long time;
+  std::string_view hash;
+
+  auto operator<=>(const time_cursor&) const = default;
+};
+
+/**
+ * \brief Validation and callback metrics for Tree
+ */
+struct tree_metrics {
+  Counter& invalid; /**< Rejected by get_valid: bad hash or under the PoW requirement */
+  Counter& extra_root; /**< Rejected by get_valid: a second graph root */
+  Counter& server_orphan; /**< Rejected by get_valid: no intraserver parent in an already rooted server */
+  Histogram& callback; /**< server_add_funcs latency, in ns */
+
+  tree_metrics(const metric_labels& instance, MetricsRegistry& registry = MetricsRegistry::shared());
+};
+
 /**
  * \brief Default graph interpretation model
  */
@@ -103,6 +218,13 @@ protected:
    */
   int pow = 0;
 
+  /**
+   * \brief Truth state of get_valid recomputing block hashes
+   *
+   * Dropped while a FileTree pushes blocks out of its own mapped store, which were verified before they were saved.
+   */
+  bool rehash_blocks = true;
+
   // FIXME Not sure where we use this -- not referenced anywhere in Tree::
   //std::unordered_set<std::string> saved_hashes;
 
@@ -113,6 +235,65 @@ protected:
    */
   std::map<std::string, linked<block>*> server_roots;
 
+  tree_metrics tree_stats; /**< Rejections and callback latency */
+
+  /**
+   * \brief Blocks of each 'server', ordered by time
+   *
+   * Maintained in push_response, so only linked blocks are indexed.
+   */
+  std::map<std::string, std::set<time_cursor>> time_index;
+
+  /**
+   * \brief Blocks of each graph user (c_trip), by 'server' and then time
+   *
+   * Only kept while user_indexed; blocks without a c_trip aren't indexed.
+   */
+  std::unordered_map<std::string, std::map<std::string, std::set<time_cursor>>> user_index;
+
+  /**
+   * \brief Truth state of user_index being kept, see set_user_index
+   */
+  bool user_indexed = false;
+
+  /**
+   * \brief Memlock of time_index and user_index; queries share it, pushes take it
+   */
+  std::shared_mutex time_index_mtx;
+
+  /**
+   * \brief Add a linked block to time_index
+   * \param node Block's node in the graph; the index views its trip
+   * \returns Index bytes added, for memory accounting
+   *
+   * Callers hold time_index_mtx.
+   */
+  int64_t index_time(const linked<block>& node);
+
+  /**
+   * \brief Add a linked block to user_index
+   * \param node Block's node in the graph; the index views its trip
+   * \param index_deltas Index bytes added, for memory accounting; per-user overhead is ungrouped
+   *
+   * Callers hold time_index_mtx and have checked user_indexed.
+   */
+  void index_user(const linked<block>& node, std::map<std::string, memory_usage>& index_deltas);
+
+  /**
+   * \brief Rebuild time_index, and user_index if kept, from the graph
+   *
+   * Accounts the rebuilt indexes as memory; callers have zeroed index memory first.
+   */
+  void reindex();
+
+  /**
+   * \brief Order walk_topological visits blocks in, parents first
+   * \returns Hashes, to look up again before visiting
+   *
+   * Callers hold push_proc_mtx.
+   */
+  std::vector<std::string> walk_order(const std::string& s_trip, const std::unordered_set<std::string>& since);
+
   /**
    * \brief Interprets an established graph
    * \param root Block to interpret as root.
@@ -137,6 +318,47 @@ protected:
       std::unordered_set<std::string> new_trips, 
       std::unordered_set<std::string> flags = std::unordered_set<std::string>()
       ) override;
+
+  /**
+   * \brief Write the linked graph to a checkpoint file
+   * \param path Checkpoint path, replaced atomically
+   * \param store_mark Opaque description of the storage the graph was built from
+   *
+   * Holds nodes, edges, the root, server roots and the PoW requirement. Callers hold push_proc_mtx.
+   */
+  void save_checkpoint(std::string path, std::string store_mark);
+
+  /**
+   * \brief Rebuild the linked graph from a checkpoint, without validation
+   * \param path Checkpoint path
+   * \param blocks Stored blocks; checkpointed ones are moved into the graph and erased, leaving those that still need validating
+   * \param mark_ok Checks the checkpoint's store mark against the storage blocks came from
+   * \returns Truth state; on false (missing, corrupt or stale checkpoint) nothing is changed
+   *
+   * Callers hold push_proc_mtx.
+   */
+  bool restore_checkpoint(
+      std::string path,
+      std::unordered_set<block>& blocks,
+      std::function<bool(std::string_view)> mark_ok
+      );
+
+  /**
+   * \brief Strings, parent hashes and contents of a block; contents still in a mapped store count as mapped
+   *
+   * Contents are classed when pushed, so ones materialized later stay counted as mapped until recount_memory.
+   */
+  memory_usage vertex_memory(const block& target) override;
+
+  /**
+   * \brief Blocks are accounted by s_trip
+   */
+  std::string memory_group(const block& target) override;
+
+  /**
+   * \brief Bytes of a server_roots entry
+   */
+  static int64_t server_root_memory(const std::string& s_trip);
 public:
   /**
    * \brief Maps callbacks to server trips
@@ -261,6 +483,122 @@ public:
    */
   std::unordered_set<std::string> get_parent_hash_union(std::unordered_set<std::string> c_hashes);
 
+  /**
+   * \brief A 'server''s blocks within a time range
+   * \param s_trip 'server' trip
+   * \param from Earliest time, inclusive
+   * \param to Latest time, inclusive
+   * \param limit Optional. Most blocks to return
+   * \returns Blocks, oldest first
+   *
+   * Logarithmic in the server's history, plus the output.
+   */
+  std::vector<time_cursor> get_time_range(
+      std::string s_trip,
+      unsigned long long from,
+      unsigned long long to,
+      size_t limit = SIZE_MAX
+      );
+
+  /**
+   * \brief A 'server''s newest blocks
+   * \param s_trip 'server' trip
+   * \param count Most blocks to return
+   * \returns Blocks, newest first
+   */
+  std::vector<time_cursor> get_latest(std::string s_trip, size_t count);
+
+  /**
+   * \brief A page of a 'server''s blocks older than a cursor
+   * \param s_trip 'server' trip
+   * \param cursor Exclusive bound, e.g. the last block of the previous page
+   * \param count Most blocks to return
+   * \returns Blocks, newest first
+   */
+  std::vector<time_cursor> get_before(std::string s_trip, time_cursor cursor, size_t count);
+
+  /**
+   * \brief A page of a 'server''s blocks newer than a cursor
+   * \param s_trip 'server' trip
+   * \param cursor Exclusive bound, e.g. the last block of the previous page
+   * \param count Most blocks to return
+   * \returns Blocks, oldest first
+   */
+  std::vector<time_cursor> get_after(std::string s_trip, time_cursor cursor, size_t count);
+
+  /**
+   * \brief Summarize linked blocks for reconciliation with another Tree
+   * \param cells Table size; at least 1.5x the expected difference
+   * \param s_trip Optional. Only a given 'server''s blocks
+   * \returns IBLT of their hashes; see IBLT::pack for sending it
+   *
+   * Reads time_index a chunk at a time, so pushes are held up for one chunk rather than the whole walk; blocks linked meanwhile may be left out.
+   */
+  IBLT summarize(size_t cells, std::string s_trip = std::string());
+
+  /**
+   * \brief Diff linked blocks against another Tree's summary
+   * \param theirs Their summarize(), with the same s_trip
+   * \param s_trip Optional. Only a given 'server''s blocks
+   * \returns only_ours: blocks they lack (see export_blocks), only_theirs: hashes to request
+   *
+   * Our summary is taken at their size. While the result is incomplete, both sides retry with twice the cells, so what gets sent tracks the difference.
+   */
+  iblt_diff reconcile(const IBLT& theirs, std::string s_trip = std::string());
+
+  /**
+   * \brief Linked blocks, parents first
+   * \param hashes Blocks to export; ones not linked are skipped
+   * \returns Blocks, each after any of its parents among them, ready for queue_batch on another Tree
+   *
+   * Takes push_proc_mtx, so not for server_add_funcs.
+   */
+  std::vector<block> export_blocks(std::unordered_set<std::string> hashes);
+
+  /**
+   * \brief Visit linked blocks, parents first
+   * \param visit Called once per block
+   * \param s_trip Optional. Only a given 'server''s blocks
+   * \param since Optional. Leave out these blocks and their ancestors, e.g. a peer's tips
+   *
+   * Holds push_proc_mtx only to order the blocks and to copy them out a chunk at a time, so pushes carry on while visit runs; not for server_add_funcs.
+   * Visits the blocks linked when it began; any dropped since by a set_pow_req rebuild or checkpoint restore are skipped.
+   */
+  void walk_topological(
+      std::function<void(const block&)> visit,
+      std::string s_trip = std::string(),
+      std::unordered_set<std::string> since = std::unordered_set<std::string>()
+      );
+
+  /**
+   * \brief Keep or drop the graph user index
+   * \param enabled Truth state
+   *
+   * Off by default, and then costs nothing. Enabling indexes every linked block; disabling frees the index.
+   */
+  void set_user_index(bool enabled);
+
+  /**
+   * \brief A page of a graph user's blocks, across 'servers'
+   * \param c_trip Graph user trip
+   * \param count Most blocks to return
+   * \param before Optional. Exclusive bound, e.g. the last block of the previous page
+   * \param from Optional. Earliest time, inclusive
+   * \param to Optional. Latest time, inclusive
+   * \param s_trip Optional. Only blocks in a given 'server'
+   * \returns Blocks, newest first
+   *
+   * Throws std::runtime_error if the user index is off. Logarithmic in the user's history per 'server' they posted in, plus the output.
+   */
+  std::vector<time_cursor> get_user_blocks(
+      std::string c_trip,
+      size_t count,
+      std::optional<time_cursor> before = std::nullopt,
+      unsigned long long from = 0,
+      unsigned long long to = ULLONG_MAX,
+      std::string s_trip = std::string()
+      );
+
   /**
    * \brief Generate a root block.
    *
@@ -268,7 +606,10 @@ public:
    */
   void create_root();
 
-  Tree();         
+  /**
+   * \param name Optional. Labels the tree's metrics, see graph_model::get_metric_instance
+   */
+  Tree(std::string name = std::string());
 };
 
 /**
@@ -4,11 +4,34 @@
 #include <cryptopp/aes.h>
 #include <cryptopp/gcm.h>
 #include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
 
 #include "../../inc/crypt.hpp"
 
 using namespace CryptoPP;
 
+// segmented stream layout: header = chunk_len (4, BE) | nonce prefix (7), then chunks of ciphertext | tag
+static const size_t STREAM_PREFIXLEN = 7;
+static const size_t STREAM_HEADERLEN = 4 + STREAM_PREFIXLEN;
+static const size_t STREAM_IVLEN = 12;
+static const size_t STREAM_TAGLEN = 16;
+
+// chunk nonce = prefix | counter (4, BE) | final flag
+static void stream_iv(byte* iv, const std::string& header, uint32_t counter, bool final) {
+    std::memcpy(iv, header.data() + 4, STREAM_PREFIXLEN);
+    for (int i = 0; i < 4; i++) iv[STREAM_PREFIXLEN + i] = (byte) (counter >> (24 - 8 * i));
+    iv[STREAM_IVLEN - 1] = final ? 1 : 0;
+}
+
+// every chunk authenticates the header; the final one also authenticates the total length
+static std::string stream_aad(const std::string& header, bool final, uint64_t total) {
+    std::string aad = header;
+    if (final) for (int i = 0; i < 8; i++) aad += (char) (total >> (56 - 8 * i));
+    return aad;
+}
+
 // skey = AES::DEFAULT_KEYLENGTH
 std::array<std::string, 2> cAES::encrypt(std::string skey, std::string msg) {
     AutoSeededRandomPool prng;
@@ -86,6 +109,48 @@ std::string cAES::decrypt(std::string skey, std::string snonce, std::string ciph
     return std::string();
 }
 
+cAES::Session::Session(std::string skey) {
+    (this->e).SetKey(reinterpret_cast<const byte*>(&skey[0]), skey.size());
+    (this->d).SetKey(reinterpret_cast<const byte*>(&skey[0]), skey.size());
+}
+
+std::array<std::string, 2> cAES::Session::encrypt(std::string msg) {
+    // tag size, must match cAES::encrypt
+    const int TAG_SIZE = 12;
+
+    SecByteBlock nonce(AES_NONCELEN);
+    (this->prng).GenerateBlock(nonce, nonce.size());
+
+    // same layout the AuthenticatedEncryptionFilter emits: cipher | tag
+    std::string cipher(msg.size() + TAG_SIZE, '\0');
+    (this->e).EncryptAndAuthenticate(
+        reinterpret_cast<byte*>(&cipher[0]), reinterpret_cast<byte*>(&cipher[msg.size()]), TAG_SIZE, 
+        nonce, nonce.size(), 
+        nullptr, 0, 
+        reinterpret_cast<const byte*>(msg.data()), msg.size()
+    );
+
+    std::string snonce(reinterpret_cast<const char*>(&nonce[0]), nonce.size());
+    return {cipher, snonce};
+}
+
+std::string cAES::Session::decrypt(std::string snonce, std::string cipher) {
+    // tag size, must match cAES::decrypt
+    const int TAG_SIZE = 12;
+    if (cipher.size() < TAG_SIZE) return std::string();
+
+    size_t len = cipher.size() - TAG_SIZE;
+    std::string recovered(len, '\0');
+    bool legit = (this->d).DecryptAndVerify(
+        reinterpret_cast<byte*>(&recovered[0]), reinterpret_cast<const byte*>(&cipher[len]), TAG_SIZE, 
+        reinterpret_cast<const byte*>(snonce.data()), snonce.size(), 
+        nullptr, 0, 
+        reinterpret_cast<const byte*>(cipher.data()), len
+    );
+    if (!legit) return std::string();
+    return recovered;
+}
+
 std::string cAES::keygen() {
     AutoSeededRandomPool prng;
     SecByteBlock key(AES_KEYLEN);
@@ -93,3 +158,92 @@ std::string cAES::keygen() {
     std::string skey(reinterpret_cast<const char*>(&key[0]), key.size());
     return skey;
 }
+
+void cAES::encrypt(std::string skey, cIO::Reader& msg, cIO::Writer& cipher, size_t chunk_len) {
+    if (chunk_len == 0 || chunk_len > UINT32_MAX) throw "AES stream chunk length out of range";
+    AutoSeededRandomPool prng;
+
+    // header
+    std::string header(STREAM_HEADERLEN, '\0');
+    for (int i = 0; i < 4; i++) header[i] = (char) (chunk_len >> (24 - 8 * i));
+    prng.GenerateBlock(reinterpret_cast<byte*>(&header[4]), STREAM_PREFIXLEN);
+    cipher.write(header.data(), header.size());
+
+    // keyed once, every chunk only resyncs the IV
+    GCM<AES>::Encryption e;
+    e.SetKey(reinterpret_cast<const byte*>(&skey[0]), skey.size());
+
+    // one spare byte tells us whether there's anything after this chunk
+    SecByteBlock plain(chunk_len + 1);
+    std::vector<byte> sealed(chunk_len + STREAM_TAGLEN);
+    byte iv[STREAM_IVLEN];
+    size_t carried = 0;
+    uint64_t total = 0;
+    uint32_t counter = 0;
+
+    while (true) {
+        size_t got = carried + cIO::read_full(msg, reinterpret_cast<char*>(&plain[carried]), plain.size() - carried);
+        bool final = got <= chunk_len;
+        size_t len = final ? got : chunk_len;
+        total += len;
+
+        stream_iv(iv, header, counter, final);
+        std::string aad = stream_aad(header, final, total);
+        e.EncryptAndAuthenticate(
+            sealed.data(), sealed.data() + len, STREAM_TAGLEN, 
+            iv, STREAM_IVLEN, 
+            reinterpret_cast<const byte*>(aad.data()), aad.size(), 
+            plain, len
+        );
+        cipher.write(reinterpret_cast<const char*>(sealed.data()), len + STREAM_TAGLEN);
+
+        if (final) return;
+        if (++counter == 0) throw "AES stream exhausted its chunk counter";
+        plain[0] = plain[chunk_len];
+        carried = 1;
+    }
+}
+
+bool cAES::decrypt(std::string skey, cIO::Reader& cipher, cIO::Writer& msg) {
+    std::string header(STREAM_HEADERLEN, '\0');
+    if (cIO::read_full(cipher, &header[0], header.size()) != header.size()) return false;
+    size_t chunk_len = 0;
+    for (int i = 0; i < 4; i++) chunk_len = (chunk_len << 8) | (unsigned char) header[i];
+    if (chunk_len == 0) return false;
+
+    GCM<AES>::Decryption d;
+    d.SetKey(reinterpret_cast<const byte*>(&skey[0]), skey.size());
+
+    size_t frame_len = chunk_len + STREAM_TAGLEN;
+    std::vector<byte> sealed(frame_len + 1);
+    SecByteBlock plain(chunk_len);
+    byte iv[STREAM_IVLEN];
+    size_t carried = 0;
+    uint64_t total = 0;
+    uint32_t counter = 0;
+
+    while (true) {
+        size_t got = carried + cIO::read_full(cipher, reinterpret_cast<char*>(&sealed[carried]), sealed.size() - carried);
+        bool final = got <= frame_len;
+        size_t len = final ? got : frame_len;
+        if (len < STREAM_TAGLEN) return false;
+        size_t plain_len = len - STREAM_TAGLEN;
+        total += plain_len;
+
+        stream_iv(iv, header, counter, final);
+        std::string aad = stream_aad(header, final, total);
+        bool legit = d.DecryptAndVerify(
+            plain, sealed.data() + plain_len, STREAM_TAGLEN, 
+            iv, STREAM_IVLEN, 
+            reinterpret_cast<const byte*>(aad.data()), aad.size(), 
+            sealed.data(), plain_len
+        );
+        if (!legit) return false;
+        msg.write(reinterpret_cast<const char*>(&plain[0]), plain_len);
+
+        if (final) return true;
+        if (++counter == 0) return false;
+        sealed[0] = sealed[frame_len];
+        carried = 1;
+    }
+}
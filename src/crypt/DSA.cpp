@@ -1,11 +1,40 @@
 #include "../../inc/crypt.hpp"
 #include <cryptopp/dsa.h>
 #include <cryptopp/osrng.h>
+#include <cryptopp/xed25519.h>
+#include <map>
 
 using namespace CryptoPP;
 
-std::array<std::string, 2> cDSA::keygen() {
+size_t cDSA::siglen(Alg alg) {
+    switch (alg) {
+        case Alg::DSA: return DSA_SIGLEN;
+        case Alg::ED25519: return ED25519_SIGLEN;
+    }
+    throw "Unknown signature algorithm";
+}
+
+std::array<std::string, 2> cDSA::keygen(Alg alg) {
     AutoSeededRandomPool rng;
+    std::string encodedPublicKey, encodedPrivateKey;
+
+    if (alg == Alg::ED25519) {
+        ed25519::Signer signer;
+        signer.AccessPrivateKey().GenerateRandom(rng);
+        ed25519::Verifier verifier(signer);
+
+        // Validating
+        if (!signer.GetPrivateKey().Validate(rng, 3) || !verifier.GetPublicKey().Validate(rng, 3)) {
+            throw "Ed25519 KeyGen produced invalid keys";
+        }
+
+        // Save keys to strings (PKCS8 / X.509, BER)
+        verifier.GetPublicKey().Save(StringSink(encodedPublicKey).Ref());
+        signer.GetPrivateKey().Save(StringSink(encodedPrivateKey).Ref());
+        return {encodedPrivateKey, encodedPublicKey};
+    }
+    siglen(alg); // rejects unknown schemes
+
     // Private
     DSA::PrivateKey privateKey;
     privateKey.GenerateRandomWithKeySize(rng, DSA_KEYLEN);
@@ -20,7 +49,6 @@ std::array<std::string, 2> cDSA::keygen() {
     }
 
     // No issues
-    std::string encodedPublicKey, encodedPrivateKey;
 
     // Save keys to strings (encoded as per BER)
     publicKey.Save(StringSink(encodedPublicKey).Ref());
@@ -33,21 +61,85 @@ std::array<std::string, 2> cDSA::keygen() {
     return {encodedPrivateKey, encodedPublicKey};
 }
 
-std::string cDSA::sign(std::string encodedPrivateKey, std::string msg) {
-    AutoSeededRandomPool rng;
-    // output
-    std::string signature;
+cDSA::PriKey::PriKey() {}
+
+cDSA::PriKey::PriKey(std::string encodedPrivateKey, Alg alg, bool precompute) : scheme(alg) {
+    StringStore encoded(encodedPrivateKey);
+
+    if (alg == Alg::ED25519) {
+        this->s = std::make_shared<ed25519::Signer>(encoded);
+        return;
+    }
+    siglen(alg); // rejects unknown schemes
 
     // loading key
     DSA::PrivateKey privateKey;
-    privateKey.Load(
-        StringStore(
-            encodedPrivateKey
-        ).Ref()
-    );
+    privateKey.Load(encoded);
 
     // Initializing signer object
-    DSA::Signer s(privateKey);
+    std::shared_ptr<DSA::Signer> signer = std::make_shared<DSA::Signer>(privateKey);
+    // fixed-base tables for g^k; read-only once built, so sharing stays safe
+    if (precompute) signer->AccessKey().Precompute();
+    this->s = signer;
+}
+
+bool cDSA::PriKey::empty() const {
+    return !(this->s);
+}
+
+cDSA::Alg cDSA::PriKey::alg() const {
+    return this->scheme;
+}
+
+const PK_Signer& cDSA::PriKey::signer() const {
+    if (empty()) throw "DSA PriKey used before a key was loaded";
+    return *(this->s);
+}
+
+cDSA::PubKey::PubKey() {}
+
+cDSA::PubKey::PubKey(std::string encodedPublicKey, Alg alg, bool precompute) : scheme(alg) {
+    StringStore encoded(encodedPublicKey);
+
+    if (alg == Alg::ED25519) {
+        this->v = std::make_shared<ed25519::Verifier>(encoded);
+        return;
+    }
+    siglen(alg); // rejects unknown schemes
+
+    // loading key
+    DSA::PublicKey publicKey;
+    publicKey.Load(encoded);
+
+    // Initializing verifier object
+    std::shared_ptr<DSA::Verifier> verifier = std::make_shared<DSA::Verifier>(publicKey);
+    // fixed-base tables for g and y
+    if (precompute) verifier->AccessKey().Precompute();
+    this->v = verifier;
+}
+
+bool cDSA::PubKey::empty() const {
+    return !(this->v);
+}
+
+cDSA::Alg cDSA::PubKey::alg() const {
+    return this->scheme;
+}
+
+const PK_Verifier& cDSA::PubKey::verifier() const {
+    if (empty()) throw "DSA PubKey used before a key was loaded";
+    return *(this->v);
+}
+
+std::string cDSA::sign(std::string encodedPrivateKey, std::string msg, Alg alg) {
+    // one-shot; building the tables would cost more than they save
+    return cDSA::sign(PriKey(encodedPrivateKey, alg, false), msg);
+}
+
+std::string cDSA::sign(const PriKey& privateKey, std::string msg) {
+    AutoSeededRandomPool rng;
+    // output
+    std::string signature;
 
     StringSource (
         // input
@@ -57,32 +149,30 @@ std::string cDSA::sign(std::string encodedPrivateKey, std::string msg) {
         // BufferedTransformation
         new SignerFilter(
             rng,
-            s,
+            privateKey.signer(),
             new StringSink (signature)
         )
     );
     return signature;
 }
 
-bool cDSA::verify(std::string encodedPublicKey, std::string sig, std::string msg) {
+bool cDSA::verify(std::string encodedPublicKey, std::string sig, std::string msg, Alg alg) {
+    return cDSA::verify(PubKey(encodedPublicKey, alg, false), sig, msg);
+}
+
+bool cDSA::verify(const PubKey& publicKey, std::string sig, std::string msg) {
     // return value
     bool legit; // phrased as a question, not an assertion
 
-    // loading key
-    DSA::PublicKey publicKey;
-    publicKey.Load(
-        StringStore(
-            encodedPublicKey
-        ).Ref()
-    );
-    // Initializing verifier object
-    DSA::Verifier v(publicKey);
+    // both schemes have fixed-length signatures; anything else can't be ours
+    if (sig.size() != siglen(publicKey.alg())) return false;
+
     // Checking
     StringSource(
         msg + sig,
         true,
         new SignatureVerificationFilter {
-            v,
+            publicKey.verifier(),
             new ArraySink (
                 (byte*)&legit, sizeof(legit) /* should be 1 byte, but better safe than sorry */
             ),
@@ -94,3 +184,60 @@ bool cDSA::verify(std::string encodedPublicKey, std::string sig, std::string msg
 
     return legit;
 }
+
+std::vector<bool> cDSA::verify_batch(
+    const PubKey& publicKey, 
+    std::span<const std::string> sigs, 
+    std::span<const std::string> msgs, 
+    ThreadPool& pool
+  ) {
+    if (sigs.size() != msgs.size()) throw "DSA batch verify given mismatched sigs/msgs";
+
+    // vector<bool> packs bits, so workers write bytes instead
+    std::vector<char> legit(sigs.size());
+    pool.parallel_for(sigs.size(), [&](size_t i) {
+        legit[i] = cDSA::verify(publicKey, sigs[i], msgs[i]);
+    });
+    return std::vector<bool>(legit.begin(), legit.end());
+}
+
+std::vector<bool> cDSA::verify_batch(
+    std::span<const std::string> encodedPublicKeys, 
+    std::span<const std::string> sigs, 
+    std::span<const std::string> msgs, 
+    Alg alg, 
+    ThreadPool& pool
+  ) {
+    if (encodedPublicKeys.size() != sigs.size() || sigs.size() != msgs.size()) {
+        throw "DSA batch verify given mismatched keys/sigs/msgs";
+    }
+
+    // decode each distinct key once, in parallel; a key that doesn't decode fails only its own items
+    std::map<std::string, std::optional<PubKey>> keys;
+    for (const auto& encoded : encodedPublicKeys) keys.try_emplace(encoded);
+    std::vector<std::map<std::string, std::optional<PubKey>>::iterator> to_load;
+    for (auto it = keys.begin(); it != keys.end(); it++) to_load.push_back(it);
+    pool.parallel_for(to_load.size(), [&](size_t i) {
+        try {
+            to_load[i]->second = PubKey(to_load[i]->first, alg);
+        } catch (...) {
+            to_load[i]->second.reset();
+        }
+    });
+
+    std::vector<char> legit(sigs.size());
+    pool.parallel_for(sigs.size(), [&](size_t i) {
+        const std::optional<PubKey>& key = keys.at(encodedPublicKeys[i]);
+        legit[i] = key && cDSA::verify(*key, sigs[i], msgs[i]);
+    });
+    return std::vector<bool>(legit.begin(), legit.end());
+}
+
+std::vector<bool> cDSA::verify_batch(
+    std::span<const std::string> encodedPublicKeys, 
+    std::span<const std::string> sigs, 
+    std::span<const std::string> msgs, 
+    ThreadPool& pool
+  ) {
+    return cDSA::verify_batch(encodedPublicKeys, sigs, msgs, Alg::DSA, pool);
+}
@@ -3,6 +3,7 @@
 #include <cryptopp/gcm.h>
 #include <array>
 #include <cryptopp/rsa.h>
+#include <cryptopp/sha.h>
 
 #include "../../inc/crypt.hpp"
 using namespace std;
@@ -35,11 +36,18 @@ std::array<std::string, 2> cRSA::keygen() {
     return {encodedPrivateKey, encodedPublicKey};
 }
 
-std::string cRSA::encrypt(std::string encodedPublicKey, std::string msg) {
-    AutoSeededRandomPool rng;
-    // return value
-    std::string cipher;
+// key ids hash the public key as we'd save it, so any encoding of a key (or its private half) gets the same id
+static std::string fingerprint(const RSA::PublicKey& publicKey) {
+    std::string encodedPublicKey;
+    publicKey.Save(StringSink(encodedPublicKey).Ref());
+    byte digest[SHA256::DIGESTSIZE];
+    SHA256().CalculateDigest(digest, reinterpret_cast<const byte*>(encodedPublicKey.data()), encodedPublicKey.size());
+    return std::string(reinterpret_cast<const char*>(digest), RSA_KEYIDLEN);
+}
+
+cRSA::PubKey::PubKey() {}
 
+cRSA::PubKey::PubKey(std::string encodedPublicKey) {
     // loading key
     RSA::PublicKey publicKey;
     publicKey.Load(
@@ -49,7 +57,64 @@ std::string cRSA::encrypt(std::string encodedPublicKey, std::string msg) {
     );
 
     // encryptor object initialization
-    RSAES_OAEP_SHA_Encryptor e(publicKey);
+    this->e = std::make_shared<RSAES_OAEP_SHA_Encryptor>(publicKey);
+    this->key_id = fingerprint(publicKey);
+}
+
+bool cRSA::PubKey::empty() const {
+    return !(this->e);
+}
+
+const std::string& cRSA::PubKey::id() const {
+    return this->key_id;
+}
+
+const RSAES_OAEP_SHA_Encryptor& cRSA::PubKey::encryptor() const {
+    if (empty()) throw "RSA PubKey used before a key was loaded";
+    return *(this->e);
+}
+
+cRSA::PriKey::PriKey() {}
+
+cRSA::PriKey::PriKey(std::string encodedPrivateKey) {
+    // loading key
+    RSA::PrivateKey privateKey;
+    privateKey.Load(
+        StringStore(
+            encodedPrivateKey
+        ).Ref()
+    );
+
+    // Intialize Decryptor object
+    this->d = std::make_shared<RSAES_OAEP_SHA_Decryptor>(privateKey);
+
+    // id comes from the public half, so it matches what senders see
+    RSA::PublicKey publicKey;
+    publicKey.AssignFrom(privateKey);
+    this->key_id = fingerprint(publicKey);
+}
+
+bool cRSA::PriKey::empty() const {
+    return !(this->d);
+}
+
+const std::string& cRSA::PriKey::id() const {
+    return this->key_id;
+}
+
+const RSAES_OAEP_SHA_Decryptor& cRSA::PriKey::decryptor() const {
+    if (empty()) throw "RSA PriKey used before a key was loaded";
+    return *(this->d);
+}
+
+std::string cRSA::encrypt(std::string encodedPublicKey, std::string msg) {
+    return cRSA::encrypt(PubKey(encodedPublicKey), msg);
+}
+
+std::string cRSA::encrypt(const PubKey& publicKey, std::string msg) {
+    AutoSeededRandomPool rng;
+    // return value
+    std::string cipher;
 
     StringSource (
         // msg input
@@ -57,7 +122,7 @@ std::string cRSA::encrypt(std::string encodedPublicKey, std::string msg) {
         // pump all (pass input to BufferedTransform)
         true,
         // BufferedTransform
-        new PK_EncryptorFilter(rng, e,
+        new PK_EncryptorFilter(rng, publicKey.encryptor(),
             new StringSink(cipher)
         )
     );
@@ -65,28 +130,21 @@ std::string cRSA::encrypt(std::string encodedPublicKey, std::string msg) {
 }
 
 std::string cRSA::decrypt(std::string encodedPrivateKey, std::string cipher) {
+    return cRSA::decrypt(PriKey(encodedPrivateKey), cipher);
+}
+
+std::string cRSA::decrypt(const PriKey& privateKey, std::string cipher) {
     AutoSeededRandomPool rng;
     // return value
     std::string recovered;
 
-    // loading key
-    RSA::PrivateKey privateKey;
-    privateKey.Load(
-        StringStore(
-            encodedPrivateKey
-        ).Ref()
-    );
-
-    // Intialize Decryptor object
-    RSAES_OAEP_SHA_Decryptor d(privateKey);
-
     StringSource (
         // msg input
         cipher,
         // pump all (pass input to BufferedTransform)
         true,
         // BufferedTransform
-        new PK_DecryptorFilter(rng, d,
+        new PK_DecryptorFilter(rng, privateKey.decryptor(),
             new StringSink(recovered)
         )
     );
@@ -0,0 +1,42 @@
+#include "../../inc/crypt.hpp"
+#include <algorithm>
+#include <cstring>
+
+cIO::StringReader::StringReader(std::string_view src) : src(src) {}
+
+size_t cIO::StringReader::read(char* buf, size_t len) {
+    size_t n = std::min(len, (this->src).size());
+    std::memcpy(buf, (this->src).data(), n);
+    (this->src).remove_prefix(n);
+    return n;
+}
+
+cIO::StringWriter::StringWriter(std::string& dst) : dst(dst) {}
+
+void cIO::StringWriter::write(const char* buf, size_t len) {
+    (this->dst).append(buf, len);
+}
+
+cIO::IStreamReader::IStreamReader(std::istream& src) : src(src) {}
+
+size_t cIO::IStreamReader::read(char* buf, size_t len) {
+    (this->src).read(buf, len);
+    return (this->src).gcount();
+}
+
+cIO::OStreamWriter::OStreamWriter(std::ostream& dst) : dst(dst) {}
+
+void cIO::OStreamWriter::write(const char* buf, size_t len) {
+    (this->dst).write(buf, len);
+    if (!(this->dst)) throw "cIO stream write failed";
+}
+
+size_t cIO::read_full(Reader& src, char* buf, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        size_t n = src.read(buf + got, len - got);
+        if (n == 0) break;
+        got += n;
+    }
+    return got;
+}
@@ -0,0 +1,117 @@
+#include "../../inc/crypt.hpp"
+
+#include <algorithm>
+
+KeyPool::KeyPool(
+    std::function<std::array<std::string, 2>()> keygen, 
+    size_t low_watermark, 
+    size_t high_watermark, 
+    size_t threads
+  ) : keygen(keygen), low_watermark(low_watermark), high_watermark(high_watermark) {
+    if (high_watermark < low_watermark) throw "KeyPool high watermark below low watermark";
+    this->started = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads; i++) (this->workers).emplace_back(&KeyPool::work, this);
+}
+
+KeyPool::~KeyPool() {
+    {
+        std::lock_guard lk(this->pool_mtx);
+        this->stopping = true;
+    }
+    (this->pool_cv).notify_all();
+    for (auto& worker : this->workers) worker.join();
+}
+
+void KeyPool::work() {
+    std::unique_lock lk(this->pool_mtx);
+    while (true) {
+        (this->pool_cv).wait(lk, [this] {
+            return this->stopping || (this->refilling && (this->ready).size() + this->in_flight < this->high_watermark);
+        });
+        if (this->stopping) return;
+
+        this->in_flight++;
+        lk.unlock();
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::array<std::string, 2> pair;
+        std::exception_ptr error;
+        try {
+            pair = (this->keygen)();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::chrono::duration<double> took = std::chrono::steady_clock::now() - start;
+
+        lk.lock();
+        this->in_flight--;
+        if (error) {
+            // a failed validation is worth retrying, but a keygen that always fails (e.g. a broken RNG) mustn't spin
+            this->failures++;
+            this->failing++;
+            this->last_error = error;
+            std::chrono::milliseconds backoff(std::min<size_t>(KEYPOOL_BACKOFF_MAX_MS, (size_t) KEYPOOL_BACKOFF_MS << std::min<size_t>(this->failing - 1, 16)));
+            (this->pool_cv).wait_for(lk, backoff, [this] { return this->stopping; });
+            continue;
+        }
+        this->failing = 0;
+        this->last_error = nullptr;
+        (this->ready).push_back(pair);
+        this->generated++;
+        this->gen_seconds += took.count();
+        if ((this->ready).size() >= this->high_watermark) this->refilling = false;
+    }
+}
+
+std::array<std::string, 2> KeyPool::take() {
+    {
+        std::lock_guard lk(this->pool_mtx);
+        this->taken++;
+        if (!(this->ready).empty()) {
+            std::array<std::string, 2> pair = (this->ready).front();
+            (this->ready).pop_front();
+            if ((this->ready).size() <= this->low_watermark && !(this->refilling)) {
+                this->refilling = true;
+                (this->pool_cv).notify_all();
+            }
+            return pair;
+        }
+        this->misses++;
+        this->refilling = true;
+        if (this->failing >= KEYPOOL_FAILURE_LIMIT) std::rethrow_exception(this->last_error);
+    }
+    (this->pool_cv).notify_all();
+    // dry; don't make the caller wait behind the queue
+    return (this->keygen)();
+}
+
+void KeyPool::set_watermarks(size_t low_watermark, size_t high_watermark) {
+    if (high_watermark < low_watermark) throw "KeyPool high watermark below low watermark";
+    {
+        std::lock_guard lk(this->pool_mtx);
+        this->low_watermark = low_watermark;
+        this->high_watermark = high_watermark;
+        if ((this->ready).size() <= low_watermark) this->refilling = true;
+    }
+    (this->pool_cv).notify_all();
+}
+
+size_t KeyPool::depth() {
+    std::lock_guard lk(this->pool_mtx);
+    return (this->ready).size();
+}
+
+keypool_stats KeyPool::stats() {
+    std::lock_guard lk(this->pool_mtx);
+    std::chrono::duration<double> up = std::chrono::steady_clock::now() - this->started;
+
+    keypool_stats out;
+    out.depth = (this->ready).size();
+    out.generated = this->generated;
+    out.taken = this->taken;
+    out.misses = this->misses;
+    out.failures = this->failures;
+    out.gen_rate = up.count() > 0 ? this->generated / up.count() : 0;
+    out.mean_gen_ms = this->generated > 0 ? 1000 * this->gen_seconds / this->generated : 0;
+    return out;
+}
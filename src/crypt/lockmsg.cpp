@@ -1,24 +1,186 @@
 #include "../../inc/crypt.hpp"
+#include <cryptopp/osrng.h>
 #include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+using namespace CryptoPP;
 
 std::string undo_concat(std::string& target_str, size_t length) {
     std::string output = target_str.substr(target_str.length() - length);
-    target_str = target_str.substr(0, target_str.length() - length);
+    target_str.resize(target_str.length() - length); // shrinking in place, no copy of the remainder
     return output;
 }
 
+// decryption yields nothing when the tag doesn't check out, and a real plaintext always ends in a signature
+std::array<std::string, 2> split_signed(std::string plaintext, cDSA::Alg alg) {
+    size_t sig_len = cDSA::siglen(alg);
+    if (plaintext.size() < sig_len) throw "cMSG envelope failed authentication";
+    std::string sig = undo_concat(plaintext, sig_len);
+    return {plaintext, sig};
+}
+
+// passes the message through while feeding the signer, then yields the signature
+class SigningReader : public cIO::Reader {
+public:
+    SigningReader(cIO::Reader& src, const PK_Signer& signer) : src(src), signer(signer) {
+        this->acc.reset(signer.NewSignatureAccumulator(this->rng));
+    }
+
+    size_t read(char* buf, size_t len) override {
+        if (!(this->signed_all)) {
+            size_t n = (this->src).read(buf, len);
+            if (n > 0) {
+                (this->acc)->Update(reinterpret_cast<const byte*>(buf), n);
+                return n;
+            }
+            (this->sig).resize((this->signer).MaxSignatureLength());
+            (this->sig).resize((this->signer).SignAndRestart(
+                this->rng, *(this->acc), reinterpret_cast<byte*>(&(this->sig)[0]), false
+            ));
+            this->signed_all = true;
+        }
+        size_t n = std::min(len, (this->sig).size() - this->sig_pos);
+        std::memcpy(buf, (this->sig).data() + this->sig_pos, n);
+        this->sig_pos += n;
+        return n;
+    }
+private:
+    cIO::Reader& src;
+    const PK_Signer& signer;
+    AutoSeededRandomPool rng;
+    std::unique_ptr<PK_MessageAccumulator> acc;
+    bool signed_all = false;
+    std::string sig;
+    size_t sig_pos = 0;
+};
+
+// passes everything through except the last `hold` bytes
+class HoldbackWriter : public cIO::Writer {
+public:
+    HoldbackWriter(cIO::Writer& dst, size_t hold) : dst(dst), hold(hold) {}
+
+    void write(const char* buf, size_t len) override {
+        (this->tail).append(buf, len);
+        if ((this->tail).size() <= this->hold) return;
+        size_t n = (this->tail).size() - this->hold;
+        (this->dst).write((this->tail).data(), n);
+        (this->tail).erase(0, n);
+    }
+
+    std::string held() const {
+        return this->tail;
+    }
+private:
+    cIO::Writer& dst;
+    size_t hold;
+    std::string tail;
+};
+
+// what the tag in front of an envelope tells us
+struct envelope_header {
+    unsigned char version = 0;
+    bool asymm = false;
+    cDSA::Alg alg = cDSA::Alg::DSA;
+    size_t len = 0; /**< Bytes of tag before the body */
+};
+
+static envelope_header read_header(std::string_view envelope) {
+    envelope_header header;
+    header.version = cMSG::version(envelope);
+    if (header.version == 0) return header;
+
+    header.asymm = (envelope[5] & MSG_F_ASYMM) != 0;
+    header.len = MSG_HEADERLEN;
+    if (header.version == MSG_V_STREAM) return header;
+    if (header.version != MSG_V_TAGGED && header.version != MSG_V_STREAM_TAGGED && header.version != MSG_V_MULTI) {
+        throw "cMSG envelope has an unknown version";
+    }
+
+    if (envelope.size() < MSG_HEADERLEN + 1) throw "cMSG envelope truncated";
+    header.alg = (cDSA::Alg) envelope[MSG_HEADERLEN];
+    cDSA::siglen(header.alg); // rejects unknown schemes
+    header.len++;
+    return header;
+}
+
+// body after the tag: cipher | [wrapped key] | nonce, with the plaintext signed by alg
+static std::array<std::string, 2> open_body(
+    std::string body,
+    cDSA::Alg alg,
+    bool use_asymm,
+    std::string aes_key,
+    const cRSA::PriKey& rsa_pri_key
+  ) {
+    if (body.size() < AES_NONCELEN + (use_asymm ? RSA_KEYLEN / 8 : 0)) throw "cMSG envelope truncated";
+    std::string nonce = undo_concat(body, AES_NONCELEN);
+    if (use_asymm) aes_key = cRSA::decrypt(rsa_pri_key, undo_concat(body, RSA_KEYLEN / 8)); //get RSA keylen in chars (bytes)
+    std::string plaintext = cAES::decrypt(aes_key, nonce, body);
+    return split_signed(plaintext, alg);
+}
+
+// untagged envelopes are AES output, which starts with MSG_MAGIC about once in 2^32; when a tagged parse fails, the envelope gets one go as untagged, and if that fails too the tagged error stands
+template<class Untagged>
+static std::array<std::string, 2> retry_untagged(std::exception_ptr tagged_error, Untagged untagged) {
+    try {
+        return untagged();
+    } catch (...) {
+        std::rethrow_exception(tagged_error);
+    }
+}
+
+static std::string write_header(unsigned char version, bool use_asymm, cDSA::Alg alg) {
+    std::string header = MSG_MAGIC;
+    header += (char) version;
+    header += (char) (use_asymm ? MSG_F_ASYMM : 0);
+    header += (char) alg;
+    return header;
+}
+
+unsigned char cMSG::version(std::string_view envelope) {
+    if (envelope.size() < MSG_HEADERLEN || envelope.substr(0, 4) != MSG_MAGIC) return 0;
+    return envelope[4];
+}
+
+cDSA::Alg cMSG::sig_alg(std::string_view envelope) {
+    try {
+        return read_header(envelope).alg;
+    } catch (...) {
+        return cDSA::Alg::DSA; // an untagged envelope that only looks tagged, see retry_untagged
+    }
+}
+
 std::string cMSG::lock(
     std::string message, 
     bool use_asymm, 
     std::string dsa_pri_key, 
     std::string aes_key, 
     std::string rsa_pub_key
+  ) {
+    return cMSG::lock(
+        message, 
+        use_asymm, 
+        cDSA::PriKey(dsa_pri_key, cDSA::Alg::DSA, false), 
+        aes_key, 
+        use_asymm ? cRSA::PubKey(rsa_pub_key) : cRSA::PubKey()
+    );
+}
+
+std::string cMSG::lock(
+    std::string message, 
+    bool use_asymm, 
+    const cDSA::PriKey& dsa_pri_key, 
+    std::string aes_key, 
+    const cRSA::PubKey& rsa_pub_key
   ) {
     std::string sig = cDSA::sign(dsa_pri_key, message);
-    std::string unified_plaintext = message + sig;
+    message += sig; // message is ours, so append rather than copy both
     std::string ciphertext;
+    // DSA envelopes stay untagged so older readers keep working
+    if (dsa_pri_key.alg() != cDSA::Alg::DSA) ciphertext = write_header(MSG_V_TAGGED, use_asymm, dsa_pri_key.alg());
     if (use_asymm) aes_key = cAES::keygen();
-    std::array<std::string, 2> encresults = cAES::encrypt(aes_key, unified_plaintext);
+    std::array<std::string, 2> encresults = cAES::encrypt(aes_key, message);
     ciphertext += encresults[0];
     if (use_asymm) ciphertext += cRSA::encrypt(rsa_pub_key, aes_key);
     ciphertext += encresults[1];
@@ -31,9 +193,263 @@ std::array<std::string, 2> cMSG::unlock(
     std::string aes_key,
     std::string rsa_pri_key
   ) {
+    return cMSG::unlock(
+        ciphertext, 
+        use_asymm, 
+        aes_key, 
+        use_asymm ? cRSA::PriKey(rsa_pri_key) : cRSA::PriKey()
+    );
+}
+
+std::array<std::string, 2> cMSG::unlock(
+    std::string ciphertext,
+    bool use_asymm,
+    std::string aes_key,
+    const cRSA::PriKey& rsa_pri_key
+  ) {
+    if (cMSG::version(ciphertext) == 0) return open_body(ciphertext, cDSA::Alg::DSA, use_asymm, aes_key, rsa_pri_key);
+    try {
+        envelope_header header = read_header(ciphertext);
+        if (header.version == MSG_V_STREAM || header.version == MSG_V_STREAM_TAGGED) {
+            cIO::StringReader src(ciphertext);
+            std::string plaintext;
+            cIO::StringWriter dst(plaintext);
+            std::string sig = cMSG::unlock(src, dst, use_asymm, aes_key, rsa_pri_key);
+            return {plaintext, sig};
+        }
+        if (header.asymm != use_asymm) throw "cMSG envelope key mode mismatch";
+        if (header.version == MSG_V_MULTI) return cMSG::unlock(ciphertext, rsa_pri_key);
+        return open_body(ciphertext.substr(header.len), header.alg, use_asymm, aes_key, rsa_pri_key);
+    } catch (...) {
+        return retry_untagged(std::current_exception(), [&] {
+            return open_body(ciphertext, cDSA::Alg::DSA, use_asymm, aes_key, rsa_pri_key);
+        });
+    }
+}
+
+std::string cMSG::lock(
+    std::string message, 
+    const cDSA::PriKey& dsa_pri_key, 
+    cAES::Session& session
+  ) {
+    std::string sig = cDSA::sign(dsa_pri_key, message);
+    message += sig;
+    std::string ciphertext;
+    if (dsa_pri_key.alg() != cDSA::Alg::DSA) ciphertext = write_header(MSG_V_TAGGED, false, dsa_pri_key.alg());
+    std::array<std::string, 2> encresults = session.encrypt(message);
+    return ciphertext + encresults[0] + encresults[1];
+}
+
+std::array<std::string, 2> cMSG::unlock(
+    std::string ciphertext, 
+    cAES::Session& session
+  ) {
+    auto open = [&session](std::string body, cDSA::Alg alg) {
+        if (body.size() < AES_NONCELEN) throw "cMSG envelope truncated";
+        std::string nonce = undo_concat(body, AES_NONCELEN);
+        std::string plaintext = session.decrypt(nonce, body);
+        return split_signed(plaintext, alg);
+    };
+    if (cMSG::version(ciphertext) == 0) return open(ciphertext, cDSA::Alg::DSA);
+    try {
+        envelope_header header = read_header(ciphertext);
+        if (header.version != MSG_V_TAGGED) throw "cMSG envelope can't be unlocked with a session";
+        if (header.asymm) throw "cMSG envelope key mode mismatch";
+        return open(ciphertext.substr(header.len), header.alg);
+    } catch (...) {
+        return retry_untagged(std::current_exception(), [&] {return open(ciphertext, cDSA::Alg::DSA);});
+    }
+}
+
+std::string cMSG::lock(
+    std::string message, 
+    const cDSA::PriKey& dsa_pri_key, 
+    std::span<const cRSA::PubKey> recipients, 
+    ThreadPool& pool
+  ) {
+    if (recipients.size() > UINT32_MAX) throw "cMSG envelope has too many recipients";
+
+    // sign and encrypt once for everyone
+    std::string sig = cDSA::sign(dsa_pri_key, message);
+    message += sig;
+    std::string aes_key = cAES::keygen();
+    std::array<std::string, 2> encresults = cAES::encrypt(aes_key, message);
+
+    // slot = key id | wrapped key; sorting whole slots sorts by id
+    std::vector<std::string> slots(recipients.size());
+    pool.parallel_for(recipients.size(), [&](size_t i) {
+        slots[i] = recipients[i].id() + cRSA::encrypt(recipients[i], aes_key);
+    });
+    std::sort(slots.begin(), slots.end());
+
+    std::string ciphertext = write_header(MSG_V_MULTI, true, dsa_pri_key.alg());
+    for (int i = 0; i < 4; i++) ciphertext += (char) (slots.size() >> (24 - 8 * i));
+    ciphertext.reserve(ciphertext.size() + slots.size() * (RSA_KEYIDLEN + RSA_KEYLEN / 8) + encresults[0].size() + encresults[1].size());
+    for (const auto& slot : slots) ciphertext += slot;
+    ciphertext += encresults[0];
+    ciphertext += encresults[1];
+    return ciphertext;
+}
+
+// tag | slot count (4, BE) | sorted slots | cipher | nonce
+static std::array<std::string, 2> unlock_multi(
+    std::string ciphertext, 
+    const cRSA::PriKey& rsa_pri_key
+  ) {
+    envelope_header header = read_header(ciphertext);
+    const size_t slot_len = RSA_KEYIDLEN + RSA_KEYLEN / 8;
+    size_t pos = header.len;
+    if (ciphertext.size() < pos + 4) throw "cMSG envelope truncated";
+    size_t slot_count = 0;
+    for (int i = 0; i < 4; i++) slot_count = (slot_count << 8) | (unsigned char) ciphertext[pos + i];
+    pos += 4;
+    if (ciphertext.size() < pos + AES_NONCELEN || (ciphertext.size() - pos - AES_NONCELEN) / slot_len < slot_count) {
+        throw "cMSG envelope truncated";
+    }
+
+    // slots are sorted by id, so find ours with a binary search
+    std::string_view slots(ciphertext.data() + pos, slot_count * slot_len);
+    const std::string& id = rsa_pri_key.id();
+    size_t lo = 0, hi = slot_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (slots.substr(mid * slot_len, RSA_KEYIDLEN) < id) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // ids are truncated hashes, so walk the (almost always single) run of matches
+    std::string aes_key;
+    for (size_t i = lo; i < slot_count && slots.substr(i * slot_len, RSA_KEYIDLEN) == id; i++) {
+        try {
+            aes_key = cRSA::decrypt(rsa_pri_key, std::string(slots.substr(i * slot_len + RSA_KEYIDLEN, RSA_KEYLEN / 8)));
+            break;
+        } catch (const Exception&) {
+            continue; // someone else's key with a colliding id
+        }
+    }
+    if (aes_key.empty()) throw "cMSG envelope has no slot for this key";
+
+    ciphertext.erase(0, pos + slot_count * slot_len);
     std::string nonce = undo_concat(ciphertext, AES_NONCELEN);
-    if (use_asymm) aes_key = cRSA::decrypt(rsa_pri_key, undo_concat(ciphertext, RSA_KEYLEN / 8)); //get RSA keylen in chars (bytes)
     std::string plaintext = cAES::decrypt(aes_key, nonce, ciphertext);
-    std::string sig = undo_concat(plaintext, DSA_SIGLEN);
-    return {plaintext, sig};
+    return split_signed(plaintext, header.alg);
+}
+
+std::array<std::string, 2> cMSG::unlock(
+    std::string ciphertext, 
+    const cRSA::PriKey& rsa_pri_key
+  ) {
+    if (cMSG::version(ciphertext) != MSG_V_MULTI) return cMSG::unlock(ciphertext, true, "", rsa_pri_key);
+    try {
+        return unlock_multi(ciphertext, rsa_pri_key);
+    } catch (...) {
+        return retry_untagged(std::current_exception(), [&] {
+            return open_body(ciphertext, cDSA::Alg::DSA, true, "", rsa_pri_key);
+        });
+    }
+}
+
+std::vector<std::optional<std::array<std::string, 2>>> cMSG::unlock_batch(
+    std::span<const std::string> ciphertexts,
+    bool use_asymm,
+    std::string aes_key,
+    std::string rsa_pri_key,
+    ThreadPool& pool
+  ) {
+    // decode the RSA key once for the whole batch
+    return cMSG::unlock_batch(
+        ciphertexts, 
+        use_asymm, 
+        aes_key, 
+        use_asymm ? cRSA::PriKey(rsa_pri_key) : cRSA::PriKey(), 
+        pool
+    );
+}
+
+std::vector<std::optional<std::array<std::string, 2>>> cMSG::unlock_batch(
+    std::span<const std::string> ciphertexts,
+    bool use_asymm,
+    std::string aes_key,
+    const cRSA::PriKey& rsa_pri_key,
+    ThreadPool& pool
+  ) {
+    // one bad envelope leaves its own slot empty instead of failing the batch
+    std::vector<std::optional<std::array<std::string, 2>>> results(ciphertexts.size());
+    pool.parallel_for(ciphertexts.size(), [&](size_t i) {
+        try {
+            results[i] = cMSG::unlock(ciphertexts[i], use_asymm, aes_key, rsa_pri_key);
+        } catch (...) {
+            results[i].reset();
+        }
+    });
+    return results;
+}
+
+void cMSG::lock(
+    cIO::Reader& message, 
+    cIO::Writer& ciphertext, 
+    bool use_asymm, 
+    const cDSA::PriKey& dsa_pri_key, 
+    std::string aes_key, 
+    const cRSA::PubKey& rsa_pub_key
+  ) {
+    std::string header = write_header(MSG_V_STREAM_TAGGED, use_asymm, dsa_pri_key.alg());
+    ciphertext.write(header.data(), header.size());
+
+    if (use_asymm) {
+        aes_key = cAES::keygen();
+        std::string wrapped_key = cRSA::encrypt(rsa_pub_key, aes_key);
+        ciphertext.write(wrapped_key.data(), wrapped_key.size());
+    }
+
+    // plaintext is message | sig, same as the in-memory envelope
+    SigningReader signing(message, dsa_pri_key.signer());
+    cAES::encrypt(aes_key, signing, ciphertext);
+}
+
+std::string cMSG::unlock(
+    cIO::Reader& ciphertext, 
+    cIO::Writer& message, 
+    bool use_asymm, 
+    std::string aes_key, 
+    const cRSA::PriKey& rsa_pri_key
+  ) {
+    std::string tag(MSG_HEADERLEN, '\0');
+    tag.resize(cIO::read_full(ciphertext, &tag[0], tag.size()));
+
+    // only stream versions are read as a stream; anything else, untagged envelopes that look tagged included, is unlocked in memory
+    unsigned char version = cMSG::version(tag);
+    if (version != MSG_V_STREAM && version != MSG_V_STREAM_TAGGED) {
+        // envelopes built in memory are bounded anyway
+        std::string whole = tag;
+        char buf[4096];
+        size_t n;
+        while ((n = ciphertext.read(buf, sizeof(buf))) > 0) whole.append(buf, n);
+        std::array<std::string, 2> unlocked = cMSG::unlock(whole, use_asymm, aes_key, rsa_pri_key);
+        message.write(unlocked[0].data(), unlocked[0].size());
+        return unlocked[1];
+    }
+
+    // the tagged stream version carries one more byte for the algorithm
+    if (version == MSG_V_STREAM_TAGGED) {
+        char alg;
+        if (cIO::read_full(ciphertext, &alg, 1) == 1) tag += alg;
+    }
+    envelope_header header = read_header(tag);
+    if (header.asymm != use_asymm) throw "cMSG envelope key mode mismatch";
+
+    if (use_asymm) {
+        std::string wrapped_key(RSA_KEYLEN / 8, '\0');
+        if (cIO::read_full(ciphertext, &wrapped_key[0], wrapped_key.size()) != wrapped_key.size()) {
+            throw "cMSG envelope truncated";
+        }
+        aes_key = cRSA::decrypt(rsa_pri_key, wrapped_key);
+    }
+
+    size_t sig_len = cDSA::siglen(header.alg);
+    HoldbackWriter holdback(message, sig_len);
+    if (!cAES::decrypt(aes_key, ciphertext, holdback) || holdback.held().size() != sig_len) {
+        throw "cMSG stream failed authentication";
+    }
+    return holdback.held();
 }
@@ -1,57 +1,139 @@
 #include "../../inc/ftree.hpp"
 #include <mutex>
+#include <cerrno>
+#include <unistd.h>
+
+ftree_metrics::ftree_metrics(const metric_labels& instance, MetricsRegistry& registry) :
+  save(registry.histogram("concord_save_seconds", "Time to queue a block for storage", instance, 1e-9)),
+  load(registry.histogram("concord_load_seconds", "Time to load a FileTree", instance, 1e-9)),
+  watch_lag(registry.histogram("concord_watch_lag_seconds", "Oldest watcher event to its batch being applied", instance, 1e-9)),
+  commit_failures(registry.counter("concord_store_commit_failures_total", "Write-behind commits the store failed", instance)) {}
 
 FileTree::
-FileTree(std::string dir) {
+FileTree(std::string dir, store_layout layout, bool compress) : Tree(dir), layout(layout), compress(compress), ftree_stats(get_metric_instance()) {
   load(dir);
 }
 
+FileTree::
+~FileTree() {
+  unwatch(); // nothing may push once we start tearing down
+  if (!this->store) return;
+  std::lock_guard lk(this->push_proc_mtx);
+  try {
+    write_checkpoint();
+  } catch (const std::exception&) {
+    // a missing checkpoint only costs a full validation next time; the queue still commits on its way out
+  }
+}
+
 void
-FileTree::load(std::string dir) { 
+FileTree::load(std::string dir, std::function<void(load_progress)> progress) { 
+  TRACE_SPAN("load");
+  ScopedTimer timer((this->ftree_stats).load);
   this->dir = dir;
 
   if ((this->dir).back() != '/') this->dir += "/";
-  
-  std::filesystem::path p(this->dir);
-
-  std::unordered_set<block> loaded_blocks;
-
-  for(auto& entry : std::filesystem::directory_iterator(p)) {
-    std::string path_str = entry.path().string();
-    if (path_str.substr(path_str.length() - 6) != ".block") continue; // only want .block files
-      std::ifstream saved_block(path_str.c_str());
-      if (saved_block) {
-          std::string block_data;
-          saved_block.seekg(0, std::ios::end); // move to stream end
-          block_data.resize(saved_block.tellg()); // expand string based on stream end position
-          saved_block.seekg(0, std::ios::beg);
-          saved_block.read(&block_data[0], block_data.size());
-          saved_block.close();
-          block parsed_block(json::parse(block_data));
-          loaded_blocks.insert(parsed_block);
-      } else continue;
+
+  {
+    // saves only happen under the push lock, the watcher's included, so none is mid-put while store and writer change
+    std::lock_guard lk(this->push_proc_mtx);
+    this->writer.reset();
+    if (this->layout == store_layout::mapped) this->store = std::make_unique<MappedStore>(this->dir, SEGMENT_LIMIT, this->compress);
+    else if (this->layout == store_layout::segmented) this->store = std::make_unique<SegmentStore>(this->dir, SEGMENT_LIMIT, this->compress);
+    else this->store = std::make_unique<DirStore>(this->dir);
+    this->writer = std::make_unique<WriteBehind>(*(this->store), 4096, std::chrono::milliseconds(5), &(this->ftree_stats).commit_failures);
   }
+
+  std::unordered_set<block> loaded_blocks = (this->store)->load(progress);
   
   std::lock_guard lk(this->push_proc_mtx);
+  // checkpointed blocks go straight into the graph; only what was stored after the checkpoint is validated
+  bool restored = restore_checkpoint(
+      (this->dir) + FTREE_CHECKPOINT, 
+      loaded_blocks, 
+      [this](std::string_view mark) {return (this->store)->matches(mark);}
+      );
+  if (restored && loaded_blocks.empty()) return;
+
+  // mapped contents stay unread until something asks for them, so don't hash them all here; MappedStore only hands out headers that passed a CRC
+  this->rehash_blocks = (this->layout != store_layout::mapped);
   batch_push(loaded_blocks, std::unordered_set<std::string>({"no-save"}));
+  this->rehash_blocks = true;
+  write_checkpoint();
+}
+
+void
+FileTree::write_checkpoint() {
+  (this->writer)->barrier().get();
+  std::string mark = (this->store)->mark();
+  if (mark.empty()) return; // the store can't vouch for its contents, so there's nothing to checkpoint against
+  save_checkpoint((this->dir) + FTREE_CHECKPOINT, mark);
+}
+
+void
+FileTree::checkpoint() {
+  std::lock_guard lk(this->push_proc_mtx);
+  write_checkpoint();
+}
+
+void
+FileTree::load() {
+  load(this->dir);
 }
 
 void
 FileTree::save(block to_save) { 
-  std::string block_string = to_save.dump();
-  std::ofstream block_file(((this->dir) + to_save.hash + ".block").c_str());
-  block_file << block_string;
-  block_file.close();
+  TRACE_SPAN("save");
+  ScopedTimer timer((this->ftree_stats).save);
+  (this->writer)->put(to_save);
+}
+
+std::shared_future<void>
+FileTree::durable() {
+  return (this->writer)->barrier();
 }
 
 void
 FileTree::apply(std::unordered_set<std::string> paths) {
-  std::unordered_set<block> to_check;
-  for (const auto& path : paths) { // read blocks
-    std::ifstream f(path);
-    to_check.insert(block(json::parse(f)));
+  TRACE_SPAN("watch_apply", paths.size());
+  std::vector<io_file> files;
+  for (const auto& path : paths) files.push_back({path});
+  IOEngine::shared().read(files); // read blocks, one batch
+
+  std::unordered_set<block> to_queue;
+  for (const auto& file : files) {
+    if (!file.ok) continue; // gone again before we got to it
+    try {
+      to_queue.insert(block(json::parse(file.data)));
+    } catch (const json::exception&) {
+      continue; // not a block
+    }
+  }
+
+  {
+    // our own saves land in watched directories too
+    std::lock_guard lk(this->push_proc_mtx);
+    drop_known(to_queue);
+  }
+  // validation happens in batch_push, under the push lock
+  if (!to_queue.empty()) queue_batch(to_queue);
+}
+
+watch_stats
+FileTree::get_watch_stats() {
+  std::lock_guard lk(this->watch_mtx);
+  return this->watch_counters;
+}
+
+void
+FileTree::unwatch() {
+  if (this->watcher.joinable()) {
+    uint64_t wake = 1;
+    while (write(this->wake_fd, &wake, sizeof(wake)) < 0 && errno == EINTR);
+    (this->watcher).join();
   }
-  std::unordered_set<block> valid = get_valid(to_check);
-  queue_batch(valid);
-  // TODO Either loop over valid blocks, or overload push_reponses to take a set of blocks
+  if (this->wake_fd >= 0) close(this->wake_fd);
+  if (this->kqfd >= 0) close(this->kqfd);
+  this->wake_fd = this->kqfd = -1;
+  (this->watches).clear();
 }
@@ -2,61 +2,130 @@
 #include "../../inc/ftree.hpp"
 
 #include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
-#include <thread>
+#include <algorithm>
+#include <climits>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
 
-#define EVENT_SIZE ( sizeof (struct inotify_event) )
-#define EBUFF_LEN  ( 1024 * ( EVENT_SIZE + 16 ) )
+#define WATCH_MASK ( IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR )
+#define EBUFF_LEN ( 64 * ( sizeof (struct inotify_event) + NAME_MAX + 1 ) )
 
 void
-Watch(int fd, int wd, FileTree* tree) {
-  // FIXME the way that we do this is kind of horrible
-  try {
-    char buff[EBUFF_LEN];
-    while(true) {
-      std::memset(buff, '\0', EBUFF_LEN);
-      ssize_t len = read(wd, buff, EBUFF_LEN);
-
-      if (len < 0) {
-        printf("error in watch: %d \n", errno); 
+FileTree::watch_loop() {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd < 0) return;
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = this->kqfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, this->kqfd, &ev);
+  ev.data.fd = this->wake_fd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, this->wake_fd, &ev);
+
+  // inotify records are int-aligned and variable length
+  alignas(struct inotify_event) char buff[EBUFF_LEN];
+  std::unordered_set<std::string> pending;
+  std::chrono::steady_clock::time_point first_pending;
+
+  while (true) {
+    int timeout = -1;
+    if (!pending.empty()) {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(first_pending + this->watch_window - std::chrono::steady_clock::now());
+      timeout = std::max<long long>(0, left.count());
+    }
+
+    struct epoll_event ready[2];
+    int n = epoll_wait(epfd, ready, 2, timeout);
+    if (n < 0 && errno != EINTR) break;
+
+    bool stopping = false, rescan = false;
+    for (int i = 0; i < n; i++) {
+      if (ready[i].data.fd == this->wake_fd) {
+        stopping = true;
+        continue;
       }
-    
-      for (unsigned int i = 0; i < len; i++) {
-        struct inotify_event *event = ( struct inotify_event * ) &buff[i];
-        if (!event->len) continue;
-      
-        if (event->mask & IN_CREATE) {
-          if (event->mask & IN_ISDIR) {
-            printf("+directory %s \n", event->name);
-          } else {
-            tree->apply({std::string{event->name}}); 
+
+      // drain everything the kernel has for us
+      ssize_t len;
+      while ((len = read(this->kqfd, buff, EBUFF_LEN)) > 0) {
+        std::lock_guard lk(this->watch_mtx);
+        for (char* p = buff; p < buff + len; p += sizeof(struct inotify_event) + ((struct inotify_event*) p)->len) {
+          struct inotify_event* event = (struct inotify_event*) p;
+          if (event->mask & IN_Q_OVERFLOW) {
+            (this->watch_counters).overflows++;
+            rescan = true;
+            continue;
           }
+          if (!event->len || (event->mask & IN_ISDIR) || !(event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) continue;
+          std::string name(event->name);
+          if (!name.ends_with(".block") || !(this->watches).contains(event->wd)) continue;
+
+          if (pending.empty()) first_pending = std::chrono::steady_clock::now();
+          pending.insert((this->watches)[event->wd] + name);
+          (this->watch_counters).events++;
+        }
+      }
+    }
+    if (stopping) break; // anything pending is on disk, and the next load will have it
+
+    if (rescan) {
+      // events were dropped, so look at everything; apply skips what the graph already has
+      std::lock_guard lk(this->watch_mtx);
+      if (pending.empty()) first_pending = std::chrono::steady_clock::now();
+      for (const auto& [wd, dir] : this->watches) {
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+          if (entry.path().string().ends_with(".block")) pending.insert(entry.path().string());
         }
-        i += EVENT_SIZE + event->len;
       }
     }
-    
-  } catch (std::exception& e) {
-    inotify_rm_watch(fd, wd);
-    printf("!exception: %s \n", e.what());
-    return; // Tree was most likely closed... 
+
+    if (pending.empty() || std::chrono::steady_clock::now() < first_pending + this->watch_window) continue;
+
+    try {
+      apply(pending);
+    } catch (const std::exception& e) {
+      printf("!exception in watch: %s \n", e.what()); // keep watching; the files stay on disk
+    }
+    pending.clear();
+
+    std::chrono::duration<double, std::milli> lag = std::chrono::steady_clock::now() - first_pending;
+    (this->ftree_stats).watch_lag.record(std::chrono::duration_cast<std::chrono::nanoseconds>(lag).count());
+    std::lock_guard lk(this->watch_mtx);
+    watch_stats& counters = this->watch_counters;
+    counters.batches++;
+    counters.last_lag_ms = lag.count();
+    counters.max_lag_ms = std::max(counters.max_lag_ms, lag.count());
+    this->watch_lag_total_ms += lag.count();
+    counters.mean_lag_ms = this->watch_lag_total_ms / counters.batches;
   }
+
+  close(epfd);
 }
 
 void
 FileTree::install(std::string path) {
-  
-  // create new kernel queue instance (if we haven't already)
-  if (!kqfd) kqfd = inotify_init();
-  assert(0 < kqfd);
-
-  // install on our kq
-  int watch_d = inotify_add_watch(kqfd, path.c_str(), IN_CREATE);
-  assert(0 < watch_d);
-
-  // now we wait
-  std::thread wthread(&Watch, kqfd, watch_d, this);
-  wthread.detach();
+  if (path.back() != '/') path += "/";
+
+  // one kernel queue and one loop, however many directories
+  if (this->kqfd < 0) {
+    this->kqfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (this->kqfd < 0) throw std::runtime_error(std::string("inotify_init1 failed: ") + std::strerror(errno));
+    this->wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (this->wake_fd < 0) throw std::runtime_error(std::string("eventfd failed: ") + std::strerror(errno));
+  }
+
+  int watch_d = inotify_add_watch(this->kqfd, path.c_str(), WATCH_MASK);
+  if (watch_d < 0) throw std::runtime_error("can't watch " + path + ": " + std::strerror(errno));
+  {
+    std::lock_guard lk(this->watch_mtx);
+    (this->watches)[watch_d] = path;
+  }
+
+  if (!(this->watcher).joinable()) this->watcher = std::thread(&FileTree::watch_loop, this);
 }
 
 #endif
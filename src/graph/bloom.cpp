@@ -0,0 +1,41 @@
+#include "../../inc/bloom.hpp"
+
+#include <algorithm>
+#include <functional>
+
+BlockedBloom::BlockedBloom(size_t capacity) : blocks(std::max<size_t>(1, (capacity + BLOOM_BLOCK_KEYS - 1) / BLOOM_BLOCK_KEYS), bloom_block{}) {}
+
+std::pair<size_t, std::array<uint64_t, 8>>
+BlockedBloom::locate(std::string_view key) const {
+  uint64_t h = std::hash<std::string_view>{}(key);
+  // high half picks the block (multiply-shift instead of a modulo); a remix of the whole hash gives 6 bits per word
+  size_t block = ((h >> 32) * (this->blocks).size()) >> 32;
+  uint64_t bits = (h ^ (h >> 29)) * 0x9E3779B97F4A7C15ull;
+  std::array<uint64_t, 8> mask;
+  for (size_t i = 0; i < mask.size(); i++) mask[i] = (uint64_t) 1 << ((bits >> (16 + 6 * i)) & 63);
+  return {block, mask};
+}
+
+void
+BlockedBloom::insert(std::string_view key) {
+  auto [block, mask] = locate(key);
+  std::array<uint64_t, 8>& words = (this->blocks)[block].words;
+  for (size_t i = 0; i < words.size(); i++) words[i] |= mask[i];
+  this->inserted++;
+}
+
+bool
+BlockedBloom::may_contain(std::string_view key) const {
+  auto [block, mask] = locate(key);
+  const std::array<uint64_t, 8>& words = (this->blocks)[block].words;
+  for (size_t i = 0; i < words.size(); i++) {
+    if (!(words[i] & mask[i])) return false;
+  }
+  return true;
+}
+
+void
+BlockedBloom::clear() {
+  std::fill((this->blocks).begin(), (this->blocks).end(), bloom_block{});
+  this->inserted = 0;
+}
@@ -1,7 +1,45 @@
-#include "../../inc/graph.hpp"
+#include "../../inc/tree.hpp"
+
+push_metrics::push_metrics(const metric_labels& instance, MetricsRegistry& registry) :
+  queue_depth(registry.gauge("concord_push_queue_depth", "Batches waiting to be pushed", instance)),
+  graph_size(registry.gauge("concord_graph_vertices", "Vertices linked into the graph", instance)),
+  batches(registry.counter("concord_push_batches_total", "Batches pushed", instance)),
+  pushed(registry.counter("concord_push_vertices_total", "Vertices linked by pushes", instance)),
+  disconnected(registry.counter("concord_push_rejected_total", "Vertices rejected by pushes", with_labels(instance, {{"reason", "disconnected"}}))),
+  duplicates(registry.counter("concord_push_rejected_total", "Vertices rejected by pushes", with_labels(instance, {{"reason", "duplicate"}}))),
+  batch_size(registry.histogram("concord_push_batch_size", "Vertices offered per batch", instance)),
+  get_valid(registry.histogram("concord_push_stage_seconds", "Time spent per push stage", with_labels(instance, {{"stage", "get_valid"}}), 1e-9)),
+  get_connected(registry.histogram("concord_push_stage_seconds", "Time spent per push stage", with_labels(instance, {{"stage", "get_connected"}}), 1e-9)),
+  link(registry.histogram("concord_push_stage_seconds", "Time spent per push stage", with_labels(instance, {{"stage", "link"}}), 1e-9)),
+  push_response(registry.histogram("concord_push_stage_seconds", "Time spent per push stage", with_labels(instance, {{"stage", "push_response"}}), 1e-9)),
+  memory({
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "nodes"}})),
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "edges"}})),
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "content"}})),
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "mapped"}})),
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "indexes"}})),
+    &registry.gauge("concord_graph_memory_bytes", "Estimated heap bytes held by the graph", with_labels(instance, {{"category", "queued"}}))
+  }) {}
+
+static std::atomic<uint64_t> next_graph_instance = 0;
+
+static metric_labels
+graph_instance(const std::string& name) {
+  metric_labels labels = {{"graph", std::to_string(next_graph_instance++)}};
+  if (!name.empty()) labels["name"] = name;
+  return labels;
+}
+
+template<class vertex>
+graph_model<vertex>::graph_model(std::string name) : metric_instance(graph_instance(name)), push_stats(metric_instance) {
+  account_memory({{std::string(), {.indexes = (int64_t) (this->seen).bytes()}}});
+}
 
 template<class vertex>
-graph_model<vertex>::graph_model() {}
+graph_model<vertex>::~graph_model() {
+  // the id alone, so two graphs sharing a name don't drop each other's
+  MetricsRegistry::shared().drop({{"graph", (this->metric_instance).at("graph")}});
+}
 
 template<class vertex>
 linked<vertex> 
@@ -24,12 +62,13 @@ graph_model<vertex>::get_graph() {
 template<class vertex>
 std::unordered_set<vertex> 
 graph_model<vertex>::get_connected(std::unordered_set<vertex> to_check) {
+  TRACE_SPAN("get_connected", to_check.size());
   std::map<std::string, std::unordered_set<std::string>> parents_ref;
   std::unordered_set<std::string> conn_trips;
   std::unordered_set<vertex> conn_vertices;
   std::function<bool(std::string)> is_supported;
 
-  for (const auto tc_vert : to_check) parents_ref[tc_vert.trip()] = tc_vert.p_trips();
+  for (auto tc_vert : to_check) parents_ref[tc_vert.trip()] = tc_vert.p_trips();
 
   is_supported = [this, parents_ref, &conn_trips, &is_supported](std::string target) {
     for (const auto p_trip : parents_ref.at(target)) {
@@ -44,7 +83,7 @@ graph_model<vertex>::get_connected(std::unordered_set<vertex> to_check) {
     return true;
   };
 
-  for (const auto tc_vert : to_check) {
+  for (auto tc_vert : to_check) {
     if (
         conn_trips.contains(tc_vert.trip()) 
         || is_supported(tc_vert.trip())
@@ -53,3 +92,133 @@ graph_model<vertex>::get_connected(std::unordered_set<vertex> to_check) {
 
   return conn_vertices;
 }
+
+template<class vertex>
+memory_report
+graph_model<vertex>::get_memory() {
+  std::lock_guard lk(this->memory_mtx);
+  return this->memory;
+}
+
+template<class vertex>
+void
+graph_model<vertex>::account_memory(const std::map<std::string, memory_usage>& deltas) {
+  std::lock_guard lk(this->memory_mtx);
+  memory_usage& current = (this->memory).current;
+  for (const auto& [group, delta] : deltas) {
+    current += delta;
+    if (!group.empty()) (this->memory).by_group[group] += delta;
+  }
+
+  memory_usage& peak = (this->memory).peak;
+  peak.nodes = std::max(peak.nodes, current.nodes);
+  peak.edges = std::max(peak.edges, current.edges);
+  peak.content = std::max(peak.content, current.content);
+  peak.mapped = std::max(peak.mapped, current.mapped);
+  peak.indexes = std::max(peak.indexes, current.indexes);
+  peak.queued = std::max(peak.queued, current.queued);
+  (this->memory).peak_total = std::max((this->memory).peak_total, current.total());
+
+  std::array<int64_t, 6> values = {current.nodes, current.edges, current.content, current.mapped, current.indexes, current.queued};
+  for (size_t i = 0; i < values.size(); i++) (this->push_stats).memory[i]->set(values[i]);
+}
+
+template<class vertex>
+void
+graph_model<vertex>::reset_memory() {
+  std::lock_guard lk(this->memory_mtx);
+  int64_t queued = (this->memory).current.queued;
+  (this->memory).current = memory_usage();
+  (this->memory).current.queued = queued;
+  (this->memory).by_group.clear();
+}
+
+template<class vertex>
+void
+graph_model<vertex>::recount_memory() {
+  std::map<std::string, memory_usage> counted;
+  for (const auto& [trip, node] : this->graph) counted[memory_group(node.ref)] += linked_memory(node);
+  reset_memory();
+  account_memory(counted);
+}
+
+template<class vertex>
+memory_usage
+graph_model<vertex>::linked_memory(const linked<vertex>& node) {
+  memory_usage out = vertex_memory(node.ref);
+  out.nodes = memsize::map_entry<std::string, linked<vertex>>() + memsize::string(node.trip) * 2; // key and linked::trip
+  // each edge is an entry in the child's parents and the parent's children
+  out.edges = node.parents.size() * 2 * memsize::set_entry<linked<vertex>*>();
+  return out;
+}
+
+template<class vertex>
+int64_t
+graph_model<vertex>::batch_memory(const std::unordered_set<vertex>& batch) {
+  int64_t out = batch.size() * memsize::set_entry<vertex>();
+  for (const auto& queued : batch) out += vertex_memory(queued).content;
+  return out;
+}
+
+template<class vertex>
+memory_usage
+graph_model<vertex>::vertex_memory(const vertex& target) {
+  return memory_usage();
+}
+
+template<class vertex>
+std::string
+graph_model<vertex>::memory_group(const vertex& target) {
+  return std::string();
+}
+
+template<class vertex>
+size_t
+graph_model<vertex>::drop_known(std::unordered_set<vertex>& batch) {
+  size_t dropped = std::erase_if(batch, [this](const vertex& checked) {
+    std::string trip = checked.trip();
+    return (this->seen).may_contain(trip) && (this->graph).contains(trip);
+  });
+  (this->push_stats).duplicates.inc(dropped);
+  return dropped;
+}
+
+template<class vertex>
+void
+graph_model<vertex>::remember(const std::string& trip) {
+  if ((this->seen).size() < (this->seen).capacity()) {
+    (this->seen).insert(trip);
+    return;
+  }
+  // full; the graph already holds trip, so rebuilding from it covers trip too
+  int64_t old_bytes = (this->seen).bytes();
+  (this->seen) = BlockedBloom(2 * (this->graph).size());
+  for (const auto& [linked_trip, node] : this->graph) (this->seen).insert(linked_trip);
+  account_memory({{std::string(), {.indexes = (int64_t) (this->seen).bytes() - old_bytes}}});
+}
+
+template<class vertex>
+void
+graph_model<vertex>::reseed_seen() {
+  (this->seen) = BlockedBloom(std::max<size_t>(BLOOM_MIN_CAPACITY, 2 * (this->graph).size()));
+  for (const auto& [trip, node] : this->graph) (this->seen).insert(trip);
+  account_memory({{std::string(), {.indexes = (int64_t) (this->seen).bytes()}}});
+}
+
+template graph_model<block>::graph_model(std::string);
+template graph_model<block>::~graph_model();
+template linked<block> graph_model<block>::get_root();
+template bool graph_model<block>::check_rooted();
+template std::map<std::string, linked<block>> graph_model<block>::get_graph();
+template std::unordered_set<block> graph_model<block>::get_connected(std::unordered_set<block>);
+template size_t graph_model<block>::drop_known(std::unordered_set<block>&);
+template void graph_model<block>::remember(const std::string&);
+template void graph_model<block>::reseed_seen();
+template memory_report graph_model<block>::get_memory();
+template void graph_model<block>::account_memory(const std::map<std::string, memory_usage>&);
+template void graph_model<block>::reset_memory();
+template void graph_model<block>::recount_memory();
+template memory_usage graph_model<block>::linked_memory(const linked<block>&);
+template int64_t graph_model<block>::batch_memory(const std::unordered_set<block>&);
+template memory_usage graph_model<block>::vertex_memory(const block&);
+template std::string graph_model<block>::memory_group(const block&);
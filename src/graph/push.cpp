@@ -1,4 +1,4 @@
-#include "../../inc/graph.hpp"
+#include "../../inc/tree.hpp"
 
 template<class vertex> 
 void 
@@ -6,28 +6,56 @@ graph_model<vertex>::batch_push(
     std::unordered_set<vertex> to_push_set, 
     std::unordered_set<std::string> flags // FIXME this should be a bitmask, or even a set of ints, strings are kind of wasteful here
   ) {
+  TRACE_SPAN("batch_push", to_push_set.size());
+  push_metrics& stats = this->push_stats;
+  LapTimer timer(to_push_set.size() >= PUSH_STAGE_SAMPLE || stats.batches.value() % PUSH_STAGE_SAMPLE == 0);
+  size_t offered = to_push_set.size();
+  // re-deliveries are dropped on their trips alone, before get_valid hashes anything
+  drop_known(to_push_set);
   std::unordered_set<vertex> valid_vertices = get_valid(to_push_set);
+  timer.lap(stats.get_valid);
   std::unordered_set<vertex> usable_vertices = get_connected(valid_vertices);
+  timer.lap(stats.get_connected);
   std::unordered_set<std::string> new_trips;
 
   // if there's a new root, we deal with it first
   // we can add and link it later - the graph just needs to be configured before the full push.
-  for (const auto tp_vert : usable_vertices)
-    if (tp_vert.p_hashes().empty()) graph_configure(get_graph()[tp_vert].ref);
+  for (auto tp_vert : usable_vertices)
+    if (tp_vert.p_trips().empty()) graph_configure(tp_vert);
 
   // add all verts, *then* link, and *only then* trigger callbacks (once verts are integrated)
-  for (const auto tp_vert : usable_vertices) {
-    linked<vertex> new_vert;
-    new_vert.ref = tp_vert;
-    new_vert.trip = tp_vert.trip();
+  {
+    TRACE_SPAN("link", usable_vertices.size());
+    for (auto tp_vert : usable_vertices) {
+      linked<vertex> new_vert;
+      new_vert.ref = tp_vert;
+      new_vert.trip = tp_vert.trip();
+
+      // never replace a linked vertex; that would wipe its edges
+      if (!(this->graph).try_emplace(new_vert.trip, new_vert).second) continue;
+      remember(new_vert.trip);
+      new_trips.insert(new_vert.trip);
+    }
 
-    (this->graph)[tp_vert.trip()] = new_vert;
-    new_trips.insert(tp_vert.trip());
+    for (const auto& new_trip : new_trips) link(new_trip);
   }
+  timer.lap(stats.link);
 
-  for (const auto tp_vert : usable_vertices) link(tp_vert.trip());
+  std::map<std::string, memory_usage> memory_deltas;
+  for (const auto& new_trip : new_trips) {
+    const linked<vertex>& added = (this->graph)[new_trip];
+    memory_deltas[memory_group(added.ref)] += linked_memory(added);
+  }
+  account_memory(memory_deltas);
 
   push_response(new_trips, flags);
+  timer.lap(stats.push_response);
+
+  stats.batches.inc();
+  stats.batch_size.record(offered);
+  stats.disconnected.inc(valid_vertices.size() - usable_vertices.size());
+  stats.pushed.inc(new_trips.size());
+  stats.graph_size.set((this->graph).size());
 }
 
 // queuing (ensure that pushes don't happen simultaneously)
@@ -35,7 +63,10 @@ graph_model<vertex>::batch_push(
 template<class vertex>
 void 
 graph_model<vertex>::queue_batch(std::unordered_set<vertex> to_queue) {
+  TRACE_SPAN("queue_batch", to_queue.size());
+  account_memory({{std::string(), {.queued = batch_memory(to_queue)}}});
   (this->awaiting_push_batches).push(to_queue);
+  (this->push_stats).queue_depth.add(1);
   (this->push_proc_mtx).lock();
   if (!push_proc_active) {
     push_proc_active = true;
@@ -44,6 +75,14 @@ graph_model<vertex>::queue_batch(std::unordered_set<vertex> to_queue) {
   } else (this->push_proc_mtx).unlock();
 }
 
+template<class vertex>
+void
+graph_model<vertex>::push_batch(std::unordered_set<vertex> to_push) {
+  TRACE_SPAN("push_batch", to_push.size());
+  std::lock_guard<std::mutex> lk(this->push_proc_mtx);
+  batch_push(to_push);
+}
+
 // Convienece overloads + methods
 template<class vertex>
 void 
@@ -69,6 +108,7 @@ graph_model<vertex>::queue_unit(vertex to_queue) {
 template<class vertex>
 void 
 graph_model<vertex>::push_proc() {
+  TRACE_SPAN("push_proc");
   while (true) {
     std::unordered_set<vertex> next_batch;
 
@@ -81,8 +121,16 @@ graph_model<vertex>::push_proc() {
 
     next_batch = awaiting_push_batches.front();
     (this->awaiting_push_batches).pop();
+    (this->push_stats).queue_depth.add(-1);
+    account_memory({{std::string(), {.queued = -batch_memory(next_batch)}}});
 
-    batch_push(next_batch);
+    // a throwing batch ends this proc; drop the flag, or every later queue_batch would only enqueue
+    try {
+      batch_push(next_batch);
+    } catch (...) {
+      this->push_proc_active = false;
+      throw;
+    }
   }
 }
 
@@ -92,21 +140,27 @@ template<class vertex>
 void 
 graph_model<vertex>::link(std::string to_link) {
   // unfortunately, it turns out we can't link verts that *aren't in the graph*
-  if (!get_graph().contains(to_link)) return;
+  if (!(this->graph).contains(to_link)) return;
 
-  linked<vertex> tl_vertex = get_graph()[to_link];
+  linked<vertex>& tl_vertex = (this->graph)[to_link];
 
   // add parents by tripcodes, and give those parents the target as a child.
-  for (const auto p_trip : tl_vertex.p_trips()) {
-    (this->graph)[to_link].parents.insert(&((this->graph)[p_trip]))
+  for (const auto p_trip : tl_vertex.ref.p_trips()) {
+    (this->graph)[to_link].parents.insert(&((this->graph)[p_trip]));
     (this->graph)[p_trip].children.insert(&((this->graph)[to_link]));
   }
 
   // set up root references
-  if (tl_vertex.ref.p_hashes().empty() && !this->rooted) {
+  if (tl_vertex.ref.p_trips().empty() && !this->rooted) {
     this->rooted = true;
     this->graph_root = &((this->graph)[to_link]);
   }
 }
 
-
+template void graph_model<block>::batch_push(std::unordered_set<block>, std::unordered_set<std::string>);
+template void graph_model<block>::queue_batch(std::unordered_set<block>);
+template void graph_model<block>::queue_batch(std::vector<block>);
+template void graph_model<block>::queue_unit(block);
+template void graph_model<block>::push_batch(std::unordered_set<block>);
+template void graph_model<block>::push_proc();
+template void graph_model<block>::link(std::string);
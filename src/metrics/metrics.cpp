@@ -0,0 +1,249 @@
+#include "../../inc/metrics.hpp"
+
+#include <bit>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+void
+Histogram::record(uint64_t v) {
+  (this->buckets)[bucket(v)].fetch_add(1, std::memory_order_relaxed);
+  (this->count).fetch_add(1, std::memory_order_relaxed);
+  (this->sum).fetch_add(v, std::memory_order_relaxed);
+  uint64_t seen = (this->max).load(std::memory_order_relaxed);
+  while (v > seen && !(this->max).compare_exchange_weak(seen, v, std::memory_order_relaxed));
+}
+
+size_t
+Histogram::bucket(uint64_t v) {
+  if (v < HIST_SUB) return v;
+  // the top HIST_SUB_BITS + 1 bits pick the bucket; everything below them is the bucket's width
+  unsigned shift = std::bit_width(v) - 1 - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB + (v >> shift) - HIST_SUB;
+}
+
+std::array<uint64_t, 2>
+Histogram::bounds(size_t bucket) {
+  if (bucket < HIST_SUB) return {bucket, bucket};
+  unsigned shift = bucket / HIST_SUB - 1;
+  uint64_t lower = (bucket % HIST_SUB + HIST_SUB) << shift;
+  return {lower, lower + ((uint64_t) 1 << shift) - 1};
+}
+
+histogram_snapshot
+Histogram::snapshot() const {
+  std::array<uint64_t, HIST_BUCKETS> counts;
+  uint64_t total = 0;
+  for (size_t i = 0; i < HIST_BUCKETS; i++) {
+    counts[i] = (this->buckets)[i].load(std::memory_order_relaxed);
+    total += counts[i];
+  }
+
+  histogram_snapshot out = {};
+  out.count = total;
+  out.sum = (this->sum).load(std::memory_order_relaxed);
+  out.max = (this->max).load(std::memory_order_relaxed);
+  if (total == 0) return out;
+
+  // quantiles report their bucket's midpoint, never past the largest value seen
+  std::array<double, 4> quantiles = {0.5, 0.9, 0.99, 0.999};
+  std::array<double*, 4> targets = {&out.p50, &out.p90, &out.p99, &out.p999};
+  size_t q = 0;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < HIST_BUCKETS && q < quantiles.size(); i++) {
+    seen += counts[i];
+    while (q < quantiles.size() && seen >= std::ceil(quantiles[q] * total)) {
+      std::array<uint64_t, 2> range = bounds(i);
+      *targets[q] = std::min<double>(range[0] + (range[1] - range[0]) / 2.0, out.max);
+      q++;
+    }
+  }
+  return out;
+}
+
+MetricsRegistry::family&
+MetricsRegistry::find_family(const std::string& name, const std::string& help, metric_kind kind) {
+  if (!(this->families).contains(name)) {
+    family& created = (this->families)[name];
+    created.help = help;
+    created.kind = kind;
+    return created;
+  }
+  family& found = (this->families)[name];
+  if (found.kind != kind) throw std::runtime_error("metric " + name + " registered as two kinds");
+  return found;
+}
+
+Counter&
+MetricsRegistry::counter(std::string name, std::string help, metric_labels labels) {
+  std::lock_guard lk(this->registry_mtx);
+  family& fam = find_family(name, help, metric_kind::counter);
+  std::unique_ptr<Counter>& out = fam.counters[labels];
+  if (!out) out = std::make_unique<Counter>();
+  return *out;
+}
+
+Gauge&
+MetricsRegistry::gauge(std::string name, std::string help, metric_labels labels) {
+  std::lock_guard lk(this->registry_mtx);
+  family& fam = find_family(name, help, metric_kind::gauge);
+  std::unique_ptr<Gauge>& out = fam.gauges[labels];
+  if (!out) out = std::make_unique<Gauge>();
+  return *out;
+}
+
+Histogram&
+MetricsRegistry::histogram(std::string name, std::string help, metric_labels labels, double scale) {
+  std::lock_guard lk(this->registry_mtx);
+  family& fam = find_family(name, help, metric_kind::histogram);
+  fam.scale = scale;
+  std::unique_ptr<Histogram>& out = fam.histograms[labels];
+  if (!out) out = std::make_unique<Histogram>();
+  return *out;
+}
+
+void
+MetricsRegistry::drop(const metric_labels& match) {
+  auto matches = [&match](const metric_labels& labels) {
+    for (const auto& [key, value] : match) {
+      auto found = labels.find(key);
+      if (found == labels.end() || found->second != value) return false;
+    }
+    return true;
+  };
+  std::lock_guard lk(this->registry_mtx);
+  for (auto fam = (this->families).begin(); fam != (this->families).end();) {
+    std::erase_if(fam->second.counters, [&](const auto& entry) {return matches(entry.first);});
+    std::erase_if(fam->second.gauges, [&](const auto& entry) {return matches(entry.first);});
+    std::erase_if(fam->second.histograms, [&](const auto& entry) {return matches(entry.first);});
+    if (fam->second.counters.empty() && fam->second.gauges.empty() && fam->second.histograms.empty()) fam = (this->families).erase(fam);
+    else fam++;
+  }
+}
+
+metrics_snapshot
+MetricsRegistry::snapshot() {
+  std::lock_guard lk(this->registry_mtx);
+  metrics_snapshot out;
+  for (const auto& [name, fam] : this->families) {
+    for (const auto& [labels, c] : fam.counters) out.samples.push_back({name, fam.help, fam.kind, labels, (double) c->value(), {}, 1});
+    for (const auto& [labels, g] : fam.gauges) out.samples.push_back({name, fam.help, fam.kind, labels, (double) g->value(), {}, 1});
+    for (const auto& [labels, h] : fam.histograms) out.samples.push_back({name, fam.help, fam.kind, labels, 0, h->snapshot(), fam.scale});
+  }
+  return out;
+}
+
+static std::string
+prom_number(double v) {
+  if (std::isnan(v)) return "NaN";
+  if (v == std::floor(v) && std::fabs(v) < 1e15) return std::to_string((long long) v);
+  char buf[32];
+  std::snprintf(buf, sizeof(buf), "%.9g", v);
+  return buf;
+}
+
+static std::string
+prom_labels(const metric_labels& labels, std::string extra = std::string()) {
+  std::string out;
+  for (const auto& [key, value] : labels) {
+    std::string escaped;
+    for (char c : value) {
+      if (c == '\\' || c == '"') escaped += '\\';
+      if (c == '\n') escaped += "\\n";
+      else escaped += c;
+    }
+    out += (out.empty() ? "" : ",") + key + "=\"" + escaped + "\"";
+  }
+  if (!extra.empty()) out += (out.empty() ? "" : ",") + extra;
+  return out.empty() ? out : "{" + out + "}";
+}
+
+std::string
+MetricsRegistry::prometheus() {
+  metrics_snapshot snap = snapshot();
+  std::string out;
+  std::string last_name;
+  for (const auto& sample : snap.samples) {
+    if (sample.name != last_name) {
+      const char* type = sample.kind == metric_kind::counter ? "counter" : sample.kind == metric_kind::gauge ? "gauge" : "summary";
+      out += "# HELP " + sample.name + " " + sample.help + "\n";
+      out += "# TYPE " + sample.name + " " + type + "\n";
+      last_name = sample.name;
+    }
+
+    if (sample.kind != metric_kind::histogram) {
+      out += sample.name + prom_labels(sample.labels) + " " + prom_number(sample.value) + "\n";
+      continue;
+    }
+    const histogram_snapshot& h = sample.hist;
+    std::array<std::pair<const char*, double>, 4> quantiles = {{{"0.5", h.p50}, {"0.9", h.p90}, {"0.99", h.p99}, {"0.999", h.p999}}};
+    for (const auto& [q, v] : quantiles) {
+      out += sample.name + prom_labels(sample.labels, std::string("quantile=\"") + q + "\"") + " " + prom_number(v * sample.scale) + "\n";
+    }
+    out += sample.name + "_sum" + prom_labels(sample.labels) + " " + prom_number(h.sum * sample.scale) + "\n";
+    out += sample.name + "_count" + prom_labels(sample.labels) + " " + prom_number(h.count) + "\n";
+  }
+  return out;
+}
+
+static void
+replace_file(const std::string& path, const std::string& text) {
+  std::string tmp_path = path + ".tmp";
+  {
+    std::ofstream out(tmp_path, std::ios::trunc);
+    out << text;
+    if (!out) throw std::runtime_error("can't write metrics to " + tmp_path);
+  }
+  std::filesystem::rename(tmp_path, path);
+}
+
+void
+MetricsRegistry::write_prometheus(std::string path) {
+  replace_file(path, prometheus());
+}
+
+MetricsRegistry&
+MetricsRegistry::shared() {
+  static MetricsRegistry registry;
+  return registry;
+}
+
+MetricsExporter::MetricsExporter(
+    MetricsRegistry& registry,
+    std::function<void(const std::string&)> sink,
+    std::chrono::milliseconds interval
+  ) : registry(registry), sink(sink), interval(interval) {
+  this->exporter = std::thread(&MetricsExporter::run, this);
+}
+
+MetricsExporter::MetricsExporter(
+    MetricsRegistry& registry,
+    std::string path,
+    std::chrono::milliseconds interval
+  ) : MetricsExporter(registry, [path](const std::string& text) {replace_file(path, text);}, interval) {}
+
+MetricsExporter::~MetricsExporter() {
+  {
+    std::lock_guard lk(this->export_mtx);
+    this->stopping = true;
+  }
+  (this->stop_cv).notify_all();
+  (this->exporter).join();
+}
+
+void
+MetricsExporter::run() {
+  std::unique_lock lk(this->export_mtx);
+  while (true) {
+    bool stopping = (this->stop_cv).wait_for(lk, this->interval, [this] {return this->stopping;});
+    try {
+      (this->sink)((this->registry).prometheus());
+    } catch (const std::exception& e) {
+      printf("!exception in metrics export: %s \n", e.what()); // a missed export shouldn't take the process down
+    }
+    if (stopping) return;
+  }
+}
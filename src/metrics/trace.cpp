@@ -0,0 +1,166 @@
+#include "../../inc/trace.hpp"
+
+#include <array>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <nlohmann/json.hpp>
+
+/**
+ * One span; fields are relaxed atomics so a flush racing the owning thread reads stale values, never torn ones
+ */
+struct trace_event {
+  std::atomic<const char*> name = nullptr;
+  std::atomic<uint64_t> start_ns = 0;
+  std::atomic<uint64_t> dur_ns = 0;
+  std::atomic<int64_t> arg = -1;
+};
+
+/**
+ * A thread's spans. Only the owner writes; head counts every span ever recorded, so slot i % TRACE_RING holds span i.
+ * Rings outlive their threads, so spans from finished threads still flush, until a new thread takes the ring over (see claim_ring).
+ */
+struct trace_ring {
+  std::atomic<long> tid;
+  std::atomic<uint64_t> head = 0;
+  std::atomic<uint64_t> cleared = 0; /**< Spans before this index were dropped by trace::clear */
+  std::atomic<uint64_t> flushed = 0; /**< Spans before this index were read by trace::chrome_json */
+  std::array<trace_event, TRACE_RING> events;
+};
+
+static std::mutex rings_mtx;
+
+static std::vector<std::shared_ptr<trace_ring>>&
+all_rings() {
+  static std::vector<std::shared_ptr<trace_ring>> rings;
+  return rings;
+}
+
+/**
+ * Rings whose threads have finished, oldest first; held in all_rings as well
+ */
+static std::deque<std::shared_ptr<trace_ring>>&
+dead_rings() {
+  static std::deque<std::shared_ptr<trace_ring>> rings;
+  return rings;
+}
+
+/**
+ * A ring for a new thread: a finished thread's ring whose spans have all been flushed or cleared, else the oldest finished one once
+ * TRACE_DEAD_RINGS are waiting, else a new one. Threads come and go (a write-behind committer per FileTree::load), so rings can't be one per thread ever started.
+ */
+static std::shared_ptr<trace_ring>
+claim_ring() {
+  long tid = syscall(SYS_gettid);
+  std::lock_guard lk(rings_mtx);
+  std::deque<std::shared_ptr<trace_ring>>& dead = dead_rings();
+  auto reused = std::find_if(dead.begin(), dead.end(), [](const std::shared_ptr<trace_ring>& ring) {
+    return std::max(ring->flushed.load(std::memory_order_relaxed), ring->cleared.load(std::memory_order_relaxed)) >= ring->head.load(std::memory_order_acquire);
+  });
+  if (reused == dead.end() && dead.size() >= TRACE_DEAD_RINGS) reused = dead.begin();
+  if (reused != dead.end()) {
+    std::shared_ptr<trace_ring> ring = *reused;
+    dead.erase(reused);
+    ring->cleared.store(ring->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    ring->tid.store(tid, std::memory_order_relaxed);
+    return ring;
+  }
+
+  std::shared_ptr<trace_ring> created = std::make_shared<trace_ring>();
+  created->tid.store(tid, std::memory_order_relaxed);
+  all_rings().push_back(created);
+  return created;
+}
+
+/**
+ * Hands the thread's ring to dead_rings when the thread finishes
+ */
+struct ring_lease {
+  std::shared_ptr<trace_ring> ring = claim_ring();
+
+  ~ring_lease() {
+    std::lock_guard lk(rings_mtx);
+    dead_rings().push_back(this->ring);
+  }
+};
+
+static trace_ring&
+local_ring() {
+  thread_local ring_lease lease;
+  return *(lease.ring);
+}
+
+void
+trace::record(const char* name, uint64_t start_ns, uint64_t dur_ns, int64_t arg) {
+  trace_ring& ring = local_ring();
+  uint64_t i = ring.head.load(std::memory_order_relaxed);
+  trace_event& event = ring.events[i % TRACE_RING];
+  event.name.store(name, std::memory_order_relaxed);
+  event.start_ns.store(start_ns, std::memory_order_relaxed);
+  event.dur_ns.store(dur_ns, std::memory_order_relaxed);
+  event.arg.store(arg, std::memory_order_relaxed);
+  ring.head.store(i + 1, std::memory_order_release);
+}
+
+std::string
+trace::chrome_json() {
+  std::vector<std::shared_ptr<trace_ring>> rings;
+  {
+    std::lock_guard lk(rings_mtx);
+    rings = all_rings();
+  }
+
+  nlohmann::json events = nlohmann::json::array();
+  long pid = getpid();
+  for (const auto& ring : rings) {
+    long tid = ring->tid.load(std::memory_order_relaxed);
+    uint64_t end = ring->head.load(std::memory_order_acquire);
+    uint64_t begin = std::max(ring->cleared.load(std::memory_order_relaxed), end > TRACE_RING ? end - TRACE_RING : 0);
+
+    std::vector<nlohmann::json> copied;
+    for (uint64_t i = begin; i < end; i++) {
+      const trace_event& event = ring->events[i % TRACE_RING];
+      nlohmann::json out = {
+        {"name", event.name.load(std::memory_order_relaxed)},
+        {"ph", "X"},
+        {"ts", event.start_ns.load(std::memory_order_relaxed) / 1000.0},
+        {"dur", event.dur_ns.load(std::memory_order_relaxed) / 1000.0},
+        {"pid", pid},
+        {"tid", tid}
+      };
+      int64_t arg = event.arg.load(std::memory_order_relaxed);
+      if (arg >= 0) out["args"] = {{"n", arg}};
+      copied.push_back(out);
+    }
+
+    // the owner kept recording while we copied; anything it lapped (or is lapping) may be a mix of two spans
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t lapped = ring->head.load(std::memory_order_relaxed);
+    uint64_t first_intact = lapped + 1 > TRACE_RING ? lapped + 1 - TRACE_RING : 0;
+    for (uint64_t i = begin; i < end; i++) {
+      if (i >= first_intact) events.push_back(std::move(copied[i - begin]));
+    }
+    ring->flushed.store(std::max(ring->flushed.load(std::memory_order_relaxed), end), std::memory_order_relaxed);
+  }
+
+  return nlohmann::json({{"traceEvents", events}, {"displayTimeUnit", "ns"}}).dump();
+}
+
+void
+trace::write_chrome(std::string path) {
+  std::ofstream out(path, std::ios::trunc);
+  out << chrome_json();
+  if (!out) throw std::runtime_error("can't write trace to " + path);
+}
+
+void
+trace::clear() {
+  std::lock_guard lk(rings_mtx);
+  for (const auto& ring : all_rings()) ring->cleared.store(ring->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+}
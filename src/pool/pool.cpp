@@ -0,0 +1,102 @@
+#include "../../inc/pool.hpp"
+
+#include <atomic>
+#include <memory>
+#include <exception>
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t workers) {
+  if (workers == 0) workers = 1; // hardware_concurrency is allowed to return 0
+  for (size_t i = 0; i < workers; i++) (this->workers).emplace_back(&ThreadPool::work, this);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard lk(this->tasks_mtx);
+    this->stopping = true;
+  }
+  (this->tasks_cv).notify_all();
+  for (auto& worker : this->workers) worker.join();
+}
+
+size_t
+ThreadPool::size() const {
+  return (this->workers).size();
+}
+
+void
+ThreadPool::submit(std::function<void()> task) {
+  {
+    std::lock_guard lk(this->tasks_mtx);
+    (this->tasks).push(task);
+  }
+  (this->tasks_cv).notify_one();
+}
+
+void
+ThreadPool::work() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock lk(this->tasks_mtx);
+      (this->tasks_cv).wait(lk, [this] { return this->stopping || !(this->tasks).empty(); });
+      if ((this->tasks).empty()) return; // only reachable while stopping
+      task = (this->tasks).front();
+      (this->tasks).pop();
+    }
+    // an escaping exception would terminate the process; tasks that care about errors catch their own
+    try {
+      task();
+    } catch (...) {}
+  }
+}
+
+void
+ThreadPool::parallel_for(size_t count, std::function<void(size_t)> fn) {
+  if (count == 0) return;
+
+  // contiguous chunks keep per-thread state (keys, buffers) hot; a few per worker smooths out uneven items
+  size_t chunk_count = std::min(count, size() * 4);
+  size_t chunk_len = (count + chunk_count - 1) / chunk_count;
+  chunk_count = (count + chunk_len - 1) / chunk_len;
+
+  struct shared_state {
+    std::atomic<size_t> next_chunk = 0;
+    size_t done_chunks = 0;
+    std::exception_ptr error;
+    std::mutex mtx;
+    std::condition_variable cv;
+  };
+  auto state = std::make_shared<shared_state>();
+
+  auto run_chunks = [state, fn, count, chunk_len, chunk_count]() {
+    size_t chunk;
+    while ((chunk = (state->next_chunk)++) < chunk_count) {
+      std::exception_ptr error;
+      try {
+        size_t end = std::min(count, (chunk + 1) * chunk_len);
+        for (size_t i = chunk * chunk_len; i < end; i++) fn(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      std::lock_guard lk(state->mtx);
+      if (error && !state->error) state->error = error;
+      if (++(state->done_chunks) == chunk_count) (state->cv).notify_all();
+    }
+  };
+
+  size_t helpers = std::min(size(), chunk_count - 1);
+  for (size_t i = 0; i < helpers; i++) submit(run_chunks);
+  run_chunks();
+
+  std::unique_lock lk(state->mtx);
+  (state->cv).wait(lk, [&state, chunk_count] { return state->done_chunks == chunk_count; });
+  if (state->error) std::rethrow_exception(state->error);
+}
+
+ThreadPool&
+ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
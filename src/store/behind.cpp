@@ -0,0 +1,111 @@
+#include "../../inc/store.hpp"
+
+WriteBehind::WriteBehind(
+    BlockStore& store,
+    size_t capacity,
+    std::chrono::milliseconds window,
+    Counter* failures
+  ) : store(store), capacity(capacity), window(window), failure_count(failures) {
+  if (capacity == 0) throw std::runtime_error("write-behind queue needs a capacity");
+  this->committer = std::thread(&WriteBehind::run, this);
+}
+
+WriteBehind::~WriteBehind() {
+  {
+    std::lock_guard lk(this->queue_mtx);
+    this->stopping = true;
+  }
+  (this->work_cv).notify_all();
+  (this->space_cv).notify_all();
+  this->committer.join();
+}
+
+void
+WriteBehind::put(block to_put) {
+  std::unique_lock lk(this->queue_mtx);
+  if ((this->queue).size() >= this->capacity) {
+    this->stalls++;
+    (this->space_cv).wait(lk, [this] {return (this->queue).size() < this->capacity || this->stopping;});
+  }
+  (this->queue).push_back(std::move(to_put));
+  this->queued++;
+  if ((this->queue).size() == 1 || (this->queue).size() >= this->capacity) (this->work_cv).notify_one();
+}
+
+std::shared_future<void>
+WriteBehind::barrier() {
+  std::promise<void> done;
+  std::shared_future<void> out = done.get_future().share();
+
+  std::lock_guard lk(this->queue_mtx);
+  if (this->failure) done.set_exception(this->failure);
+  else if (this->committed == this->queued) done.set_value();
+  else {
+    (this->waiters).push_back({this->queued, std::move(done)});
+    (this->work_cv).notify_one(); // someone is waiting, so don't sit out the window
+  }
+  return out;
+}
+
+write_behind_stats
+WriteBehind::stats() {
+  std::lock_guard lk(this->queue_mtx);
+  return {(this->queue).size(), this->committed, this->batches, this->stalls, this->failures, (bool) this->failure};
+}
+
+void
+WriteBehind::run() {
+  std::unique_lock lk(this->queue_mtx);
+  std::chrono::milliseconds backoff(WRITE_BEHIND_BACKOFF_MS);
+  while (true) {
+    (this->work_cv).wait(lk, [this] {return this->stopping || !(this->queue).empty();});
+    if ((this->queue).empty()) return; // stopping, and nothing left to commit
+
+    // let the batch grow for one window, unless it's full or someone needs it now
+    if (!this->stopping) {
+      (this->work_cv).wait_for(lk, this->window, [this] {
+        return this->stopping || !(this->waiters).empty() || (this->queue).size() >= this->capacity;
+      });
+    }
+
+    std::vector<block> batch;
+    batch.swap(this->queue);
+    (this->space_cv).notify_all();
+    lk.unlock();
+
+    std::exception_ptr batch_failure;
+    try {
+      (this->store).put_batch(batch);
+      (this->store).sync();
+    } catch (...) {
+      batch_failure = std::current_exception();
+    }
+
+    lk.lock();
+    if (batch_failure) {
+      this->failure = batch_failure;
+      this->failures++;
+      if (this->failure_count) (this->failure_count)->inc();
+      // nobody waits on a store that may stay broken; later barriers fail at once until a commit goes through
+      for (auto& [until, waiter] : this->waiters) waiter.set_exception(batch_failure);
+      (this->waiters).clear();
+      // when shutting down, that was the last try; the blocks are lost the way unflushed blocks are in a crash
+      if (this->stopping) return;
+
+      // retry the batch ahead of anything queued since; puts and syncs are idempotent
+      (this->queue).insert((this->queue).begin(), std::make_move_iterator(batch.begin()), std::make_move_iterator(batch.end()));
+      (this->work_cv).wait_for(lk, backoff, [this] {return this->stopping;});
+      backoff = std::min(backoff * 2, std::chrono::milliseconds(WRITE_BEHIND_BACKOFF_MAX_MS));
+      continue;
+    }
+
+    this->failure = nullptr;
+    backoff = std::chrono::milliseconds(WRITE_BEHIND_BACKOFF_MS);
+    this->committed += batch.size();
+    this->batches++;
+    while (!(this->waiters).empty() && (this->waiters).front().first <= this->committed) {
+      (this->waiters).front().second.set_value();
+      (this->waiters).pop_front();
+    }
+  }
+}
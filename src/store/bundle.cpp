@@ -0,0 +1,224 @@
+#include "../../inc/bundle.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef CONCORD_ZSTD
+#include <zstd.h>
+#endif
+
+/**
+ * bundle layout, little-endian:
+ * magic (4) | version (4) | flags (4)
+ * | frames: record count (4) | raw length (4) | stored length (4) | CRC32C of stored (4) | CRC32C of the header before it (4)
+ *   | stored (records, zstd compressed if flagged)
+ * | end marker: a frame header of zero count and lengths
+ * records: packed length (4) | packed block
+ */
+static const char BUNDLE_MAGIC[4] = {'C', 'B', 'D', 'L'};
+static const uint32_t BUNDLE_VERSION = 1;
+static const size_t BUNDLE_FRAME_HEADER = 20;
+static const uint32_t BUNDLE_F_ZSTD = 0x01;
+static const int BUNDLE_ZSTD_LEVEL = 3;
+
+static void
+put_le(std::string& out, uint64_t value, int width) {
+  for (int i = 0; i < width; i++) out += (char) (value >> (8 * i));
+}
+
+static uint32_t
+get_le(std::string_view in, size_t pos) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) value |= (uint32_t) (unsigned char) in[pos + i] << (8 * i);
+  return value;
+}
+
+BundleWriter::BundleWriter(std::string path, bool compress) : path(path), tmp_path(path + ".tmp"), compress(compress) {
+#ifndef CONCORD_ZSTD
+  if (compress) throw std::runtime_error("bundle compression needs zstd");
+#endif
+  (this->out).open(this->tmp_path, std::ios::binary | std::ios::trunc);
+  if (!this->out) throw std::runtime_error("can't write bundle " + this->tmp_path);
+
+  std::string header(BUNDLE_MAGIC, 4);
+  put_le(header, BUNDLE_VERSION, 4);
+  put_le(header, compress ? BUNDLE_F_ZSTD : 0, 4);
+  (this->out).write(header.data(), header.size());
+}
+
+BundleWriter::~BundleWriter() {
+  if (this->finished) return;
+  (this->out).close();
+  std::remove((this->tmp_path).c_str());
+}
+
+void
+BundleWriter::put(const block& to_put) {
+  std::string packed = to_put.pack();
+  if (packed.size() > BUNDLE_RECORD_MAX) throw std::runtime_error("block " + to_put.hash + " too large for a bundle");
+  put_le(this->frame, packed.size(), 4);
+  (this->frame).append(packed);
+  this->frame_count++;
+  (this->stats).blocks++;
+  if ((this->frame).size() >= BUNDLE_FRAME) flush_frame();
+}
+
+void
+BundleWriter::flush_frame() {
+  if (this->frame_count == 0) return;
+  uint32_t raw_len = (this->frame).size();
+  std::string stored;
+#ifdef CONCORD_ZSTD
+  if (this->compress) {
+    stored.resize(ZSTD_compressBound((this->frame).size()));
+    size_t len = ZSTD_compress(stored.data(), stored.size(), (this->frame).data(), (this->frame).size(), BUNDLE_ZSTD_LEVEL);
+    if (ZSTD_isError(len)) throw std::runtime_error(std::string("bundle compression failed: ") + ZSTD_getErrorName(len));
+    stored.resize(len);
+  } else stored.swap(this->frame);
+#else
+  stored.swap(this->frame);
+#endif
+
+  write_frame(this->frame_count, raw_len, stored);
+  (this->stats).frames++;
+  (this->stats).raw_bytes += raw_len;
+  (this->stats).stored_bytes += stored.size();
+  (this->frame).clear();
+  this->frame_count = 0;
+}
+
+void
+BundleWriter::write_frame(uint32_t count, uint32_t raw_len, std::string_view stored) {
+  std::string header;
+  put_le(header, count, 4);
+  put_le(header, raw_len, 4);
+  put_le(header, stored.size(), 4);
+  put_le(header, gen::crc(stored), 4);
+  put_le(header, gen::crc(header), 4);
+  (this->out).write(header.data(), header.size());
+  (this->out).write(stored.data(), stored.size());
+  if (!this->out) throw std::runtime_error("can't write bundle " + this->tmp_path);
+}
+
+bundle_stats
+BundleWriter::finish() {
+  flush_frame();
+  write_frame(0, 0, std::string_view());
+  (this->out).close();
+  if (!this->out) throw std::runtime_error("can't write bundle " + this->tmp_path);
+
+  // ofstream can't fsync, so sync through a descriptor of our own before the rename makes the bundle visible
+  int fd = open((this->tmp_path).c_str(), O_RDONLY);
+  bool synced = fd >= 0 && fsync(fd) == 0;
+  if (fd >= 0) close(fd);
+  if (!synced) throw std::runtime_error("can't sync bundle " + this->tmp_path + ": " + std::strerror(errno));
+  std::filesystem::rename(this->tmp_path, this->path);
+  std::filesystem::path parent = std::filesystem::path(this->path).parent_path();
+  int dir_fd = open((parent.empty() ? std::string(".") : parent.string()).c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  this->finished = true;
+  return this->stats;
+}
+
+BundleReader::BundleReader(std::string path) : in(path, std::ios::binary) {
+  char header[12];
+  if (!(this->in).read(header, sizeof(header)) || std::string_view(header, 4) != std::string_view(BUNDLE_MAGIC, 4)) {
+    throw std::runtime_error("not a bundle: " + path);
+  }
+  std::string_view fields(header, sizeof(header));
+  if (get_le(fields, 4) != BUNDLE_VERSION) throw std::runtime_error("unsupported bundle version in " + path);
+  this->compressed = get_le(fields, 8) & BUNDLE_F_ZSTD;
+#ifndef CONCORD_ZSTD
+  if (this->compressed) throw std::runtime_error("bundle " + path + " is compressed, which needs zstd");
+#endif
+}
+
+bool
+BundleReader::read_frame() {
+  char header[BUNDLE_FRAME_HEADER];
+  if (!(this->in).read(header, sizeof(header))) throw std::runtime_error("truncated bundle");
+  std::string_view fields(header, sizeof(header));
+  if (gen::crc(fields.substr(0, 16)) != get_le(fields, 16)) throw std::runtime_error("corrupt bundle frame header");
+  uint32_t count = get_le(fields, 0), raw_len = get_le(fields, 4), stored_len = get_le(fields, 8), crc = get_le(fields, 12);
+  if (count == 0) {
+    if (raw_len != 0 || stored_len != 0) throw std::runtime_error("corrupt bundle end marker");
+    this->ended = true;
+    return false;
+  }
+
+  // a writer flushes once a frame reaches BUNDLE_FRAME, so no frame is over by more than one record
+  bool sane = raw_len <= BUNDLE_FRAME + 4 + BUNDLE_RECORD_MAX && count <= raw_len / 4;
+#ifdef CONCORD_ZSTD
+  sane = sane && (this->compressed ? stored_len <= ZSTD_compressBound(raw_len) : stored_len == raw_len);
+#else
+  sane = sane && stored_len == raw_len;
+#endif
+  if (!sane) throw std::runtime_error("corrupt bundle frame header");
+
+  std::string stored(stored_len, '\0');
+  if (!(this->in).read(stored.data(), stored_len)) throw std::runtime_error("truncated bundle");
+  if (gen::crc(stored) != crc) throw std::runtime_error("corrupt bundle frame");
+
+#ifdef CONCORD_ZSTD
+  if (this->compressed) {
+    (this->frame).resize(raw_len);
+    size_t len = ZSTD_decompress((this->frame).data(), raw_len, stored.data(), stored.size());
+    if (ZSTD_isError(len) || len != raw_len) throw std::runtime_error("corrupt compressed bundle frame");
+  } else (this->frame).swap(stored);
+#else
+  (this->frame).swap(stored);
+#endif
+
+  this->pos = 0;
+  this->left = count;
+  (this->stats).frames++;
+  (this->stats).raw_bytes += raw_len;
+  (this->stats).stored_bytes += stored_len;
+  return true;
+}
+
+bool
+BundleReader::next(block& out) {
+  if (this->ended) return false;
+  if (this->left == 0 && !read_frame()) return false;
+
+  if ((this->frame).size() - this->pos < 4) throw std::runtime_error("corrupt bundle record");
+  uint32_t len = get_le(this->frame, this->pos);
+  if ((this->frame).size() - this->pos - 4 < len) throw std::runtime_error("corrupt bundle record");
+  out = block::unpack(std::string_view(this->frame).substr(this->pos + 4, len));
+  this->pos += 4 + len;
+  this->left--;
+  (this->stats).blocks++;
+  return true;
+}
+
+bundle_stats
+export_bundle(Tree& tree, std::string path, bundle_scope scope, bool compress) {
+  BundleWriter writer(path, compress);
+  tree.walk_topological([&writer](const block& visited) {writer.put(visited);}, scope.s_trip, scope.since);
+  return writer.finish();
+}
+
+bundle_stats
+import_bundle(Tree& tree, std::string path, size_t batch) {
+  BundleReader reader(path);
+  std::unordered_set<block> pending;
+  pending.reserve(batch);
+  block next;
+  // pushed here rather than queued: with push_proc running on another thread, queue_batch would only enqueue, and the whole bundle could pile up
+  while (reader.next(next)) {
+    pending.insert(std::move(next));
+    if (pending.size() >= batch) {
+      tree.push_batch(std::move(pending));
+      pending.clear();
+    }
+  }
+  if (!pending.empty()) tree.push_batch(std::move(pending));
+  return reader.get_stats();
+}
@@ -0,0 +1,266 @@
+#include "../../inc/store.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef CONCORD_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+// samples per server before training, the per-sample cap, and the cap on sample bytes across servers
+static const size_t TRAIN_SAMPLES = 1024;
+static const size_t SAMPLE_LEN = 4096;
+static const size_t SAMPLE_BUDGET = 8 << 20;
+
+#ifdef CONCORD_ZSTD
+
+struct ContCodec::dictionary {
+  uint32_t id = 0;
+  ZSTD_CDict* cdict = nullptr;
+  ZSTD_DDict* ddict = nullptr;
+
+  ~dictionary() {
+    ZSTD_freeCDict(this->cdict);
+    ZSTD_freeDDict(this->ddict);
+  }
+};
+
+/**
+ * A decompression context per thread, since decoders run wherever cont is first read
+ */
+static ZSTD_DCtx*
+local_dctx() {
+  thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx*)> dctx(ZSTD_createDCtx(), ZSTD_freeDCtx);
+  return dctx.get();
+}
+
+ContCodec::ContCodec(std::string dir, int level, size_t dict_size) : dir(dir), level(level), dict_size(dict_size) {
+  this->cctx = std::shared_ptr<void>(ZSTD_createCCtx(), [](void* ctx) {ZSTD_freeCCtx((ZSTD_CCtx*) ctx);});
+
+  // dict-<id>.zdict: s_trip length (1) | s_trip | zstd dictionary
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(this->dir, ec)) {
+    std::string name = entry.path().filename().string();
+    if (!name.starts_with("dict-") || !name.ends_with(".zdict")) continue;
+    std::ifstream dict_file(entry.path(), std::ios::binary);
+    std::string raw((std::istreambuf_iterator<char>(dict_file)), std::istreambuf_iterator<char>());
+    if (raw.empty() || raw.size() < 1 + (size_t) (unsigned char) raw[0]) continue;
+    std::string s_trip = raw.substr(1, (unsigned char) raw[0]);
+    std::string_view dict = std::string_view(raw).substr(1 + s_trip.size());
+
+    std::shared_ptr<dictionary> loaded = std::make_shared<dictionary>();
+    loaded->id = ZDICT_getDictID(dict.data(), dict.size());
+    loaded->cdict = ZSTD_createCDict(dict.data(), dict.size(), this->level);
+    loaded->ddict = ZSTD_createDDict(dict.data(), dict.size());
+    if (!loaded->id || !loaded->cdict || !loaded->ddict) continue;
+    (this->by_server)[s_trip] = loaded;
+    (this->by_id)[loaded->id] = loaded;
+  }
+  (this->counters).dictionaries = (this->by_id).size();
+}
+
+ContCodec::~ContCodec() {
+  // the training task holds this
+  std::unique_lock lk(this->codec_mtx);
+  (this->trained_cv).wait(lk, [this] {return !(this->training);});
+}
+
+bool
+ContCodec::compress(const std::string& s_trip, std::string_view cont, uint32_t& dict_id, std::string& out) {
+  std::lock_guard lk(this->codec_mtx);
+  (this->counters).raw_bytes += cont.size();
+
+  std::shared_ptr<dictionary> dict;
+  if ((this->by_server).contains(s_trip)) dict = (this->by_server)[s_trip];
+  else if (!(this->untrainable).contains(s_trip) && s_trip.size() <= 0xFF && this->training != s_trip) sample(s_trip, cont);
+
+  out.resize(ZSTD_compressBound(cont.size()));
+  ZSTD_CCtx* cctx = (ZSTD_CCtx*) (this->cctx).get();
+  size_t len = dict
+    ? ZSTD_compress_usingCDict(cctx, out.data(), out.size(), cont.data(), cont.size(), dict->cdict)
+    : ZSTD_compressCCtx(cctx, out.data(), out.size(), cont.data(), cont.size(), this->level);
+
+  // the record prefix costs 9 bytes; short chat lines often don't win that back without a dictionary
+  if (ZSTD_isError(len) || len + 9 >= cont.size()) {
+    (this->counters).stored_bytes += cont.size();
+    (this->counters).passed++;
+    return false;
+  }
+  out.resize(len);
+  dict_id = dict ? dict->id : 0;
+  (this->counters).stored_bytes += len + 9;
+  (this->counters).compressed++;
+  return true;
+}
+
+void
+ContCodec::sample(const std::string& s_trip, std::string_view cont) {
+  sample_set& server = (this->samples)[s_trip];
+  bool enough = server.samples.size() >= TRAIN_SAMPLES || server.bytes >= 100 * this->dict_size;
+  if (!enough) {
+    server.samples.emplace_back(cont.substr(0, SAMPLE_LEN));
+    server.bytes += server.samples.back().size();
+    server.last = ++(this->sample_clock);
+    (this->counters).sample_bytes += server.samples.back().size();
+    enough = server.samples.size() >= TRAIN_SAMPLES || server.bytes >= 100 * this->dict_size;
+  }
+
+  // over budget: the server furthest from training goes first (the staler of two alike), so the rest still get there; it starts over if it sends more
+  while ((this->counters).sample_bytes > SAMPLE_BUDGET) {
+    auto victim = (this->samples).end();
+    for (auto it = (this->samples).begin(); it != (this->samples).end(); it++) {
+      if (it->first == s_trip) continue;
+      if (victim == (this->samples).end() || std::pair(it->second.bytes, it->second.last) < std::pair(victim->second.bytes, victim->second.last)) victim = it;
+    }
+    if (victim == (this->samples).end()) break;
+    (this->counters).sample_bytes -= victim->second.bytes;
+    (this->samples).erase(victim);
+  }
+
+  // one training at a time; a server that's ready meanwhile waits, holding its samples, and starts on its next block after
+  if (!enough || this->training) return;
+  std::vector<std::string> taken = std::move((this->samples)[s_trip].samples);
+  (this->counters).sample_bytes -= (this->samples)[s_trip].bytes;
+  (this->samples).erase(s_trip);
+  this->training = s_trip;
+  ThreadPool::shared().submit([this, s_trip, taken = std::move(taken)]() mutable {train(s_trip, std::move(taken));});
+}
+
+void
+ContCodec::train(const std::string& s_trip, std::vector<std::string> taken) {
+  std::shared_ptr<dictionary> trained;
+  bool trainable = true;
+  try {
+    std::string joined;
+    std::vector<size_t> sizes;
+    for (const auto& sample : taken) {
+      joined += sample;
+      sizes.push_back(sample.size());
+    }
+    taken.clear();
+
+    std::string dict(this->dict_size, '\0');
+    size_t len = ZDICT_trainFromBuffer(dict.data(), dict.size(), joined.data(), sizes.data(), sizes.size());
+    uint32_t id = ZDICT_isError(len) ? 0 : ZDICT_getDictID(dict.data(), len);
+    if (id) {
+      // only this task installs dictionaries, so an id free now is still free once the file is written
+      std::lock_guard lk(this->codec_mtx);
+      if ((this->by_id).contains(id)) id = 0;
+    }
+    if (!id) trainable = false; // too little (or too samey) data; plain zstd it is
+    else {
+      dict.resize(len);
+
+      // on disk before any record that needs it
+      std::string path = (this->dir) + "dict-" + std::to_string(id) + ".zdict";
+      std::string tmp_path = path + ".tmp";
+      std::string file_data = std::string(1, (char) s_trip.size()) + s_trip + dict;
+      int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0) throw std::runtime_error("can't write dictionary " + tmp_path);
+      bool written = write(fd, file_data.data(), file_data.size()) == (ssize_t) file_data.size() && fsync(fd) == 0;
+      close(fd);
+      if (!written) throw std::runtime_error("can't write dictionary " + tmp_path + ": " + std::strerror(errno));
+      std::filesystem::rename(tmp_path, path);
+      int dir_fd = open((this->dir).c_str(), O_RDONLY | O_DIRECTORY);
+      if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+      }
+
+      trained = std::make_shared<dictionary>();
+      trained->id = id;
+      trained->cdict = ZSTD_createCDict(dict.data(), dict.size(), this->level);
+      trained->ddict = ZSTD_createDDict(dict.data(), dict.size());
+    }
+  } catch (...) {
+    // a dictionary that didn't reach the disk is never used; the server samples again, and the next try may find room
+    trained.reset();
+  }
+
+  std::lock_guard lk(this->codec_mtx);
+  if (trained) {
+    (this->by_server)[s_trip] = trained;
+    (this->by_id)[trained->id] = trained;
+    (this->counters).dictionaries = (this->by_id).size();
+  } else if (!trainable) (this->untrainable).insert(s_trip);
+  this->training.reset();
+  (this->trained_cv).notify_all();
+}
+
+std::function<std::string(std::string_view)>
+ContCodec::decoder(uint32_t dict_id, uint32_t raw_len) {
+  std::shared_ptr<dictionary> dict;
+  if (dict_id) {
+    std::lock_guard lk(this->codec_mtx);
+    if (!(this->by_id).contains(dict_id)) {
+      return [dict_id](std::string_view) -> std::string {
+        throw std::runtime_error("missing dictionary " + std::to_string(dict_id));
+      };
+    }
+    dict = (this->by_id)[dict_id];
+  }
+
+  // holds the dictionary, so blocks can outlive the store that read them
+  return [dict, raw_len](std::string_view compressed) {
+    std::string out(raw_len, '\0');
+    size_t len = dict
+      ? ZSTD_decompress_usingDDict(local_dctx(), out.data(), out.size(), compressed.data(), compressed.size(), dict->ddict)
+      : ZSTD_decompressDCtx(local_dctx(), out.data(), out.size(), compressed.data(), compressed.size());
+    if (ZSTD_isError(len) || len != raw_len) throw std::runtime_error("corrupt compressed block content");
+    return out;
+  };
+}
+
+bool
+ContCodec::available() {
+  return true;
+}
+
+#else
+
+struct ContCodec::dictionary {};
+
+ContCodec::ContCodec(std::string dir, int level, size_t dict_size) : dir(dir), level(level), dict_size(dict_size) {}
+
+ContCodec::~ContCodec() {}
+
+bool
+ContCodec::compress(const std::string& s_trip, std::string_view cont, uint32_t& dict_id, std::string& out) {
+  std::lock_guard lk(this->codec_mtx);
+  (this->counters).raw_bytes += cont.size();
+  (this->counters).stored_bytes += cont.size();
+  (this->counters).passed++;
+  return false;
+}
+
+void
+ContCodec::sample(const std::string& s_trip, std::string_view cont) {}
+
+void
+ContCodec::train(const std::string& s_trip, std::vector<std::string> taken) {}
+
+std::function<std::string(std::string_view)>
+ContCodec::decoder(uint32_t dict_id, uint32_t raw_len) {
+  return [](std::string_view) -> std::string {
+    throw std::runtime_error("compressed block content, but built without zstd");
+  };
+}
+
+bool
+ContCodec::available() {
+  return false;
+}
+
+#endif
+
+codec_stats
+ContCodec::stats() {
+  std::lock_guard lk(this->codec_mtx);
+  codec_stats out = this->counters;
+  out.ratio = out.stored_bytes ? (double) out.raw_bytes / out.stored_bytes : 1;
+  return out;
+}
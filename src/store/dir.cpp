@@ -0,0 +1,179 @@
+#include "../../inc/store.hpp"
+
+#include <filesystem>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <fcntl.h>
+#include <unistd.h>
+
+DirStore::DirStore(std::string dir, IOEngine& engine) : dir(dir), engine(engine) {
+  if ((this->dir).back() != '/') this->dir += "/";
+}
+
+void
+DirStore::put(const block& to_put) {
+  put_batch({to_put});
+}
+
+void
+DirStore::put_batch(const std::vector<block>& to_put) {
+  std::vector<io_file> files(to_put.size());
+  for (size_t i = 0; i < to_put.size(); i++) {
+    files[i].path = (this->dir) + to_put[i].hash + ".block";
+    files[i].data = to_put[i].dump();
+  }
+  (this->engine).write(files);
+
+  std::lock_guard lk(this->store_mtx);
+  for (const auto& file : files) {
+    if (!file.ok) throw std::runtime_error("can't write " + file.path);
+    (this->unsynced).insert(file.path);
+  }
+}
+
+void
+DirStore::sync() {
+  std::vector<io_file> to_sync;
+  {
+    std::lock_guard lk(this->store_mtx);
+    for (const auto& path : this->unsynced) to_sync.push_back({path});
+    (this->unsynced).clear();
+  }
+  if (to_sync.empty()) return;
+
+  // failures are files removed since, with nothing left to keep
+  (this->engine).sync(to_sync);
+  // new directory entries need the directory itself synced
+  int dir_fd = open((this->dir).c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+}
+
+bool
+DirStore::contains(const std::string& hash) {
+  return std::filesystem::exists((this->dir) + hash + ".block");
+}
+
+std::unordered_set<block>
+DirStore::load(std::function<void(load_progress)> progress) {
+  std::filesystem::path p(this->dir);
+
+  // files per pool task; big enough to amortize the hand-off, small enough to spread evenly
+  const size_t chunk_len = 256;
+  const std::chrono::milliseconds report_every(250);
+
+  ThreadPool& pool = ThreadPool::shared();
+  std::unordered_set<block> loaded_blocks;
+  std::mutex loaded_mtx;
+  std::condition_variable loaded_cv;
+  size_t found = 0, loaded = 0, skipped = 0, pending_chunks = 0;
+  bool enumerated = false;
+  std::exception_ptr first_error; /**< First failure of the enumeration or a chunk, rethrown once every chunk is done */
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::time_point last_report = start;
+
+  // takes loaded_mtx itself, callers must not hold it
+  auto report = [&]() {
+    if (!progress) return;
+    load_progress state;
+    {
+      std::lock_guard lk(loaded_mtx);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      state = {found, loaded, skipped, enumerated, elapsed.count() > 0 ? loaded / elapsed.count() : 0};
+    }
+    progress(state);
+    last_report = std::chrono::steady_clock::now();
+  };
+
+  auto read_chunk = [&](std::vector<io_file> files) {
+    // the chunk counts as done however it ends, or load would wait on it forever
+    struct chunk_done {
+      std::mutex& mtx;
+      std::condition_variable& cv;
+      size_t& pending;
+      ~chunk_done() {
+        std::lock_guard lk(mtx);
+        pending--;
+        cv.notify_all();
+      }
+    } done{loaded_mtx, loaded_cv, pending_chunks};
+
+    try {
+      std::vector<block> parsed;
+      size_t bad = 0;
+      (this->engine).read(files);
+      for (const auto& file : files) {
+        if (!file.ok) {
+          bad++;
+          continue;
+        }
+        try {
+          parsed.push_back(block(json::parse(file.data)));
+        } catch (const json::exception&) {
+          bad++; // partial write or foreign file
+        }
+      }
+
+      std::lock_guard lk(loaded_mtx);
+      for (auto& parsed_block : parsed) loaded_blocks.insert(std::move(parsed_block));
+      loaded += files.size() - bad;
+      skipped += bad;
+    } catch (...) {
+      std::lock_guard lk(loaded_mtx);
+      if (!first_error) first_error = std::current_exception();
+    }
+  };
+
+  auto dispatch = [&](std::vector<io_file>& files) {
+    if (files.empty()) return;
+    {
+      std::lock_guard lk(loaded_mtx);
+      found += files.size();
+      pending_chunks++;
+    }
+    try {
+      pool.submit([&read_chunk, files]() { read_chunk(files); });
+    } catch (...) {
+      std::lock_guard lk(loaded_mtx);
+      pending_chunks--;
+      throw;
+    }
+    files.clear();
+  };
+
+  // enumerate while the pool reads and parses; on failure, still wait out the chunks already queued, as they point into this frame
+  try {
+    std::vector<io_file> chunk;
+    for(auto& entry : std::filesystem::directory_iterator(p)) {
+      std::string path_str = entry.path().string();
+      if (!path_str.ends_with(".block")) continue; // only want .block files
+      chunk.push_back({path_str});
+      if (chunk.size() < chunk_len) continue;
+      dispatch(chunk);
+      if (std::chrono::steady_clock::now() - last_report >= report_every) report();
+    }
+    dispatch(chunk);
+  } catch (...) {
+    std::lock_guard lk(loaded_mtx);
+    if (!first_error) first_error = std::current_exception();
+  }
+
+  {
+    std::unique_lock lk(loaded_mtx);
+    enumerated = true;
+    while (pending_chunks > 0) {
+      loaded_cv.wait_for(lk, report_every, [&] { return pending_chunks == 0; });
+      if (pending_chunks == 0) break;
+      lk.unlock();
+      report();
+      lk.lock();
+    }
+  }
+  if (first_error) std::rethrow_exception(first_error);
+  report();
+
+  return loaded_blocks;
+}
@@ -0,0 +1,88 @@
+#include "../../inc/ioengine.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static bool
+read_file(io_file& file) {
+  int fd = open(file.path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return false;
+  }
+  file.data.resize(st.st_size);
+  size_t done = 0;
+  while (done < file.data.size()) {
+    ssize_t n = pread(fd, file.data.data() + done, file.data.size() - done, done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  file.data.resize(done);
+  return done == (size_t) st.st_size;
+}
+
+static bool
+write_file(const io_file& file) {
+  int fd = open(file.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  size_t done = 0;
+  while (done < file.data.size()) {
+    ssize_t n = write(fd, file.data.data() + done, file.data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    done += n;
+  }
+  close(fd);
+  return done == file.data.size();
+}
+
+static bool
+sync_file(const io_file& file) {
+  int fd = open(file.path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  bool ok = fsync(fd) == 0;
+  close(fd);
+  return ok;
+}
+
+PoolEngine::PoolEngine(ThreadPool& pool) : pool(pool) {}
+
+void
+PoolEngine::read(std::vector<io_file>& files) {
+  (this->pool).parallel_for(files.size(), [&files](size_t i) { files[i].ok = read_file(files[i]); });
+}
+
+void
+PoolEngine::write(std::vector<io_file>& files) {
+  (this->pool).parallel_for(files.size(), [&files](size_t i) { files[i].ok = write_file(files[i]); });
+}
+
+void
+PoolEngine::sync(std::vector<io_file>& files) {
+  (this->pool).parallel_for(files.size(), [&files](size_t i) { files[i].ok = sync_file(files[i]); });
+}
+
+std::string
+PoolEngine::name() const {
+  return "pool";
+}
+
+IOEngine&
+IOEngine::shared() {
+#ifdef CONCORD_URING
+  // io_uring can be compiled in but refused at runtime (old kernels, seccomp, io_uring_disabled)
+  static bool use_uring = UringEngine::available();
+  if (use_uring) {
+    static UringEngine engine;
+    return engine;
+  }
+#endif
+  static PoolEngine engine;
+  return engine;
+}
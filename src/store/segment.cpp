@@ -0,0 +1,612 @@
+#include "../../inc/store.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <map>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+// record frame: payload length (4) | CRC32C of payload (4) | payload
+static const size_t FRAME_HEADERLEN = 8;
+// top bit of the frame length: payload is codec (1) | dictionary id (4) | raw cont length (4) | pack() with cont compressed
+static const uint32_t FRAME_COMPRESSED = 0x80000000;
+// next bit: payload starts with a CRC32C (4) of everything after it but cont, so headers can be trusted without reading cont
+static const uint32_t FRAME_HEADER_CRC = 0x40000000;
+static const uint32_t FRAME_FLAGS = FRAME_COMPRESSED | FRAME_HEADER_CRC;
+static const size_t RECORD_PREFIXLEN = 9;
+static const char CODEC_ZSTD = 1;
+// index entry: hash (64, hex sha256) | segment (4) | offset (8) | length (4) | CRC32C of the preceding bytes (4)
+static const size_t INDEX_HASHLEN = 64;
+static const size_t INDEX_ENTRYLEN = INDEX_HASHLEN + 4 + 8 + 4 + 4;
+
+static void
+put_le(std::string& out, uint64_t value, int width) {
+  for (int i = 0; i < width; i++) out += (char) (value >> (8 * i));
+}
+
+static uint64_t
+get_le(const char* in, int width) {
+  uint64_t value = 0;
+  for (int i = 0; i < width; i++) value |= (uint64_t) (unsigned char) in[i] << (8 * i);
+  return value;
+}
+
+static void
+write_all(int fd, const std::string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) throw std::runtime_error(std::string("segment store write failed: ") + std::strerror(errno));
+    done += n;
+  }
+}
+
+static bool
+read_at(int fd, char* buf, size_t len, uint64_t offset) {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = pread(fd, buf + done, len - done, offset + done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+// one link of a digest chain, as in the index and record digests
+static uint32_t
+chain_crc(uint32_t prev, uint32_t next) {
+  std::string link;
+  put_le(link, prev, 4);
+  put_le(link, next, 4);
+  return gen::crc(link);
+}
+
+static void
+sync_dir(const std::string& dir) {
+  int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if (dir_fd < 0) return;
+  fsync(dir_fd);
+  close(dir_fd);
+}
+
+SegmentStore::SegmentStore(std::string dir, uint64_t segment_limit, bool compress) : dir(dir), segment_limit(segment_limit), compress(compress) {
+  if ((this->dir).back() != '/') this->dir += "/";
+  if (compress && !ContCodec::available()) throw std::runtime_error("segment store compression needs zstd");
+  std::filesystem::create_directories(this->dir);
+  this->codec = std::make_unique<ContCodec>(this->dir);
+  recover();
+}
+
+SegmentStore::~SegmentStore() {
+  if (this->segment_fd >= 0) {
+    fsync(this->segment_fd);
+    close(this->segment_fd);
+  }
+  if (this->index_fd >= 0) {
+    fsync(this->index_fd);
+    close(this->index_fd);
+  }
+}
+
+std::string
+SegmentStore::segment_path(uint32_t segment) {
+  std::string num = std::to_string(segment);
+  return (this->dir) + "seg-" + std::string(num.size() < 8 ? 8 - num.size() : 0, '0') + num + ".log";
+}
+
+void
+SegmentStore::open_active(uint32_t segment) {
+  if (this->segment_fd >= 0) {
+    // a finished segment never changes again, so settle it before moving on
+    fsync(this->segment_fd);
+    close(this->segment_fd);
+  }
+
+  std::string path = segment_path(segment);
+  bool fresh = !std::filesystem::exists(path);
+  this->segment_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (this->segment_fd < 0) throw std::runtime_error("segment store can't open " + path + ": " + std::strerror(errno));
+  if (fresh) sync_dir(this->dir);
+
+  this->active_segment = segment;
+  this->active_size = std::filesystem::file_size(path);
+}
+
+void
+SegmentStore::index_put(const std::string& hash, segment_loc loc) {
+  std::string entry = hash;
+  put_le(entry, loc.segment, 4);
+  put_le(entry, loc.offset, 8);
+  put_le(entry, loc.len, 4);
+  uint32_t entry_crc = gen::crc(entry);
+  put_le(entry, entry_crc, 4);
+  write_all(this->index_fd, entry);
+  (this->index)[hash] = loc;
+  index_chain(entry_crc);
+}
+
+void
+SegmentStore::index_chain(uint32_t entry_crc) {
+  (this->index_digests).push_back(chain_crc((this->index_digests).empty() ? 0 : (this->index_digests).back(), entry_crc));
+}
+
+void
+SegmentStore::digest_records(const std::vector<std::vector<uint32_t>>& segment_crcs) {
+  std::lock_guard lk(this->store_mtx);
+  (this->record_digests).clear();
+  uint32_t digest = 0;
+  for (const auto& crcs : segment_crcs) {
+    for (uint32_t crc : crcs) {
+      digest = chain_crc(digest, crc);
+      (this->record_digests).push_back(digest);
+    }
+  }
+  this->records_digested = true;
+}
+
+void
+SegmentStore::recover() {
+  std::lock_guard lk(this->store_mtx);
+  std::string index_path = (this->dir) + "index.log";
+
+  // 1. index entries, up to the first torn or corrupt one
+  std::string raw_index;
+  {
+    std::ifstream index_file(index_path, std::ios::binary);
+    if (index_file) raw_index.assign(std::istreambuf_iterator<char>(index_file), std::istreambuf_iterator<char>());
+  }
+
+  std::map<uint32_t, uint64_t> segment_sizes;
+  for (const auto& entry : std::filesystem::directory_iterator(this->dir)) {
+    std::string name = entry.path().filename().string();
+    if (!name.starts_with("seg-") || !name.ends_with(".log")) continue;
+    segment_sizes[std::stoul(name.substr(4, name.size() - 8))] = entry.file_size();
+  }
+
+  std::map<uint32_t, uint64_t> indexed_ends; // end of the last indexed record per segment
+  size_t good_len = 0;
+  bool rewrite = false;
+  for (size_t pos = 0; pos + INDEX_ENTRYLEN <= raw_index.size(); pos += INDEX_ENTRYLEN) {
+    std::string_view entry(raw_index.data() + pos, INDEX_ENTRYLEN);
+    if (get_le(entry.data() + INDEX_ENTRYLEN - 4, 4) != gen::crc(entry.substr(0, INDEX_ENTRYLEN - 4))) break;
+    good_len = pos + INDEX_ENTRYLEN;
+
+    segment_loc loc;
+    loc.segment = get_le(entry.data() + INDEX_HASHLEN, 4);
+    loc.offset = get_le(entry.data() + INDEX_HASHLEN + 4, 8);
+    loc.len = get_le(entry.data() + INDEX_HASHLEN + 12, 4);
+    uint64_t end = loc.offset + FRAME_HEADERLEN + loc.len;
+
+    // the index can reach disk before the segment does; those entries point past the end
+    if (!segment_sizes.contains(loc.segment) || end > segment_sizes[loc.segment]) {
+      rewrite = true;
+      continue;
+    }
+    (this->index)[std::string(entry.substr(0, INDEX_HASHLEN))] = loc;
+    index_chain(get_le(entry.data() + INDEX_ENTRYLEN - 4, 4));
+    indexed_ends[loc.segment] = std::max(indexed_ends[loc.segment], end);
+  }
+  if (good_len != raw_index.size()) rewrite = true;
+
+  if (rewrite) {
+    // rebuild from what survived, then swap it in
+    std::string tmp_path = index_path + ".tmp";
+    this->index_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (this->index_fd < 0) throw std::runtime_error("segment store can't rebuild " + index_path);
+    std::unordered_map<std::string, segment_loc> kept;
+    kept.swap(this->index);
+    (this->index_digests).clear();
+    for (const auto& [hash, loc] : kept) index_put(hash, loc);
+    fsync(this->index_fd);
+    close(this->index_fd);
+    std::filesystem::rename(tmp_path, index_path);
+    sync_dir(this->dir);
+  }
+
+  this->index_fd = open(index_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (this->index_fd < 0) throw std::runtime_error("segment store can't open " + index_path);
+
+  // 2. records past the indexed end of each segment: index whole ones, cut the torn tail
+  uint32_t last_indexed = indexed_ends.empty() ? 0 : indexed_ends.rbegin()->first;
+  for (const auto& [segment, size] : segment_sizes) {
+    if (segment < last_indexed) continue;
+    uint64_t offset = indexed_ends.contains(segment) ? indexed_ends[segment] : 0;
+    if (offset >= size) continue;
+
+    std::string path = segment_path(segment);
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) continue;
+    std::string frame(FRAME_HEADERLEN, '\0');
+    std::string payload;
+    while (offset + FRAME_HEADERLEN <= size) {
+      if (!read_at(fd, &frame[0], FRAME_HEADERLEN, offset)) break;
+      uint32_t len = get_le(frame.data(), 4) & ~FRAME_FLAGS;
+      uint32_t flags = get_le(frame.data(), 4) & FRAME_FLAGS;
+      if (offset + FRAME_HEADERLEN + len > size) break;
+      payload.resize(len);
+      if (!read_at(fd, payload.data(), len, offset + FRAME_HEADERLEN)) break;
+      if (get_le(frame.data() + 4, 4) != gen::crc(payload)) break;
+
+      std::string hash;
+      try {
+        hash = decode_record(payload, flags).hash;
+      } catch (const std::runtime_error&) {
+        break;
+      }
+      if (hash.size() == INDEX_HASHLEN && !(this->index).contains(hash)) {
+        index_put(hash, {segment, offset, len});
+      }
+      offset += FRAME_HEADERLEN + len;
+    }
+    close(fd);
+
+    if (offset < size) {
+      std::filesystem::resize_file(path, offset);
+      segment_sizes[segment] = offset;
+    }
+  }
+  fsync(this->index_fd);
+
+  open_active(segment_sizes.empty() ? 0 : segment_sizes.rbegin()->first);
+}
+
+void
+SegmentStore::put(const block& to_put) {
+  if (to_put.hash.size() != INDEX_HASHLEN) throw std::runtime_error("segment store expects hex sha256 block hashes");
+  std::string payload;
+  uint32_t dict_id;
+  std::string compressed_cont;
+  bool compressed = this->compress && (this->codec)->compress(to_put.s_trip, to_put.cont.view(), dict_id, compressed_cont);
+  size_t stored_cont_len = compressed ? compressed_cont.size() : to_put.cont.size();
+  put_le(payload, 0, 4); // header CRC, filled in below
+  if (compressed) {
+    block stored = to_put;
+    put_le(payload, CODEC_ZSTD, 1);
+    put_le(payload, dict_id, 4);
+    put_le(payload, to_put.cont.size(), 4);
+    stored.cont = std::move(compressed_cont);
+    payload += stored.pack();
+  } else payload += to_put.pack();
+  if (payload.size() & FRAME_FLAGS) throw std::runtime_error("block too large for a segment record");
+  uint32_t header_crc = gen::crc(std::string_view(payload).substr(4, payload.size() - 4 - stored_cont_len));
+  for (int i = 0; i < 4; i++) payload[i] = (char) (header_crc >> (8 * i));
+
+  std::string frame;
+  frame.reserve(FRAME_HEADERLEN + payload.size());
+  put_le(frame, payload.size() | FRAME_HEADER_CRC | (compressed ? FRAME_COMPRESSED : 0), 4);
+  put_le(frame, gen::crc(payload), 4);
+  frame += payload;
+
+  std::lock_guard lk(this->store_mtx);
+  if ((this->index).contains(to_put.hash)) return;
+  if (this->active_size > 0 && this->active_size + frame.size() > this->segment_limit) {
+    open_active(this->active_segment + 1);
+  }
+
+  if (this->torn) throw std::runtime_error("segment store has a torn write it couldn't undo; reopen it");
+
+  // record first, index second; recovery re-indexes records the index never saw
+  segment_loc loc = {this->active_segment, this->active_size, (uint32_t) payload.size()};
+  off_t index_end = lseek(this->index_fd, 0, SEEK_END);
+  try {
+    write_all(this->segment_fd, frame);
+    index_put(to_put.hash, loc);
+  } catch (...) {
+    // appends land at the end of file, so a partial write must go, or the next record would sit past where the index says; then a retry is safe
+    this->torn = index_end < 0 || ftruncate(this->segment_fd, loc.offset) != 0 || ftruncate(this->index_fd, index_end) != 0;
+    throw;
+  }
+  this->active_size += frame.size();
+  if (this->records_digested) {
+    (this->record_digests).push_back(chain_crc((this->record_digests).empty() ? 0 : (this->record_digests).back(), get_le(frame.data() + 4, 4)));
+  }
+}
+
+void
+SegmentStore::sync() {
+  std::lock_guard lk(this->store_mtx);
+  if (fsync(this->segment_fd) != 0 || fsync(this->index_fd) != 0) throw std::runtime_error(std::string("segment store sync failed: ") + std::strerror(errno));
+}
+
+bool
+SegmentStore::contains(const std::string& hash) {
+  std::lock_guard lk(this->store_mtx);
+  return (this->index).contains(hash);
+}
+
+block
+SegmentStore::get(const std::string& hash) {
+  segment_loc loc;
+  {
+    std::lock_guard lk(this->store_mtx);
+    loc = (this->index).at(hash);
+  }
+
+  std::string path = segment_path(loc.segment);
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("segment store can't open " + path);
+  std::string frame(FRAME_HEADERLEN + loc.len, '\0');
+  bool ok = read_at(fd, &frame[0], frame.size(), loc.offset);
+  close(fd);
+
+  std::string_view payload(frame.data() + FRAME_HEADERLEN, loc.len);
+  if (!ok || get_le(frame.data() + 4, 4) != gen::crc(payload)) {
+    throw std::runtime_error("segment store record for " + hash + " is corrupt");
+  }
+  return decode_record(payload, get_le(frame.data(), 4) & FRAME_FLAGS);
+}
+
+block
+SegmentStore::decode_record(std::string_view payload, uint32_t flags, std::shared_ptr<const void> owner, std::function<bool()> check) {
+  uint32_t header_crc = 0;
+  if (flags & FRAME_HEADER_CRC) {
+    if (payload.size() < 4) throw std::runtime_error("segment record truncated");
+    header_crc = get_le(payload.data(), 4);
+    payload = payload.substr(4);
+  }
+  // cont is packed last, so the header is everything before it; its length comes from bytes the CRC then covers
+  auto check_header = [&](std::string_view record, size_t cont_len) {
+    if ((flags & FRAME_HEADER_CRC) && gen::crc(record.substr(0, record.size() - cont_len)) != header_crc) {
+      throw std::runtime_error("segment record header is corrupt");
+    }
+  };
+
+  if (!(flags & FRAME_COMPRESSED)) {
+    block out = owner ? block::unpack(payload, owner, check) : block::unpack(payload);
+    check_header(payload, out.cont.size());
+    return out;
+  }
+  if (payload.size() < RECORD_PREFIXLEN || payload[0] != CODEC_ZSTD) throw std::runtime_error("unknown segment record codec");
+  uint32_t dict_id = get_le(payload.data() + 1, 4);
+  uint32_t raw_len = get_le(payload.data() + 5, 4);
+
+  // keep the compressed bytes, not the contents; they're smaller and may never be read
+  // without an owner the payload is the caller's buffer, so cont borrows it only until the compressed bytes alone are copied out below
+  std::shared_ptr<const void> borrowed = owner ? owner : std::shared_ptr<const void>(payload.data(), [](const void*) {});
+  block out = block::unpack(payload.substr(RECORD_PREFIXLEN), borrowed);
+  check_header(payload, out.cont.size());
+  std::string_view compressed_cont = payload.substr(payload.size() - out.cont.size());
+  if (!owner) {
+    std::shared_ptr<std::string> held = std::make_shared<std::string>(compressed_cont);
+    compressed_cont = *held;
+    owner = held;
+  }
+  out.cont = lazy_string::source{owner, compressed_cont, check, (this->codec)->decoder(dict_id, raw_len)};
+  return out;
+}
+
+codec_stats
+SegmentStore::compression() {
+  return (this->codec)->stats();
+}
+
+std::unordered_set<block>
+SegmentStore::load(std::function<void(load_progress)> progress) {
+  std::vector<uint32_t> segments;
+  size_t found;
+  {
+    std::lock_guard lk(this->store_mtx);
+    for (const auto& entry : std::filesystem::directory_iterator(this->dir)) {
+      std::string name = entry.path().filename().string();
+      if (name.starts_with("seg-") && name.ends_with(".log")) segments.push_back(std::stoul(name.substr(4, name.size() - 8)));
+    }
+    found = (this->index).size();
+  }
+  std::sort(segments.begin(), segments.end());
+
+  std::unordered_set<block> loaded_blocks;
+  std::mutex loaded_mtx;
+  size_t loaded = 0, skipped = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // progress is serialized by loaded_mtx, but may run on pool threads
+  auto report = [&](bool enumerated) {
+    if (!progress) return;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    progress({found, loaded, skipped, enumerated, elapsed.count() > 0 ? loaded / elapsed.count() : 0});
+  };
+
+  std::vector<std::vector<uint32_t>> segment_crcs(segments.size());
+  ThreadPool::shared().parallel_for(segments.size(), [&](size_t i) {
+    std::string path = segment_path(segments[i]);
+    std::ifstream segment(path, std::ios::binary);
+    std::error_code size_error;
+    uint64_t left = std::filesystem::file_size(path, size_error);
+    if (size_error) left = 0;
+    std::vector<block> parsed;
+    size_t bad = 0;
+    char frame[FRAME_HEADERLEN];
+    std::string payload;
+    while (left >= FRAME_HEADERLEN && segment.read(frame, FRAME_HEADERLEN)) {
+      uint32_t len = get_le(frame, 4) & ~FRAME_FLAGS;
+      uint32_t flags = get_le(frame, 4) & FRAME_FLAGS;
+      left -= FRAME_HEADERLEN;
+      if (len > left) break; // torn, or a garbled header; recovery owns the repair, and the length isn't trusted for an allocation
+      left -= len;
+      payload.resize(len);
+      if (!segment.read(payload.data(), payload.size())) break;
+      segment_crcs[i].push_back(get_le(frame + 4, 4));
+      if (get_le(frame + 4, 4) != gen::crc(payload)) {
+        bad++;
+        continue;
+      }
+      try {
+        parsed.push_back(decode_record(payload, flags));
+      } catch (const std::runtime_error&) {
+        bad++;
+      }
+    }
+
+    std::lock_guard lk(loaded_mtx);
+    for (auto& parsed_block : parsed) loaded_blocks.insert(std::move(parsed_block));
+    loaded += parsed.size();
+    skipped += bad;
+    report(false);
+  });
+  digest_records(segment_crcs);
+  report(true);
+
+  return loaded_blocks;
+}
+
+// mark: index entries (8) | index digest (4) | records (8) | record digest (4)
+std::string
+SegmentStore::mark() {
+  std::lock_guard lk(this->store_mtx);
+  if (!this->records_digested) return ""; // record CRCs are only known once load has read them
+  std::string out;
+  put_le(out, (this->index_digests).size(), 8);
+  put_le(out, (this->index_digests).empty() ? 0 : (this->index_digests).back(), 4);
+  put_le(out, (this->record_digests).size(), 8);
+  put_le(out, (this->record_digests).empty() ? 0 : (this->record_digests).back(), 4);
+  return out;
+}
+
+bool
+SegmentStore::matches(std::string_view mark) {
+  if (mark.size() != 24) return false;
+  auto chain_matches = [](const std::vector<uint32_t>& digests, uint64_t count, uint32_t digest) {
+    if (count == 0) return digest == 0;
+    return count <= digests.size() && digests[count - 1] == digest;
+  };
+  std::lock_guard lk(this->store_mtx);
+  return this->records_digested
+    && chain_matches(this->index_digests, get_le(mark.data(), 8), get_le(mark.data() + 8, 4))
+    && chain_matches(this->record_digests, get_le(mark.data() + 12, 8), get_le(mark.data() + 20, 4));
+}
+
+size_t
+SegmentStore::import(BlockStore& source, int pow) {
+  std::unordered_set<block> loaded = source.load();
+  std::vector<const block*> candidates;
+  for (const auto& source_block : loaded) {
+    if (!contains(source_block.hash)) candidates.push_back(&source_block);
+  }
+
+  // records are trusted on load from here on (see MappedStore), so nothing unverified may get in
+  std::vector<char> legit(candidates.size());
+  ThreadPool::shared().parallel_for(candidates.size(), [&](size_t i) {
+    legit[i] = candidates[i]->verify(pow, true);
+  });
+
+  size_t imported = 0;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    if (!legit[i]) continue;
+    put(*candidates[i]);
+    imported++;
+  }
+  sync();
+  return imported;
+}
+
+/**
+ * A read-only segment mapping, unmapped with its last reference
+ */
+struct segment_map {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  ~segment_map() {
+    if (this->data) munmap((void*) this->data, this->size);
+  }
+};
+
+static std::shared_ptr<const segment_map>
+map_segment(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return nullptr;
+  struct stat st;
+  std::shared_ptr<segment_map> mapping = std::make_shared<segment_map>();
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr != MAP_FAILED) {
+      mapping->data = (const char*) addr;
+      mapping->size = st.st_size;
+      // headers are scattered between contents; don't fault in whole neighbourhoods for them
+      madvise(addr, st.st_size, MADV_RANDOM);
+    }
+  }
+  close(fd); // the mapping holds its own reference
+  if (!mapping->data) return nullptr;
+  return mapping;
+}
+
+std::unordered_set<block>
+MappedStore::load(std::function<void(load_progress)> progress) {
+  std::vector<uint32_t> segments;
+  size_t found;
+  {
+    std::lock_guard lk(this->store_mtx);
+    for (const auto& entry : std::filesystem::directory_iterator(this->dir)) {
+      std::string name = entry.path().filename().string();
+      if (name.starts_with("seg-") && name.ends_with(".log")) segments.push_back(std::stoul(name.substr(4, name.size() - 8)));
+    }
+    found = (this->index).size();
+  }
+  std::sort(segments.begin(), segments.end());
+
+  std::unordered_set<block> loaded_blocks;
+  std::mutex loaded_mtx;
+  size_t loaded = 0, skipped = 0;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // progress is serialized by loaded_mtx, but may run on pool threads
+  auto report = [&](bool enumerated) {
+    if (!progress) return;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    progress({found, loaded, skipped, enumerated, elapsed.count() > 0 ? loaded / elapsed.count() : 0});
+  };
+
+  std::vector<std::vector<uint32_t>> segment_crcs(segments.size());
+  ThreadPool::shared().parallel_for(segments.size(), [&](size_t i) {
+    std::shared_ptr<const segment_map> mapping = map_segment(segment_path(segments[i]));
+    if (!mapping) return;
+
+    std::vector<block> parsed;
+    size_t bad = 0;
+    uint64_t offset = 0;
+    while (offset + FRAME_HEADERLEN <= mapping->size) {
+      const char* frame = mapping->data + offset;
+      uint32_t len = get_le(frame, 4) & ~FRAME_FLAGS;
+      uint32_t flags = get_le(frame, 4) & FRAME_FLAGS;
+      if (offset + FRAME_HEADERLEN + len > mapping->size) break; // torn; recovery owns the repair
+      uint32_t crc = get_le(frame + 4, 4);
+      std::string_view payload(frame + FRAME_HEADERLEN, len);
+      offset += FRAME_HEADERLEN + len;
+      segment_crcs[i].push_back(crc);
+
+      // headers are trusted from here on (FileTree doesn't rehash mapped blocks), so one without its own CRC gets the whole record checked now
+      std::function<bool()> check = [payload, crc] { return gen::crc(payload) == crc; };
+      if (!(flags & FRAME_HEADER_CRC)) {
+        if (!check()) {
+          bad++;
+          continue;
+        }
+        check = nullptr;
+      }
+      try {
+        parsed.push_back(decode_record(payload, flags, mapping, check));
+      } catch (const std::runtime_error&) {
+        bad++;
+      }
+    }
+
+    std::lock_guard lk(loaded_mtx);
+    for (auto& parsed_block : parsed) loaded_blocks.insert(std::move(parsed_block));
+    loaded += parsed.size();
+    skipped += bad;
+    report(false);
+  });
+  digest_records(segment_crcs);
+  report(true);
+
+  return loaded_blocks;
+}
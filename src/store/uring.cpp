@@ -0,0 +1,196 @@
+#include "../../inc/ioengine.hpp"
+
+#ifdef CONCORD_URING
+
+#include <liburing.h>
+#include <deque>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * One read, write or fsync; reads and writes are resubmitted for their remainder when short
+ */
+struct uring_op {
+  enum kind_t {READ, WRITE, FSYNC};
+  io_file* file;
+  int fd;
+  kind_t kind;
+  size_t done = 0;
+  bool failed = false;
+};
+
+/**
+ * A ring per thread, torn down with the thread
+ */
+struct thread_ring {
+  io_uring ring;
+  unsigned depth = 0;
+
+  /**
+   * Tear the ring down; the next local_ring call sets up a fresh one
+   */
+  void reset() {
+    if (this->depth) io_uring_queue_exit(&(this->ring));
+    this->depth = 0;
+  }
+
+  ~thread_ring() {
+    reset();
+  }
+};
+
+static thread_ring&
+local_ring(unsigned depth) {
+  thread_local thread_ring local;
+  if (!local.depth) {
+    int err = io_uring_queue_init(depth, &local.ring, 0);
+    if (err < 0) throw std::runtime_error("io_uring setup failed: " + std::to_string(-err));
+    local.depth = depth;
+  }
+  return local;
+}
+
+static void
+prep(io_uring_sqe* sqe, uring_op& op) {
+  size_t left = op.file->data.size() - op.done;
+  unsigned len = left > UINT_MAX ? UINT_MAX : left;
+  char* buf = op.file->data.data() + op.done;
+  if (op.kind == uring_op::READ) io_uring_prep_read(sqe, op.fd, buf, len, op.done);
+  else if (op.kind == uring_op::WRITE) io_uring_prep_write(sqe, op.fd, buf, len, op.done);
+  else io_uring_prep_fsync(sqe, op.fd, 0);
+  io_uring_sqe_set_data(sqe, &op);
+}
+
+static void
+run_ops(thread_ring& local, std::vector<uring_op>& ops) {
+  std::deque<uring_op*> pending;
+  for (auto& op : ops) {
+    if (op.failed) continue;
+    if (op.kind == uring_op::FSYNC || op.file->data.size() > 0) pending.push_back(&op);
+  }
+
+  // queued: prepared but not yet taken by the kernel; in_flight: taken, completion outstanding
+  unsigned queued = 0, in_flight = 0;
+  while (!pending.empty() || queued > 0 || in_flight > 0) {
+    // fill the ring, then one syscall to submit everything and wait for at least one completion
+    while (!pending.empty() && queued + in_flight < local.depth) {
+      io_uring_sqe* sqe = io_uring_get_sqe(&local.ring);
+      if (!sqe) break;
+      prep(sqe, *pending.front());
+      pending.pop_front();
+      queued++;
+    }
+    int submitted = io_uring_submit_and_wait(&local.ring, 1);
+    if (submitted >= 0) {
+      queued -= std::min<unsigned>(queued, submitted);
+      in_flight += submitted;
+    } else if (submitted != -EINTR && !((submitted == -EAGAIN || submitted == -EBUSY) && in_flight > 0)) {
+      // the kernel still owns in-flight buffers, which belong to our caller; wait them out before unwinding
+      while (in_flight > 0) {
+        io_uring_cqe* cqe;
+        int err = io_uring_wait_cqe(&local.ring, &cqe);
+        if (err == -EINTR) continue;
+        if (err < 0) break;
+        io_uring_cqe_seen(&local.ring, cqe);
+        in_flight--;
+      }
+      // and never let a later batch submit what's still queued, pointing at ops that are gone
+      local.reset();
+      throw std::runtime_error("io_uring submit failed: " + std::to_string(-submitted));
+    }
+
+    io_uring_cqe* cqe;
+    unsigned head, seen = 0;
+    io_uring_for_each_cqe(&local.ring, head, cqe) {
+      uring_op& op = *(uring_op*) io_uring_cqe_get_data(cqe);
+      seen++;
+      in_flight--;
+      if (cqe->res == -EINTR || cqe->res == -EAGAIN) pending.push_back(&op);
+      else if (cqe->res < 0) op.failed = true;
+      else if (op.kind != uring_op::FSYNC) {
+        if (cqe->res == 0) op.failed = true; // no progress: file shrank or the disk is full
+        else {
+          op.done += cqe->res;
+          if (op.done < op.file->data.size()) pending.push_back(&op);
+        }
+      }
+    }
+    io_uring_cq_advance(&local.ring, seen);
+  }
+}
+
+/**
+ * Open a window of files, run kind over all of them, close them again
+ */
+static void
+run_files(unsigned depth, std::vector<io_file>& files, uring_op::kind_t kind) {
+  thread_ring& local = local_ring(depth);
+  int flags = (kind == uring_op::WRITE) ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+
+  // a window at a time keeps open descriptors bounded
+  for (size_t start = 0; start < files.size(); start += local.depth) {
+    size_t end = std::min(files.size(), start + local.depth);
+    std::vector<uring_op> ops;
+    ops.reserve(end - start);
+    // the window's descriptors are closed however it ends
+    struct window_fds {
+      std::vector<uring_op>& ops;
+      ~window_fds() {
+        for (auto& op : ops) {
+          if (op.fd >= 0) close(op.fd);
+        }
+      }
+    } opened{ops};
+    for (size_t i = start; i < end; i++) {
+      uring_op op = {&files[i], open(files[i].path.c_str(), flags, 0644), kind};
+      op.failed = op.fd < 0;
+      if (!op.failed && kind == uring_op::READ) {
+        struct stat st;
+        if (fstat(op.fd, &st) == 0) files[i].data.resize(st.st_size);
+        else op.failed = true;
+      }
+      ops.push_back(op);
+    }
+
+    run_ops(local, ops);
+
+    for (auto& op : ops) op.file->ok = !op.failed;
+  }
+}
+
+UringEngine::UringEngine(unsigned depth) : depth(depth) {}
+
+void
+UringEngine::read(std::vector<io_file>& files) {
+  run_files(this->depth, files, uring_op::READ);
+}
+
+void
+UringEngine::write(std::vector<io_file>& files) {
+  run_files(this->depth, files, uring_op::WRITE);
+}
+
+void
+UringEngine::sync(std::vector<io_file>& files) {
+  run_files(this->depth, files, uring_op::FSYNC);
+}
+
+std::string
+UringEngine::name() const {
+  return "io_uring";
+}
+
+bool
+UringEngine::available() {
+  io_uring probe;
+  if (io_uring_queue_init(2, &probe, 0) < 0) return false;
+  io_uring_queue_exit(&probe);
+  return true;
+}
+
+#endif
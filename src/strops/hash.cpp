@@ -1,4 +1,5 @@
 #include <cryptopp/sha.h>
+#include <cryptopp/crc.h>
 #include <cryptopp/osrng.h>
 #include <string>
 #include <fstream>
@@ -49,3 +50,12 @@ std::string gen::string(size_t len) {
     std::string nstr(reinterpret_cast<const char*>(&buf[0]), buf.size());
     return nstr;
 }
+
+uint32_t gen::crc(std::string_view data) {
+    CRC32C crc;
+    crc.Update(reinterpret_cast<const byte*>(data.data()), data.size());
+    // CRC32C keeps its register little-endian
+    byte digest[CRC32C::DIGESTSIZE];
+    crc.Final(digest);
+    return (uint32_t) digest[0] | (uint32_t) digest[1] << 8 | (uint32_t) digest[2] << 16 | (uint32_t) digest[3] << 24;
+}
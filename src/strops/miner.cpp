@@ -8,6 +8,7 @@
 #include <iostream>
 
 #include "../../inc/strops.hpp"
+#include "../../inc/trace.hpp"
 
 Miner::Miner(int POW_req) {
     this->pow = POW_req;
@@ -25,6 +26,7 @@ bool Miner::check_valid_hash(std::string hash) {
 
 // genning hash and nonce
 std::array<std::string, 2> Miner::generate_valid_nonce(bool debug_info, std::string content) {
+    TRACE_SPAN("mine", this->pow);
     std::string rhash = hex::encode(gen::hash(false, content)); //hash init
     std::string nonce;
 
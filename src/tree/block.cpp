@@ -1,17 +1,93 @@
 #include "../../inc/tree.hpp"
 #include "../../inc/strops.hpp"
 
+lazy_string::lazy_string() {}
+
+lazy_string::lazy_string(std::string value) : contents(std::move(value)) {}
+
+lazy_string::lazy_string(const char* value) : contents(std::string(value)) {}
+
+lazy_string::lazy_string(source backing) : contents(std::make_shared<state>()) {
+  state& st = *std::get<std::shared_ptr<state>>(this->contents);
+  st.encoded = (bool) backing.decode;
+  st.backing = std::move(backing);
+}
+
+std::string_view
+lazy_string::checked_bytes(state& st) {
+  std::call_once(st.checked, [&st] {
+    if (st.backing.check && !st.backing.check()) throw std::runtime_error("lazy string source failed its check");
+  });
+  return st.backing.bytes;
+}
+
+std::string_view
+lazy_string::view() const {
+  if (const std::string* owned = std::get_if<std::string>(&(this->contents))) return *owned;
+  state& st = *std::get<std::shared_ptr<state>>(this->contents);
+  if (st.encoded) return get();
+  return checked_bytes(st);
+}
+
+const std::string&
+lazy_string::get() const {
+  if (const std::string* owned = std::get_if<std::string>(&(this->contents))) return *owned;
+  state& st = *std::get<std::shared_ptr<state>>(this->contents);
+  std::call_once(st.copied, [&st] {
+    std::string_view bytes = checked_bytes(st);
+    if (st.encoded) {
+      st.value = st.backing.decode(bytes);
+      // encoded bytes are only ever read here, so whatever holds them (e.g. a record copy) can go; bytes stays behind as a size
+      st.backing.owner.reset();
+      st.backing.check = nullptr;
+      st.backing.decode = nullptr;
+    } else st.value.assign(bytes);
+    st.materialized = true;
+  });
+  return st.value;
+}
+
+size_t
+lazy_string::size() const {
+  if (const std::string* owned = std::get_if<std::string>(&(this->contents))) return owned->size();
+  state& st = *std::get<std::shared_ptr<state>>(this->contents);
+  if (st.encoded) return get().size();
+  return st.backing.bytes.size();
+}
+
+bool
+lazy_string::materialized() const {
+  return std::holds_alternative<std::string>(this->contents) || std::get<std::shared_ptr<state>>(this->contents)->materialized;
+}
+
+size_t
+lazy_string::heap_bytes() const {
+  if (const std::string* owned = std::get_if<std::string>(&(this->contents))) return memsize::string(*owned);
+  const state& st = *std::get<std::shared_ptr<state>>(this->contents);
+  // make_shared puts the control block (two counts and a vtable pointer) in the same allocation
+  size_t out = memsize::chunk(sizeof(state) + 16);
+  if (st.materialized) out += memsize::string(st.value);
+  return out;
+}
+
+size_t
+lazy_string::source_bytes() const {
+  return materialized() ? 0 : std::get<std::shared_ptr<state>>(this->contents)->backing.bytes.size();
+}
+
 std::string 
 block::hash_concat() const {
-  std::string concat_data = b64::encode(timeh::to_string(this->time)) + this->s_trip + this->c_trip + this->cont; //b64 timestr encoding is only for safety
+  std::string concat_data = b64::encode(timeh::to_string(this->time)) + this->s_trip + this->c_trip; //b64 timestr encoding is only for safety
+  concat_data += (this->cont).view();
   for (auto ph : order_hashes(this->p_hashes)) concat_data += ph;
   return concat_data;
 }
 
 bool 
-block::verify(int pow) const {
-  std::string result_hash = hex::encode(gen::hash(false, this->hash_concat() + this->nonce));
-  if (result_hash != this->hash) return false;
+block::verify(int pow, bool rehash) const {
+  std::string result_hash = this->hash;
+  if (rehash) result_hash = hex::encode(gen::hash(false, this->hash_concat() + this->nonce));
+  if (result_hash != this->hash || result_hash.size() < (size_t) pow) return false;
   for (int i = 0; i < pow; i++) {
     if (result_hash.at(i) != '0') return false;
   }
@@ -30,7 +106,7 @@ block::jdump() const {
       this->nonce, 
       this->s_trip, 
       this->c_trip, 
-      this->cont, 
+      std::string((this->cont).view()), 
       this->hash
       });
   
@@ -43,8 +119,81 @@ block::dump() const {
   return this->jdump().dump();
 }
 
+/**
+ * pack layout, little-endian:
+ * time (8) | nonce, s_trip, c_trip, hash (1 byte length each) | p_hash count (2) | p_hashes (1 byte length each) | cont (4 byte length)
+ */
+std::string
+block::pack() const {
+  std::string packed;
+  auto put_int = [&packed](unsigned long long value, int width) {
+    for (int i = 0; i < width; i++) packed += (char) (value >> (8 * i));
+  };
+  auto put_short_str = [&packed](const std::string& str) {
+    if (str.size() > 0xFF) throw std::runtime_error("block field too long to pack");
+    packed += (char) str.size();
+    packed += str;
+  };
+
+  packed.reserve(8 + 4 * 65 + 2 + 65 * (this->p_hashes).size() + 4 + (this->cont).size());
+  put_int(this->time, 8);
+  put_short_str(this->nonce);
+  put_short_str(this->s_trip);
+  put_short_str(this->c_trip);
+  put_short_str(this->hash);
+  if ((this->p_hashes).size() > 0xFFFF) throw std::runtime_error("block has too many parents to pack");
+  put_int((this->p_hashes).size(), 2);
+  for (const auto& ph : order_hashes(this->p_hashes)) put_short_str(ph);
+  if ((this->cont).size() > 0xFFFFFFFF) throw std::runtime_error("block content too long to pack");
+  put_int((this->cont).size(), 4);
+  packed += (this->cont).view();
+  return packed;
+}
+
+block
+block::unpack(std::string_view packed) {
+  return unpack(packed, nullptr);
+}
+
+block
+block::unpack(std::string_view packed, std::shared_ptr<const void> owner, std::function<bool()> check) {
+  size_t pos = 0;
+  auto need = [&packed, &pos](size_t len) {
+    if (packed.size() - pos < len) throw std::runtime_error("packed block truncated");
+  };
+  auto get_int = [&](int width) {
+    need(width);
+    unsigned long long value = 0;
+    for (int i = 0; i < width; i++) value |= (unsigned long long) (unsigned char) packed[pos + i] << (8 * i);
+    pos += width;
+    return value;
+  };
+  auto get_str = [&](size_t len) {
+    need(len);
+    std::string str(packed.substr(pos, len));
+    pos += len;
+    return str;
+  };
+
+  block out;
+  out.time = get_int(8);
+  out.nonce = get_str(get_int(1));
+  out.s_trip = get_str(get_int(1));
+  out.c_trip = get_str(get_int(1));
+  out.hash = get_str(get_int(1));
+  size_t p_count = get_int(2);
+  for (size_t i = 0; i < p_count; i++) (out.p_hashes).insert(get_str(get_int(1)));
+  size_t cont_len = get_int(4);
+  need(cont_len);
+  if (owner) out.cont = lazy_string::source{owner, packed.substr(pos, cont_len), check};
+  else out.cont = std::string(packed.substr(pos, cont_len));
+  pos += cont_len;
+  if (pos != packed.size()) throw std::runtime_error("packed block has trailing bytes");
+  return out;
+}
+
 std::string 
-block::trip() {
+block::trip() const {
   return this->hash;
 }
 
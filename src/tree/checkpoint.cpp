@@ -0,0 +1,202 @@
+#include "../../inc/tree.hpp"
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * checkpoint layout, little-endian:
+ * magic (4) | version (4) | pow (4) | store mark (4 byte length)
+ * | node count (4) | nodes (1 byte length hashes) | edge count (8) | edges (child index (4), parent index (4))
+ * | root index (4, all ones if unrooted) | server root count (4) | server roots (1 byte length s_trip, node index (4))
+ * | CRC32C of everything before (4)
+ */
+static const char CHECKPOINT_MAGIC[4] = {'C', 'C', 'K', 'P'};
+static const uint32_t CHECKPOINT_VERSION = 1;
+static const uint32_t CHECKPOINT_NO_ROOT = 0xFFFFFFFF;
+
+static void
+put_le(std::string& out, uint64_t value, int width) {
+  for (int i = 0; i < width; i++) out += (char) (value >> (8 * i));
+}
+
+void
+Tree::save_checkpoint(std::string path, std::string store_mark) {
+  std::unordered_map<const linked<block>*, uint32_t> node_index;
+  std::string out(CHECKPOINT_MAGIC, 4);
+  put_le(out, CHECKPOINT_VERSION, 4);
+  put_le(out, (uint32_t) this->pow, 4);
+  put_le(out, store_mark.size(), 4);
+  out += store_mark;
+
+  put_le(out, (this->graph).size(), 4);
+  for (const auto& [trip, node] : this->graph) {
+    if (trip.size() > 0xFF) throw std::runtime_error("trip too long to checkpoint");
+    node_index[&node] = node_index.size();
+    out += (char) trip.size();
+    out += trip;
+  }
+
+  std::string edges;
+  uint64_t edge_count = 0;
+  for (const auto& [trip, node] : this->graph) {
+    for (const auto* parent : node.parents) {
+      put_le(edges, node_index[&node], 4);
+      put_le(edges, node_index.at(parent), 4);
+      edge_count++;
+    }
+  }
+  put_le(out, edge_count, 8);
+  out += edges;
+
+  put_le(out, (this->rooted && this->graph_root) ? node_index.at(this->graph_root) : CHECKPOINT_NO_ROOT, 4);
+  put_le(out, (this->server_roots).size(), 4);
+  for (const auto& [s_trip, root] : this->server_roots) {
+    out += (char) s_trip.size();
+    out += s_trip;
+    put_le(out, node_index.at(root), 4);
+  }
+  put_le(out, gen::crc(out), 4);
+
+  // write aside and swap in, so a crash leaves either the old checkpoint or the new one
+  std::string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) throw std::runtime_error("can't write checkpoint " + tmp_path);
+  size_t done = 0;
+  while (done < out.size()) {
+    ssize_t n = write(fd, out.data() + done, out.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      close(fd);
+      throw std::runtime_error(std::string("checkpoint write failed: ") + std::strerror(errno));
+    }
+    done += n;
+  }
+  fsync(fd);
+  close(fd);
+  std::filesystem::rename(tmp_path, path);
+}
+
+bool
+Tree::restore_checkpoint(
+    std::string path,
+    std::unordered_set<block>& blocks,
+    std::function<bool(std::string_view)> mark_ok
+  ) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < 4) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) return false;
+  std::unique_ptr<void, std::function<void(void*)>> unmap(addr, [&st](void* a) { munmap(a, st.st_size); });
+  std::string_view data((const char*) addr, st.st_size);
+
+  // parse everything before touching the graph
+  size_t pos = 0;
+  bool ok = true;
+  auto get_int = [&](int width) -> uint64_t {
+    if (!ok || data.size() - pos < (size_t) width) {
+      ok = false;
+      return 0;
+    }
+    uint64_t value = 0;
+    for (int i = 0; i < width; i++) value |= (uint64_t) (unsigned char) data[pos + i] << (8 * i);
+    pos += width;
+    return value;
+  };
+  auto get_str = [&](size_t len) -> std::string_view {
+    if (!ok || data.size() - pos < len) {
+      ok = false;
+      return std::string_view();
+    }
+    std::string_view str = data.substr(pos, len);
+    pos += len;
+    return str;
+  };
+
+  std::string_view body = data.substr(0, data.size() - 4);
+  pos = body.size();
+  if (get_int(4) != gen::crc(body)) return false;
+  pos = 0;
+  if (get_str(4) != std::string_view(CHECKPOINT_MAGIC, 4) || get_int(4) != CHECKPOINT_VERSION) return false;
+  int checkpoint_pow = (int) get_int(4);
+  std::string_view store_mark = get_str(get_int(4));
+  if (!ok || !mark_ok(store_mark)) return false;
+
+  size_t node_count = get_int(4);
+  std::vector<std::unordered_set<block>::iterator> node_blocks;
+  node_blocks.reserve(ok ? std::min(node_count, body.size()) : 0);
+  std::unordered_set<std::string_view> seen;
+  block key;
+  for (size_t i = 0; ok && i < node_count; i++) {
+    std::string_view trip = get_str(get_int(1));
+    if (!seen.insert(trip).second) return false;
+    key.hash = trip;
+    auto found = blocks.find(key);
+    if (found == blocks.end()) return false; // the store lost a checkpointed block
+    node_blocks.push_back(found);
+  }
+
+  uint64_t edge_count = get_int(8);
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+  edges.reserve(ok ? std::min<uint64_t>(edge_count, body.size() / 8) : 0);
+  for (uint64_t i = 0; ok && i < edge_count; i++) {
+    uint32_t child = get_int(4), parent = get_int(4);
+    if (child >= node_count || parent >= node_count) return false;
+    edges.push_back({child, parent});
+  }
+
+  uint32_t root = get_int(4);
+  if (root != CHECKPOINT_NO_ROOT && root >= node_count) return false;
+  size_t server_root_count = get_int(4);
+  std::vector<std::pair<std::string, uint32_t>> checkpoint_server_roots;
+  for (size_t i = 0; ok && i < server_root_count; i++) {
+    std::string s_trip(get_str(get_int(1)));
+    uint32_t index = get_int(4);
+    if (index >= node_count) return false;
+    checkpoint_server_roots.push_back({s_trip, index});
+  }
+  if (!ok || pos != body.size()) return false;
+
+  // swap the graph in; the indexes view the old graph's keys, so they're emptied first and rebuilt by reindex
+  {
+    std::unique_lock lk(this->time_index_mtx);
+    (this->time_index).clear();
+    (this->user_index).clear();
+  }
+  (this->graph).clear();
+  (this->server_roots).clear();
+  std::vector<linked<block>*> nodes;
+  nodes.reserve(node_count);
+  for (const auto& node_block : node_blocks) {
+    linked<block>& node = (this->graph)[node_block->hash];
+    node.trip = node_block->hash;
+    node.ref = *node_block;
+    nodes.push_back(&node);
+  }
+  for (const auto& [child, parent] : edges) {
+    nodes[child]->parents.insert(nodes[parent]);
+    nodes[parent]->children.insert(nodes[child]);
+  }
+  this->rooted = (root != CHECKPOINT_NO_ROOT);
+  this->graph_root = (this->rooted) ? nodes[root] : nullptr;
+  for (const auto& [s_trip, index] : checkpoint_server_roots) (this->server_roots)[s_trip] = nodes[index];
+  this->pow = checkpoint_pow;
+
+  recount_memory();
+  std::map<std::string, memory_usage> index_deltas;
+  for (const auto& [s_trip, root] : this->server_roots) index_deltas[s_trip].indexes += server_root_memory(s_trip);
+  account_memory(index_deltas);
+  reindex();
+  reseed_seen();
+
+  for (const auto& node_block : node_blocks) blocks.erase(node_block);
+  return true;
+}
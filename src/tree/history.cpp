@@ -0,0 +1,173 @@
+#include "../../inc/tree.hpp"
+
+// index bytes, shared by indexing and set_user_index so that disabling hands back exactly what was counted
+static int64_t
+cursor_bytes() {
+  return memsize::chunk(4 * sizeof(void*) + sizeof(time_cursor));
+}
+
+static int64_t
+user_bytes(const std::string& c_trip) {
+  using shards = std::map<std::string, std::set<time_cursor>>;
+  return memsize::chunk(sizeof(void*) + sizeof(std::string) + sizeof(shards) + sizeof(size_t)) + sizeof(void*) + memsize::string(c_trip);
+}
+
+static int64_t
+shard_bytes(const std::string& s_trip) {
+  return memsize::map_entry<std::string, std::set<time_cursor>>() + memsize::string(s_trip);
+}
+
+int64_t
+Tree::index_time(const linked<block>& node) {
+  int64_t added = cursor_bytes();
+  auto server = (this->time_index).find(node.ref.s_trip);
+  if (server == (this->time_index).end()) {
+    server = (this->time_index).emplace(node.ref.s_trip, std::set<time_cursor>()).first;
+    added += memsize::map_entry<std::string, std::set<time_cursor>>() + memsize::string(node.ref.s_trip);
+  }
+  return (server->second).insert({node.ref.time, node.trip}).second ? added : 0;
+}
+
+void
+Tree::index_user(const linked<block>& node, std::map<std::string, memory_usage>& index_deltas) {
+  if (node.ref.c_trip.empty()) return;
+  auto user = (this->user_index).find(node.ref.c_trip);
+  if (user == (this->user_index).end()) {
+    user = (this->user_index).emplace(node.ref.c_trip, std::map<std::string, std::set<time_cursor>>()).first;
+    index_deltas[std::string()].indexes += user_bytes(node.ref.c_trip);
+  }
+  auto shard = (user->second).find(node.ref.s_trip);
+  if (shard == (user->second).end()) {
+    shard = (user->second).emplace(node.ref.s_trip, std::set<time_cursor>()).first;
+    index_deltas[node.ref.s_trip].indexes += shard_bytes(node.ref.s_trip);
+  }
+  if ((shard->second).insert({node.ref.time, node.trip}).second) index_deltas[node.ref.s_trip].indexes += cursor_bytes();
+}
+
+void
+Tree::reindex() {
+  std::map<std::string, memory_usage> index_deltas;
+  {
+    std::unique_lock lk(this->time_index_mtx);
+    (this->time_index).clear();
+    (this->user_index).clear();
+    for (const auto& [hash, node] : this->graph) {
+      index_deltas[node.ref.s_trip].indexes += index_time(node);
+      if (this->user_indexed) index_user(node, index_deltas);
+    }
+  }
+  account_memory(index_deltas);
+}
+
+std::vector<time_cursor>
+Tree::get_time_range(
+    std::string s_trip,
+    unsigned long long from,
+    unsigned long long to,
+    size_t limit
+  ) {
+  std::shared_lock lk(this->time_index_mtx);
+  std::vector<time_cursor> out;
+  auto server = (this->time_index).find(s_trip);
+  if (server == (this->time_index).end() || from > to) return out;
+  const std::set<time_cursor>& history = server->second;
+  // an empty view sorts first among equal times
+  for (auto it = history.lower_bound({from, std::string_view()}); it != history.end() && it->time <= to && out.size() < limit; it++) {
+    out.push_back(*it);
+  }
+  return out;
+}
+
+std::vector<time_cursor>
+Tree::get_latest(std::string s_trip, size_t count) {
+  std::shared_lock lk(this->time_index_mtx);
+  std::vector<time_cursor> out;
+  auto server = (this->time_index).find(s_trip);
+  if (server == (this->time_index).end()) return out;
+  const std::set<time_cursor>& history = server->second;
+  for (auto it = history.rbegin(); it != history.rend() && out.size() < count; it++) out.push_back(*it);
+  return out;
+}
+
+std::vector<time_cursor>
+Tree::get_before(std::string s_trip, time_cursor cursor, size_t count) {
+  std::shared_lock lk(this->time_index_mtx);
+  std::vector<time_cursor> out;
+  auto server = (this->time_index).find(s_trip);
+  if (server == (this->time_index).end()) return out;
+  const std::set<time_cursor>& history = server->second;
+  for (auto it = std::make_reverse_iterator(history.lower_bound(cursor)); it != history.rend() && out.size() < count; it++) {
+    out.push_back(*it);
+  }
+  return out;
+}
+
+std::vector<time_cursor>
+Tree::get_after(std::string s_trip, time_cursor cursor, size_t count) {
+  std::shared_lock lk(this->time_index_mtx);
+  std::vector<time_cursor> out;
+  auto server = (this->time_index).find(s_trip);
+  if (server == (this->time_index).end()) return out;
+  const std::set<time_cursor>& history = server->second;
+  for (auto it = history.upper_bound(cursor); it != history.end() && out.size() < count; it++) out.push_back(*it);
+  return out;
+}
+
+void
+Tree::set_user_index(bool enabled) {
+  std::lock_guard push_lk(this->push_proc_mtx);
+  if (enabled == this->user_indexed) return;
+  std::map<std::string, memory_usage> index_deltas;
+  {
+    std::unique_lock lk(this->time_index_mtx);
+    this->user_indexed = enabled;
+    if (enabled) {
+      for (const auto& [hash, node] : this->graph) index_user(node, index_deltas);
+    } else {
+      for (const auto& [c_trip, shards] : this->user_index) {
+        index_deltas[std::string()].indexes -= user_bytes(c_trip);
+        for (const auto& [s_trip, history] : shards) index_deltas[s_trip].indexes -= shard_bytes(s_trip) + history.size() * cursor_bytes();
+      }
+      (this->user_index).clear();
+    }
+  }
+  account_memory(index_deltas);
+}
+
+std::vector<time_cursor>
+Tree::get_user_blocks(
+    std::string c_trip,
+    size_t count,
+    std::optional<time_cursor> before,
+    unsigned long long from,
+    unsigned long long to,
+    std::string s_trip
+  ) {
+  std::shared_lock lk(this->time_index_mtx);
+  if (!this->user_indexed) throw std::runtime_error("user index is off");
+  std::vector<time_cursor> out;
+  auto user = (this->user_index).find(c_trip);
+  if (user == (this->user_index).end() || from > to) return out;
+
+  // one run per 'server', each walked newest first from just under the bounds; merged by taking the newest head
+  using run = std::pair<std::set<time_cursor>::const_iterator, std::set<time_cursor>::const_iterator>; // first, past the next
+  auto newer = [](const run& x, const run& y) {return *std::prev(x.second) < *std::prev(y.second);};
+  std::priority_queue<run, std::vector<run>, decltype(newer)> heads(newer);
+  for (const auto& [shard_trip, history] : user->second) {
+    if (!s_trip.empty() && shard_trip != s_trip) continue;
+    auto end = history.end();
+    if (to != ULLONG_MAX) end = history.lower_bound({to + 1, std::string_view()});
+    if (before && (end == history.end() || *before < *end)) end = history.lower_bound(*before);
+    if (end != history.begin()) heads.push({history.begin(), end});
+  }
+
+  while (out.size() < count && !heads.empty()) {
+    run head = heads.top();
+    heads.pop();
+    const time_cursor& next = *std::prev(head.second);
+    if (next.time < from) continue; // the rest of this run is older still
+    out.push_back(next);
+    if (--head.second != head.first) heads.push(head);
+  }
+  return out;
+}
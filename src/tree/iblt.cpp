@@ -0,0 +1,159 @@
+#include "../../inc/iblt.hpp"
+#include "../../inc/strops.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+/**
+ * packed layout, little-endian:
+ * magic (4) | cell count (4) | cells (count (4), key sum (IBLT_KEYLEN), check sum (8))
+ */
+static const char IBLT_MAGIC[4] = {'C', 'I', 'B', 'L'};
+
+static uint64_t
+mix(uint64_t x) {
+  // splitmix64's finalizer
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ull;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBull;
+  return x ^ (x >> 31);
+}
+
+static uint64_t
+fold(const std::array<uint8_t, IBLT_KEYLEN>& key) {
+  uint64_t h = 0;
+  for (size_t i = 0; i < IBLT_KEYLEN; i += 8) {
+    // little-endian words, so hosts of either byte order place keys in the same cells
+    uint64_t word = 0;
+    for (size_t b = 0; b < 8; b++) word |= (uint64_t) key[i + b] << (8 * b);
+    h = mix(h ^ word);
+  }
+  return h;
+}
+
+IBLT::IBLT(size_t cells) : cells((std::max<size_t>(cells, 1) + IBLT_HASHES - 1) / IBLT_HASHES * IBLT_HASHES) {}
+
+std::array<size_t, IBLT_HASHES>
+IBLT::locate(const std::array<uint8_t, IBLT_KEYLEN>& key) const {
+  uint64_t h = fold(key);
+  size_t partition = (this->cells).size() / IBLT_HASHES;
+  std::array<size_t, IBLT_HASHES> out;
+  for (size_t i = 0; i < IBLT_HASHES; i++) out[i] = i * partition + mix(h + (i + 1) * 0x9E3779B97F4A7C15ull) % partition;
+  return out;
+}
+
+uint64_t
+IBLT::check(const std::array<uint8_t, IBLT_KEYLEN>& key) {
+  return mix(fold(key) ^ 0x5851F42D4C957F2Dull);
+}
+
+void
+IBLT::toggle(const std::array<uint8_t, IBLT_KEYLEN>& key, int sign) {
+  uint64_t key_check = check(key);
+  for (size_t index : locate(key)) {
+    cell& target = (this->cells)[index];
+    target.count += sign;
+    for (size_t i = 0; i < IBLT_KEYLEN; i++) target.key_sum[i] ^= key[i];
+    target.check_sum ^= key_check;
+  }
+}
+
+void
+IBLT::insert(const std::string& hex_key) {
+  std::string raw = hex::decode(hex_key);
+  if (raw.size() != IBLT_KEYLEN) throw std::runtime_error("IBLT keys must be " + std::to_string(IBLT_KEYLEN) + " byte digests");
+  std::array<uint8_t, IBLT_KEYLEN> key;
+  std::memcpy(key.data(), raw.data(), IBLT_KEYLEN);
+  toggle(key, 1);
+}
+
+IBLT&
+IBLT::operator-=(const IBLT& other) {
+  if (other.size() != size()) throw std::runtime_error("can't subtract IBLTs of different sizes");
+  for (size_t c = 0; c < size(); c++) {
+    cell& ours = (this->cells)[c];
+    const cell& theirs = (other.cells)[c];
+    ours.count -= theirs.count;
+    for (size_t i = 0; i < IBLT_KEYLEN; i++) ours.key_sum[i] ^= theirs.key_sum[i];
+    ours.check_sum ^= theirs.check_sum;
+  }
+  return *this;
+}
+
+iblt_diff
+IBLT::list() const {
+  IBLT peeled = *this;
+  iblt_diff out = {{}, {}, true};
+
+  // a pure cell holds exactly one key; removing it may leave other cells pure
+  auto pure = [&peeled](size_t c) {
+    const cell& target = (peeled.cells)[c];
+    return (target.count == 1 || target.count == -1) && target.check_sum == check(target.key_sum);
+  };
+  std::vector<size_t> candidates;
+  for (size_t c = 0; c < peeled.size(); c++) {
+    if (pure(c)) candidates.push_back(c);
+  }
+  while (!candidates.empty()) {
+    size_t c = candidates.back();
+    candidates.pop_back();
+    if (!pure(c)) continue; // emptied by an earlier peel
+    std::array<uint8_t, IBLT_KEYLEN> key = (peeled.cells)[c].key_sum;
+    int sign = (peeled.cells)[c].count;
+    (sign > 0 ? out.only_ours : out.only_theirs).push_back(hex::encode(std::string((const char*) key.data(), IBLT_KEYLEN)));
+    peeled.toggle(key, -sign);
+    for (size_t index : peeled.locate(key)) {
+      if (pure(index)) candidates.push_back(index);
+    }
+  }
+
+  for (const auto& target : peeled.cells) {
+    if (target.count != 0 || target.check_sum != 0) out.complete = false;
+  }
+  return out;
+}
+
+static void
+put_le(std::string& out, uint64_t value, int width) {
+  for (int i = 0; i < width; i++) out += (char) (value >> (8 * i));
+}
+
+static uint64_t
+get_le(std::string_view in, size_t pos, int width) {
+  uint64_t value = 0;
+  for (int i = 0; i < width; i++) value |= (uint64_t) (unsigned char) in[pos + i] << (8 * i);
+  return value;
+}
+
+std::string
+IBLT::pack() const {
+  std::string out(IBLT_MAGIC, 4);
+  out.reserve(8 + size() * (12 + IBLT_KEYLEN));
+  put_le(out, size(), 4);
+  for (const auto& target : this->cells) {
+    put_le(out, (uint32_t) target.count, 4);
+    out.append((const char*) target.key_sum.data(), IBLT_KEYLEN);
+    put_le(out, target.check_sum, 8);
+  }
+  return out;
+}
+
+IBLT
+IBLT::unpack(std::string_view packed) {
+  const size_t cell_len = 12 + IBLT_KEYLEN;
+  if (packed.size() < 8 || packed.substr(0, 4) != std::string_view(IBLT_MAGIC, 4)) throw std::runtime_error("not a packed IBLT");
+  size_t count = get_le(packed, 4, 4);
+  if (count == 0 || count % IBLT_HASHES != 0 || packed.size() != 8 + count * cell_len) throw std::runtime_error("malformed packed IBLT");
+
+  IBLT out(count);
+  for (size_t c = 0; c < count; c++) {
+    size_t pos = 8 + c * cell_len;
+    cell& target = (out.cells)[c];
+    target.count = (int32_t) get_le(packed, pos, 4);
+    std::memcpy(target.key_sum.data(), packed.data() + pos + 4, IBLT_KEYLEN);
+    target.check_sum = get_le(packed, pos + 4 + IBLT_KEYLEN, 8);
+  }
+  return out;
+}
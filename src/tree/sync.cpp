@@ -0,0 +1,153 @@
+#include "../../inc/tree.hpp"
+
+#include <algorithm>
+
+static const size_t WALK_CHUNK = 1024; // blocks copied out per push_proc_mtx hold in walk_topological
+static const size_t SUMMARIZE_CHUNK = 4096; // hashes copied out per time_index_mtx hold in summarize
+
+IBLT
+Tree::summarize(size_t cells, std::string s_trip) {
+  IBLT out(cells);
+  // time_index holds every linked block, by server; pushes take its lock exclusively, so hashes are copied out a chunk at a time and decoded into
+  // the table unlocked, each chunk resuming after the last hash copied. Blocks linked or dropped between chunks may be missed, which reconcile's
+  // retries absorb like any other difference.
+  std::string server = s_trip, after_hash;
+  unsigned long long after_time = 0;
+  bool resuming = false;
+  std::vector<std::string> chunk;
+  chunk.reserve(SUMMARIZE_CHUNK);
+  do {
+    chunk.clear();
+    {
+      std::shared_lock lk(this->time_index_mtx);
+      for (auto history = (this->time_index).lower_bound(server); history != (this->time_index).end(); ++history) {
+        if (!s_trip.empty() && history->first != s_trip) break;
+        auto entry = resuming && history->first == server ? (history->second).upper_bound({after_time, after_hash}) : (history->second).begin();
+        for (; entry != (history->second).end() && chunk.size() < SUMMARIZE_CHUNK; ++entry) chunk.emplace_back(entry->hash);
+        if (chunk.size() == SUMMARIZE_CHUNK) {
+          server = history->first;
+          after_time = std::prev(entry)->time;
+          after_hash = chunk.back();
+          resuming = true;
+          break;
+        }
+      }
+    }
+    for (const auto& hash : chunk) out.insert(hash);
+  } while (chunk.size() == SUMMARIZE_CHUNK);
+  return out;
+}
+
+iblt_diff
+Tree::reconcile(const IBLT& theirs, std::string s_trip) {
+  IBLT diff = summarize(theirs.size(), s_trip);
+  diff -= theirs;
+  return diff.list();
+}
+
+std::vector<block>
+Tree::export_blocks(std::unordered_set<std::string> hashes) {
+  std::lock_guard lk(this->push_proc_mtx);
+  std::erase_if(hashes, [this](const std::string& hash) {return !(this->graph).contains(hash);});
+
+  // Kahn's algorithm over the exported subgraph
+  std::unordered_map<std::string, size_t> waiting_on;
+  std::vector<std::string> ready;
+  for (const auto& hash : hashes) {
+    size_t parents = 0;
+    for (const auto& parent : (this->graph).at(hash).parents) parents += hashes.contains(parent->trip);
+    if (parents == 0) ready.push_back(hash);
+    else waiting_on[hash] = parents;
+  }
+
+  std::vector<block> out;
+  out.reserve(hashes.size());
+  while (!ready.empty()) {
+    const linked<block>& next = (this->graph).at(ready.back());
+    ready.pop_back();
+    out.push_back(next.ref);
+    for (const auto& child : next.children) {
+      auto waiting = waiting_on.find(child->trip);
+      if (waiting != waiting_on.end() && --(waiting->second) == 0) {
+        ready.push_back(child->trip);
+        waiting_on.erase(waiting);
+      }
+    }
+  }
+  return out;
+}
+
+void
+Tree::walk_topological(
+    std::function<void(const block&)> visit,
+    std::string s_trip,
+    std::unordered_set<std::string> since
+  ) {
+  std::vector<std::string> order;
+  {
+    std::lock_guard lk(this->push_proc_mtx);
+    order = walk_order(s_trip, since);
+  }
+
+  // visit runs unlocked, so a slow one (e.g. a disk write) doesn't hold up pushes; blocks are copied out a chunk at a time
+  std::vector<block> chunk;
+  chunk.reserve(std::min(order.size(), WALK_CHUNK));
+  for (size_t start = 0; start < order.size(); start += WALK_CHUNK) {
+    chunk.clear();
+    {
+      std::lock_guard lk(this->push_proc_mtx);
+      for (size_t i = start; i < std::min(order.size(), start + WALK_CHUNK); i++) {
+        // gone if a set_pow_req rebuild or checkpoint restore dropped it since; its descendants went with it
+        auto found = (this->graph).find(order[i]);
+        if (found != (this->graph).end()) chunk.push_back(found->second.ref);
+      }
+    }
+    for (const auto& visited : chunk) visit(visited);
+  }
+}
+
+std::vector<std::string>
+Tree::walk_order(const std::string& s_trip, const std::unordered_set<std::string>& since) {
+  // what the other side already has: the since blocks and everything under them
+  std::unordered_set<const linked<block>*> excluded;
+  std::vector<const linked<block>*> frontier;
+  for (const auto& hash : since) {
+    auto found = (this->graph).find(hash);
+    if (found != (this->graph).end() && excluded.insert(&(found->second)).second) frontier.push_back(&(found->second));
+  }
+  while (!frontier.empty()) {
+    const linked<block>* next = frontier.back();
+    frontier.pop_back();
+    for (const auto& parent : next->parents) {
+      if (excluded.insert(parent).second) frontier.push_back(parent);
+    }
+  }
+
+  auto included = [&](const linked<block>* node) {
+    return !excluded.contains(node) && (s_trip.empty() || node->ref.s_trip == s_trip);
+  };
+
+  // Kahn's algorithm, counting only included parents
+  std::unordered_map<const linked<block>*, size_t> waiting_on;
+  std::vector<const linked<block>*> ready;
+  std::vector<std::string> out;
+  for (const auto& [hash, node] : this->graph) {
+    if (!included(&node)) continue;
+    size_t parents = std::count_if(node.parents.begin(), node.parents.end(), included);
+    if (parents == 0) ready.push_back(&node);
+    else waiting_on[&node] = parents;
+  }
+  while (!ready.empty()) {
+    const linked<block>* next = ready.back();
+    ready.pop_back();
+    out.push_back(next->trip);
+    for (const auto& child : next->children) {
+      auto waiting = waiting_on.find(child);
+      if (waiting != waiting_on.end() && --(waiting->second) == 0) {
+        ready.push_back(child);
+        waiting_on.erase(waiting);
+      }
+    }
+  }
+  return out;
+}
@@ -2,12 +2,19 @@
 #include <algorithm>
 
 
-Tree::Tree() {}
+tree_metrics::tree_metrics(const metric_labels& instance, MetricsRegistry& registry) :
+  invalid(registry.counter("concord_push_rejected_total", "Vertices rejected by pushes", with_labels(instance, {{"reason", "invalid"}}))),
+  extra_root(registry.counter("concord_push_rejected_total", "Vertices rejected by pushes", with_labels(instance, {{"reason", "extra_root"}}))),
+  server_orphan(registry.counter("concord_push_rejected_total", "Vertices rejected by pushes", with_labels(instance, {{"reason", "server_orphan"}}))),
+  callback(registry.histogram("concord_callback_seconds", "Time spent in server_add_funcs callbacks", instance, 1e-9)) {}
+
+Tree::Tree(std::string name) : graph_model(name), tree_stats(get_metric_instance()) {}
 
 void 
 Tree::graph_configure(block root) {
   // for now, just extract POW threshold
-  json config = json::parse(root.cont);
+  std::string_view root_cont = root.cont.view();
+  json config = json::parse(root_cont.begin(), root_cont.end());
   if (config.contains("pow")) set_pow_req((int) config["pow"]);
 }
 
@@ -22,8 +29,22 @@ Tree::set_pow_req(int POW_req) {
   std::unordered_set<block> known_blocks;
   for (const auto& [hash, l_block] : get_graph()) known_blocks.insert(l_block.ref);
     
+  // start from nothing, so the old root and server roots are found again rather than rejected against themselves
+  // the indexes view the graph's keys, so they go first, before a reader can compare against freed nodes
+  {
+    std::unique_lock lk(this->time_index_mtx);
+    (this->time_index).clear();
+    (this->user_index).clear();
+  }
   (this->graph).clear();
+  (this->server_roots).clear();
+  this->graph_root = nullptr;
+  this->rooted = false;
   std::queue<std::unordered_set<block>>().swap((this->awaiting_push_batches));
+  (this->push_stats).queue_depth.set(0);
+  reset_memory();
+  account_memory({{std::string(), {.queued = -get_memory().current.queued}}});
+  reseed_seen();
   batch_push(known_blocks);
 }
 
@@ -56,6 +77,7 @@ Tree::create_root() {
 
 std::unordered_set<block> 
 Tree::get_valid(std::unordered_set<block> to_check) {
+  TRACE_SPAN("get_valid", to_check.size());
   bool root_found = check_rooted();
   std::unordered_set<std::string> rooted_servers;
   for (const auto& [s_trip, root] : (this->server_roots)) rooted_servers.insert(s_trip);
@@ -63,14 +85,20 @@ Tree::get_valid(std::unordered_set<block> to_check) {
   std::map<std::string, std::string> s_trip_by_hash;
   for (const auto& tc_block : to_check) s_trip_by_hash[tc_block.hash] = tc_block.s_trip;
 
+  std::unordered_set<block> valid;
   for (const auto& tc_block : to_check) {
-    if (!tc_block.verify(get_pow_req())) {
-      to_check.erase(tc_block);
+    if (!tc_block.verify(get_pow_req(), this->rehash_blocks)) {
+      (this->tree_stats).invalid.inc();
       continue;
     }
-
-    if (is_orphan(tc_block.hash)) {
-      if (root_found) to_check.erase(tc_block);
+    bool keep = true;
+
+    // blocks being checked aren't in the graph yet, so orphans are the ones without parents
+    if (tc_block.p_hashes.empty()) {
+      if (root_found) {
+        keep = false;
+        (this->tree_stats).extra_root.inc();
+      }
       else root_found = true;
     }
 
@@ -80,18 +108,23 @@ Tree::get_valid(std::unordered_set<block> to_check) {
             s_trip_by_hash.contains(p_hash) 
             && s_trip_by_hash[p_hash] == tc_block.s_trip
           ) || (
-            get_graph().contains(p_hash) 
-            && get_graph()[p_hash].ref.s_trip == tc_block.s_trip
+            (this->graph).contains(p_hash) 
+            && (this->graph)[p_hash].ref.s_trip == tc_block.s_trip
           )) intra_orphan = false;
     }
 
     if (intra_orphan) {
-      if (rooted_servers.contains(tc_block.s_trip)) to_check.erase(tc_block);
+      if (rooted_servers.contains(tc_block.s_trip)) {
+        if (keep) (this->tree_stats).server_orphan.inc();
+        keep = false;
+      }
       else rooted_servers.insert(tc_block.s_trip);
     }
+
+    if (keep) valid.insert(tc_block);
   }
   
-  return to_check;
+  return valid;
 }
 
 /**
@@ -106,17 +139,56 @@ Tree::push_response(
     std::unordered_set<std::string> new_trips, 
     std::unordered_set<std::string> flags 
   ) {
+  TRACE_SPAN("push_response", new_trips.size());
   bool save_new = !flags.contains("no-save"); 
   std::map<std::string, std::unordered_set<std::string>> server_batches;
+  std::map<std::string, memory_usage> index_deltas;
+  {
+    std::unique_lock lk(this->time_index_mtx);
+    for (const auto& new_trip : new_trips) {
+      const linked<block>& new_node = (this->graph).at(new_trip);
+      index_deltas[new_node.ref.s_trip].indexes += index_time(new_node);
+      if (this->user_indexed) index_user(new_node, index_deltas);
+    }
+  }
   for (const auto& new_trip : new_trips) {
-    block new_block = get_graph()[new_trip].ref;
+    const block& new_block = (this->graph).at(new_trip).ref;
 
-    if (is_intraserver_orphan(new_trip)) 
+    if (is_intraserver_orphan(new_trip)) {
+      if (!(this->server_roots).contains(new_block.s_trip)) index_deltas[new_block.s_trip].indexes += server_root_memory(new_block.s_trip);
       (this->server_roots)[new_block.s_trip] = &((this->graph)[new_trip]);
+    }
     if (save_new) save(new_block);
 
     server_batches[new_block.s_trip].insert(new_trip);
   }
+  account_memory(index_deltas);
+
+  for (const auto& [s_trip, batch] : server_batches) {
+    if (!server_add_funcs.contains(s_trip)) continue;
+    TRACE_SPAN("server_add_func", batch.size());
+    ScopedTimer timer((this->tree_stats).callback);
+    server_add_funcs[s_trip](batch);
+  }
+}
+
+memory_usage
+Tree::vertex_memory(const block& target) {
+  memory_usage out;
+  out.content = memsize::string(target.hash) + memsize::string(target.nonce) + memsize::string(target.s_trip) + memsize::string(target.c_trip);
+  out.content += target.p_hashes.size() * memsize::set_entry<std::string>();
+  for (const auto& p_hash : target.p_hashes) out.content += memsize::string(p_hash);
+  out.content += target.cont.heap_bytes();
+  out.mapped = target.cont.source_bytes();
+  return out;
+}
+
+std::string
+Tree::memory_group(const block& target) {
+  return target.s_trip;
+}
 
-  for (const auto& [s_trip, batch] : server_batches) server_add_funcs[s_trip](batch);
+int64_t
+Tree::server_root_memory(const std::string& s_trip) {
+  return memsize::map_entry<std::string, linked<block>*>() + memsize::string(s_trip);
 }
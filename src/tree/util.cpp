@@ -65,8 +65,8 @@ Tree::is_orphan(std::string to_check) {
 
 bool 
 Tree::is_intraserver_childless(std::string to_check) {
-  linked<block> tcl_block = get_graph()[to_check];
-  std::string server_trip = tcl_block.ref.s_trip;
+  const linked<block>& tcl_block = (this->graph).at(to_check);
+  const std::string& server_trip = tcl_block.ref.s_trip;
 
   for (const auto& child : tcl_block.children) {
     if (child->ref.s_trip == server_trip) return false;
@@ -77,8 +77,8 @@ Tree::is_intraserver_childless(std::string to_check) {
 
 bool
 Tree::is_intraserver_orphan(std::string to_check) {
-  linked<block> tcl_block = get_graph()[to_check];
-  std::string server_trip = tcl_block.ref.s_trip;
+  const linked<block>& tcl_block = (this->graph).at(to_check);
+  const std::string& server_trip = tcl_block.ref.s_trip;
   for (const auto& parent : tcl_block.parents) {
     if (parent->ref.s_trip == server_trip) return false;
   }